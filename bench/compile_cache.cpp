@@ -0,0 +1,96 @@
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+#include "vm/compile_cache.hpp"
+#include "vm/virtual_machine.hpp"
+
+// Runs a handful of scripts over and over through RVM::Run(source), the way
+// a service evaluating the same requests does, and reports the time per
+// run without a cache, with an in-memory cache, with a cache smaller than
+// the set of scripts, and for the first run of each script with a fresh
+// in-memory cache over a warm directory, which is what a restarted process
+// sees.
+//
+// usage: ravi_bench_compile_cache [statements] [runs] [scripts]
+
+static std::string Generate(std::size_t statements, std::uint64_t seed) {
+
+	std::mt19937_64 random(seed);
+	auto below = [&random](std::size_t bound) { return std::size_t(random() % bound); };
+
+	static constexpr const char* Literals[] = { "1", "2", "3", "7", "10", "0.5", "1.25", "4.75" };
+	static constexpr const char* Operators[] = { " + ", " - ", " * ", " / " };
+
+	std::string source;
+	for (std::size_t i = 0; i < statements; i++) {
+		std::size_t terms = 2 + below(6);
+		source += "(";
+		for (std::size_t t = 0; t < terms; t++) {
+			if (t > 0)
+				source += Operators[below(std::size(Operators))];
+			source += Literals[below(std::size(Literals))];
+		}
+		source += ") < 100;\n";
+	}
+	return source;
+}
+
+static double Measure(const std::vector<std::string>& scripts, std::size_t runs, VM::CompileCache* cache) {
+
+	VM::RVM rvm;
+	rvm.SetJitThreshold(0);
+	rvm.SetCompileCache(cache);
+
+	auto start = std::chrono::steady_clock::now();
+	for (std::size_t i = 0; i < runs; i++)
+		if (rvm.Run(scripts[i % scripts.size()]) != VM::InterpreteResult::OK)
+			std::exit(1);
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / double(runs);
+}
+
+static void Report(const char* name, double run, double baseline, const VM::CompileCache* cache) {
+
+	std::cout << name << ": " << run << " us per run (" << baseline / run << "x)";
+	if (cache)
+		std::cout << ", " << cache->Hits() << " hits, " << cache->DiskHits() << " from disk, "
+			<< cache->Misses() << " misses, " << cache->Evictions() << " evictions";
+	std::cout << "\n";
+}
+
+int main(int argc, char** argv) {
+
+	std::size_t statements = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000;
+	std::size_t runs = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 400;
+	std::size_t count = argc > 3 ? std::max<std::size_t>(1, std::strtoul(argv[3], nullptr, 10)) : 4;
+
+	std::vector<std::string> scripts;
+	for (std::size_t i = 0; i < count; i++)
+		scripts.push_back(Generate(statements, i + 1));
+
+	double baseline = Measure(scripts, runs, nullptr);
+	Report("no cache", baseline, baseline, nullptr);
+
+	VM::CompileCache memory;
+	Report("memory", Measure(scripts, runs, &memory), baseline, &memory);
+
+	// Round robin over more scripts than fit evicts every entry before its
+	// next use: the worst case, every run a miss.
+	VM::CompileCache small(count - 1);
+	Report("memory, too small", Measure(scripts, runs, &small), baseline, &small);
+
+	std::filesystem::path directory = std::filesystem::temp_directory_path() / "ravi_bench_compile_cache";
+	std::filesystem::remove_all(directory);
+	{
+		VM::CompileCache writer(VM::CompileCache::DefaultCapacity, directory.string());
+		Measure(scripts, count, &writer);
+	}
+	VM::CompileCache restarted(VM::CompileCache::DefaultCapacity, directory.string());
+	Report("restarted, warm directory", Measure(scripts, count, &restarted), baseline, &restarted);
+	std::filesystem::remove_all(directory);
+
+	return 0;
+}
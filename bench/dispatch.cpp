@@ -0,0 +1,278 @@
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <algorithm>
+#include "vm/chunk.hpp"
+#include "vm/virtual_machine.hpp"
+#include "vm/trace.hpp"
+#include "vm/peephole.hpp"
+
+// Runs a long straight-line opcode sequence through RVM::Run and reports the
+// time per executed instruction. The block mixes every arithmetic opcode so
+// the dispatch sites see a realistic, not perfectly periodic, pattern.
+// The same program is then timed after the peephole pass, on the register
+// engine, and with the ring trace on, without and with the top of the
+// stack in each record, reporting instruction counts and relative times.
+// The block is then rebuilt with the Number_* and the
+// Integer_* opcodes the type checker emits for proven operands, and timed
+// against the generic one together with the tag checks each run executes.
+// Then generic opcodes on integer operands run with and without
+// quickening. Those runs all keep the JIT off. Last, machine code from the
+// JIT is timed against the interpreter on a chunk of at most HotBlocks
+// blocks: a hot chunk's code stays in the caches, while megabytes of
+// straight-line machine code would be fetched from memory on every run.
+// The JIT would fold the constant block away, so it is timed without
+// folding, then with it, and on a chunk that takes a side exit at its end.
+//
+// usage: ravi_bench_dispatch [blocks] [runs]
+
+static std::size_t EmitBlock(VM::Chunk& chunk, std::size_t i, bool specialized = false) {
+
+	using VM::OpCode;
+
+	chunk.WriteConstant(Value(i % 7));
+	chunk.WriteConstant(2.0);
+	chunk.Write8(specialized ? OpCode::Number_Add : OpCode::Add);
+	chunk.WriteConstant(3.0);
+	chunk.Write8(specialized ? OpCode::Number_Multiply : OpCode::Multiply);
+	chunk.Write8(specialized ? OpCode::Number_Negate : OpCode::Negate);
+	chunk.WriteConstant(1.0);
+	if (i % 2)
+		chunk.Write8(specialized ? OpCode::Number_Substract : OpCode::Substract);
+	else
+		chunk.Write8(specialized ? OpCode::Number_Add : OpCode::Add);
+	chunk.WriteConstant(4.0);
+	chunk.Write8(specialized ? OpCode::Number_Divide : OpCode::Divide);
+	chunk.Write8(OpCode::Pop);
+	return 11;
+}
+
+static std::size_t EmitIntegerBlock(VM::Chunk& chunk, std::size_t i) {
+
+	chunk.WriteConstant(Value::Integer(std::int32_t(i % 7)));
+	chunk.WriteConstant(Value::Integer(2));
+	chunk.Write8(VM::OpCode::Integer_Add);
+	chunk.WriteConstant(Value::Integer(3));
+	chunk.Write8(VM::OpCode::Integer_Multiply);
+	chunk.Write8(VM::OpCode::Integer_Negate);
+	chunk.WriteConstant(Value::Integer(1));
+	chunk.Write8(i % 2 ? VM::OpCode::Integer_Substract : VM::OpCode::Integer_Add);
+	chunk.WriteConstant(Value::Integer(4));
+	chunk.Write8(VM::OpCode::Integer_Divide);
+	chunk.Write8(VM::OpCode::Pop);
+	return 11;
+}
+
+// Generic opcodes whose operands are all integers, as they would be when
+// read from variables of unknown type; every one of them gets quickened.
+static std::size_t EmitQuickeningBlock(VM::Chunk& chunk, std::size_t i) {
+
+	const VM::OpCode opcodes[] = {
+		VM::OpCode::Add, VM::OpCode::Less, VM::OpCode::Multiply, VM::OpCode::Equal, VM::OpCode::Substract
+	};
+
+	for (VM::OpCode opcode : opcodes) {
+		chunk.WriteConstant(Value::Integer(std::int32_t(i % 7)));
+		chunk.WriteConstant(Value::Integer(3));
+		chunk.Write8(opcode);
+		chunk.Write8(VM::OpCode::Pop);
+	}
+	return 20;
+}
+
+// Instructions that test operand tags; the code is straight-line, so this is
+// also the number executed per run.
+static std::size_t TagChecks(const VM::Chunk& chunk) {
+
+	std::size_t checks = 0;
+	for (std::size_t offset = 0; offset < chunk.Size(); offset += VM::Chunk::InstructionSize(chunk.At(offset))) {
+		switch (chunk.At(offset)) {
+		case VM::OpCode::Negate:
+		case VM::OpCode::Add:
+		case VM::OpCode::Substract:
+		case VM::OpCode::Multiply:
+		case VM::OpCode::Divide:
+		case VM::OpCode::Add_Constant:
+		case VM::OpCode::Substract_Constant:
+		case VM::OpCode::Multiply_Constant:
+		case VM::OpCode::Divide_Constant:
+		case VM::OpCode::Constant_Negated:
+			checks++;
+			break;
+		default:
+			break;
+		}
+	}
+	return checks;
+}
+
+static constexpr std::size_t HotBlocks = 1000;
+
+static double TimeRuns(VM::RVM& rvm, std::size_t runs) {
+
+	// Warm up caches and the branch predictor before timing.
+	rvm.Run();
+
+	auto start = std::chrono::steady_clock::now();
+	for (std::size_t i = 0; i < runs; i++)
+		rvm.Run();
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+
+	std::size_t blocks = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+	std::size_t runs = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 50;
+
+	VM::Chunk chunk;
+	std::size_t instructions = 1;
+	for (std::size_t i = 0; i < blocks; i++)
+		instructions += EmitBlock(chunk, i);
+	chunk.Write8(VM::OpCode::End);
+
+	VM::RVM rvm(chunk);
+	rvm.SetJitThreshold(0);
+	if (rvm.Run() != VM::InterpreteResult::OK)
+		return 1;
+
+	double plain = TimeRuns(rvm, runs);
+
+	VM::Chunk fused_chunk = chunk;
+	VM::Peephole::Optimize(fused_chunk);
+	VM::RVM fused(fused_chunk);
+	fused.SetJitThreshold(0);
+	double fused_time = TimeRuns(fused, runs);
+
+	VM::RVM registers(chunk);
+	registers.SetEngine(VM::Engine::Register);
+	if (registers.Run() != VM::InterpreteResult::OK)
+		return 1;
+	double register_time = TimeRuns(registers, runs);
+	std::size_t register_instructions = registers.RegisterChunk().InstructionCount();
+
+	VM::Chunk number_chunk;
+	for (std::size_t i = 0; i < blocks; i++)
+		EmitBlock(number_chunk, i, true);
+	number_chunk.Write8(VM::OpCode::End);
+
+	VM::RVM numbers(number_chunk);
+	numbers.SetJitThreshold(0);
+	if (numbers.Run() != VM::InterpreteResult::OK)
+		return 1;
+	double number_time = TimeRuns(numbers, runs);
+
+	VM::Chunk integer_chunk;
+	for (std::size_t i = 0; i < blocks; i++)
+		EmitIntegerBlock(integer_chunk, i);
+	integer_chunk.Write8(VM::OpCode::End);
+
+	VM::RVM integers(integer_chunk);
+	integers.SetJitThreshold(0);
+	if (integers.Run() != VM::InterpreteResult::OK)
+		return 1;
+	double integer_time = TimeRuns(integers, runs);
+
+	VM::Chunk generic_chunk;
+	std::size_t generic_instructions = 1;
+	for (std::size_t i = 0; i < blocks; i++)
+		generic_instructions += EmitQuickeningBlock(generic_chunk, i);
+	generic_chunk.Write8(VM::OpCode::End);
+
+	VM::RVM unquickened(generic_chunk);
+	unquickened.SetJitThreshold(0);
+	unquickened.SetQuickening(false);
+	double unquickened_time = TimeRuns(unquickened, runs);
+
+	VM::RVM quickened(generic_chunk);
+	quickened.SetJitThreshold(0);
+	double quickened_time = TimeRuns(quickened, runs);
+
+	std::size_t hot_blocks = std::min(blocks, HotBlocks);
+	std::size_t hot_runs = runs * blocks / hot_blocks;
+	VM::Chunk hot_chunk;
+	std::size_t hot_instructions = 1;
+	for (std::size_t i = 0; i < hot_blocks; i++)
+		hot_instructions += EmitBlock(hot_chunk, i);
+	hot_chunk.Write8(VM::OpCode::End);
+
+	VM::RVM hot(hot_chunk);
+	hot.SetJitThreshold(0);
+	double hot_time = TimeRuns(hot, hot_runs);
+
+	VM::RVM jit(hot_chunk);
+	jit.SetJitThreshold(1);
+	jit.SetJitFolding(false);
+	double jit_time = TimeRuns(jit, hot_runs);
+
+	VM::RVM folded(hot_chunk);
+	folded.SetJitThreshold(1);
+	double folded_time = TimeRuns(folded, hot_runs);
+
+	// An integer operand at the end takes a side exit on every run.
+	VM::Chunk exit_chunk;
+	for (std::size_t i = 0; i < hot_blocks; i++)
+		EmitBlock(exit_chunk, i);
+	exit_chunk.WriteConstant(Value::Integer(1));
+	exit_chunk.WriteConstant(2.0);
+	exit_chunk.Write8(VM::OpCode::Add);
+	exit_chunk.Write8(VM::OpCode::Pop);
+	exit_chunk.Write8(VM::OpCode::End);
+
+	VM::RVM exit_interpreter(exit_chunk);
+	exit_interpreter.SetJitThreshold(0);
+	double exit_interpreted = TimeRuns(exit_interpreter, hot_runs);
+
+	VM::RVM exits(exit_chunk);
+	exits.SetJitThreshold(1);
+	exits.SetJitFolding(false);
+	double exit_time = TimeRuns(exits, hot_runs);
+
+	// The fastest of a few alternating rounds each, so that noise on a
+	// shared machine does not skew the ratios.
+	VM::RingTrace ring;
+	double untraced = 0.0, traced = 0.0, traced_top = 0.0;
+	auto fastest = [](double& best, double time) { best = best == 0.0 ? time : std::min(best, time); };
+	for (int round = 0; round < 5; round++) {
+		rvm.SetTraceRing(nullptr);
+		fastest(untraced, TimeRuns(rvm, runs));
+		rvm.SetTraceRing(&ring);
+		ring.SetCaptureTop(false);
+		fastest(traced, TimeRuns(rvm, runs));
+		ring.SetCaptureTop(true);
+		fastest(traced_top, TimeRuns(rvm, runs));
+	}
+
+#ifdef RAVI_COMPUTED_GOTO
+	const char* mode = "computed goto";
+#else
+	const char* mode = "switch";
+#endif
+
+	double executed = double(instructions * runs);
+	std::cout << "dispatch (" << mode << "): " << instructions << " instructions x " << runs << " runs, "
+		<< plain / executed << " ns/instruction\n";
+	std::cout << "peephole: " << fused_chunk.InstructionCount() << " instructions, "
+		<< fused_time / plain << "x the stack engine's time\n";
+	std::cout << "register engine: " << register_instructions << " instructions, "
+		<< register_time / double(instructions * runs) << " ns per stack instruction ("
+		<< register_time / plain << "x the stack engine's time)\n";
+	std::cout << "Number_* opcodes: " << number_time / executed << " ns/instruction ("
+		<< number_time / plain << "x the generic time), " << TagChecks(number_chunk) << " tag checks per run, generic "
+		<< TagChecks(chunk) << ", after peephole " << TagChecks(fused_chunk) << "\n";
+	std::cout << "Integer_* opcodes: " << integer_time / executed << " ns/instruction ("
+		<< integer_time / plain << "x the generic time), " << TagChecks(integer_chunk) << " tag checks per run\n";
+	std::cout << "quickening: " << quickened.CurrentChunk().Quickened() << " quickened, "
+		<< quickened.CurrentChunk().Deoptimized() << " deoptimized, generic opcodes on integers "
+		<< quickened_time / double(generic_instructions * runs) << " ns/instruction ("
+		<< quickened_time / unquickened_time << "x without quickening)\n";
+	std::cout << "jit: " << hot_instructions << " instructions x " << hot_runs << " runs, "
+		<< jit_time / double(hot_instructions * hot_runs) << " ns/instruction (" << jit_time / hot_time
+		<< "x the stack engine's time), " << jit.JitRuns() << " runs as machine code, "
+		<< folded_time / hot_time << "x with constants folded\n";
+	std::cout << "jit side exits: " << exits.JitExits() << " exits, " << exit_time / exit_interpreted
+		<< "x the stack engine's time, " << 100.0 * double(exits.JitTime().count()) / exit_time
+		<< "% of it in machine code\n";
+	std::cout << "ring trace: " << traced / executed << " ns/instruction ("
+		<< traced / untraced << "x), " << traced_top / untraced << "x with the top of the stack\n";
+	return 0;
+}
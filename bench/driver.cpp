@@ -0,0 +1,101 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "vm/driver.hpp"
+
+// Writes a generated corpus of script files to a temporary directory and
+// compiles it with Driver::CompileAll on 1, 2, 4 ... workers up to the
+// hardware threads, or the given count, reporting the time and the speedup
+// over one worker. Files vary in size, as a real corpus does, which the
+// workers' one file at a time scheduling evens out. The best of the runs is
+// kept, after a first one that also warms the page cache.
+//
+// usage: ravi_bench_driver [files] [statements] [runs] [jobs]
+
+static std::string Generate(std::size_t statements, std::uint64_t seed) {
+
+	std::mt19937_64 random(seed);
+	auto below = [&random](std::size_t bound) { return std::size_t(random() % bound); };
+
+	static constexpr const char* Literals[] = { "1", "2", "3", "7", "10", "0.5", "1.25", "4.75" };
+	static constexpr const char* Operators[] = { " + ", " - ", " * ", " / " };
+
+	std::string source;
+	for (std::size_t i = 0; i < statements; i++) {
+		std::size_t terms = 2 + below(6);
+		source += "(";
+		for (std::size_t t = 0; t < terms; t++) {
+			if (t > 0)
+				source += Operators[below(std::size(Operators))];
+			source += Literals[below(std::size(Literals))];
+		}
+		source += ") < 100; // " + std::to_string(i) + "\n";
+	}
+	return source;
+}
+
+int main(int argc, char** argv) {
+
+	std::size_t files = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 256;
+	std::size_t statements = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 2000;
+	std::size_t runs = argc > 3 ? std::max<std::size_t>(1, std::strtoul(argv[3], nullptr, 10)) : 3;
+
+	std::filesystem::path directory = std::filesystem::temp_directory_path() / "ravi_bench_driver";
+	std::filesystem::remove_all(directory);
+	std::filesystem::create_directories(directory);
+
+	std::vector<std::string> paths;
+	std::uintmax_t bytes = 0;
+	for (std::size_t i = 0; i < files; i++) {
+		std::string path = (directory / ("unit" + std::to_string(i) + ".rv")).string();
+		std::string source = Generate(statements / 2 + i * 7919 % (statements + 1), i + 1);
+		std::ofstream(path, std::ios::binary) << source;
+		paths.push_back(path);
+		bytes += source.size();
+	}
+
+	std::size_t threads = argc > 4 ? std::max<std::size_t>(1, std::strtoul(argv[4], nullptr, 10))
+		: std::max(1u, std::thread::hardware_concurrency());
+	std::vector<std::size_t> jobs;
+	for (std::size_t j = 1; j < threads; j *= 2)
+		jobs.push_back(j);
+	jobs.push_back(threads);
+
+	std::cout << files << " files, " << bytes / 1024 << " KiB, " << std::thread::hardware_concurrency() << " hardware threads\n";
+
+	double baseline = 0;
+	for (std::size_t j : jobs) {
+
+		double best = 0;
+		for (std::size_t run = 0; run <= runs; run++) {
+			auto start = std::chrono::steady_clock::now();
+			std::vector<VM::Driver::Unit> units = VM::Driver::CompileAll(paths, j);
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+			for (const VM::Driver::Unit& unit : units)
+				if (!unit.ok) {
+					std::cerr << "Error: " << unit.path << " did not compile\n";
+					return 1;
+				}
+
+			if (run == 1 || (run > 1 && seconds < best))
+				best = seconds;
+		}
+
+		if (j == 1)
+			baseline = best;
+
+		std::cout << "-j" << j << ": " << best * 1000.0 << " ms, " << double(bytes) / double(1 << 20) / best << " MB/s, "
+			<< baseline / best << "x speedup, " << baseline / best / double(j) * 100.0 << "% efficiency\n";
+	}
+
+	std::filesystem::remove_all(directory);
+	return 0;
+}
@@ -0,0 +1,157 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "analysis/lexer.hpp"
+#include "analysis/scanner.hpp"
+
+// Lexes generated multi-megabyte inputs with each Scanner backend the CPU
+// supports and reports the throughput of Lexer::Tokenize. The inputs stress
+// the scanned runs one at a time: deep indentation, long identifiers, long
+// number literals and comment lines, then a mix of all of them. Every
+// backend must produce the same tokens as the scalar one.
+//
+// Last, the mixed input is lexed into tokens stored the way they were
+// before Token became a plain value, one shared_ptr per token holding a
+// copy of its lexeme, and the token rate is compared with Tokenize's.
+//
+// usage: ravi_bench_lexer [megabytes] [runs]
+
+static std::string Generate(std::size_t bytes, std::size_t shape) {
+
+	std::mt19937_64 random(shape + 1);
+	auto below = [&random](std::size_t bound) { return std::size_t(random() % bound); };
+
+	auto word = [&](std::size_t length) {
+		std::string text(1, char('a' + below(26)));
+		for (std::size_t i = 1; i < length; i++)
+			text += "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"[below(62)];
+		return text;
+	};
+
+	auto digits = [&](std::size_t length) {
+		std::string text(1, char('1' + below(9)));
+		for (std::size_t i = 1; i < length; i++)
+			text += char('0' + below(10));
+		return text;
+	};
+
+	std::string source;
+	while (source.size() < bytes) {
+		std::size_t kind = shape < 4 ? shape : below(4);
+		switch (kind) {
+		case 0:
+			source += std::string(16 + below(64), below(4) == 0 ? '\t' : ' ') + word(4) + " + 1;\n";
+			break;
+		case 1:
+			source += word(24 + below(40)) + " * " + word(24 + below(40)) + ";\n";
+			break;
+		case 2:
+			source += digits(12 + below(20)) + "." + digits(8 + below(8)) + " - " + digits(16 + below(16)) + ";\n";
+			break;
+		default:
+			source += "// " + word(40 + below(80)) + " " + word(20) + "\n" + word(6) + " < 2;\n";
+			break;
+		}
+	}
+	return source;
+}
+
+// The token the lexer allocated for every lexeme before Token became a
+// plain value.
+struct SharedToken {
+	Analysis::Token::Kind KindType;
+	void* Data;
+	std::string Text;
+	std::size_t Line;
+	std::size_t Col;
+};
+
+static std::vector<std::shared_ptr<SharedToken>> TokenizeShared(std::string_view source) {
+
+	Analysis::Lexer lexer(source);
+	std::vector<std::shared_ptr<SharedToken>> tokens;
+
+	for (;;) {
+		Analysis::Token tk = lexer.PeekNextToken();
+		tokens.push_back(std::make_shared<SharedToken>(SharedToken{
+			tk.KindType, nullptr, std::string(lexer.Lexeme(tk)), tk.Line, tk.Col }));
+		if (tk.KindType == Analysis::Token::Kind::TkEOF)
+			return tokens;
+	}
+}
+
+template<typename Function>
+static double Seconds(std::size_t runs, Function&& function) {
+
+	function();
+	auto start = std::chrono::steady_clock::now();
+	for (std::size_t i = 0; i < runs; i++)
+		function();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / double(runs);
+}
+
+int main(int argc, char** argv) {
+
+	std::size_t megabytes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 16;
+	std::size_t runs = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 5;
+
+	static constexpr const char* Shapes[] = { "indentation", "identifiers", "numbers", "comments", "mixed" };
+	static constexpr Analysis::Scanner::Backend Backends[] = {
+		Analysis::Scanner::Backend::Scalar, Analysis::Scanner::Backend::SSE2, Analysis::Scanner::Backend::AVX2
+	};
+
+	Analysis::Scanner::Backend best = Analysis::Scanner::Best();
+
+	for (std::size_t shape = 0; shape < std::size(Shapes); shape++) {
+
+		std::string source = Generate(megabytes << 20, shape);
+		std::vector<Analysis::Token> expected;
+		double scalar = 0;
+
+		for (Analysis::Scanner::Backend backend : Backends) {
+
+			if (!Analysis::Scanner::Select(backend))
+				continue;
+
+			std::vector<Analysis::Token> tokens;
+			double seconds = Seconds(runs, [&] { tokens = Analysis::Lexer(source).Tokenize(); });
+
+			if (expected.empty())
+				expected = tokens;
+			else if (tokens.size() != expected.size() || !std::equal(tokens.begin(), tokens.end(), expected.begin(),
+				[](const Analysis::Token& a, const Analysis::Token& b) {
+					return a.KindType == b.KindType && a.Offset == b.Offset && a.Length == b.Length && a.Line == b.Line;
+				})) {
+				std::cerr << "Error: " << Analysis::Scanner::ToString(backend) << " tokens differ on " << Shapes[shape] << "\n";
+				return 1;
+			}
+
+			double throughput = double(source.size()) / double(1 << 20) / seconds;
+			if (backend == Analysis::Scanner::Backend::Scalar)
+				scalar = throughput;
+
+			std::cout << Shapes[shape] << ", " << Analysis::Scanner::ToString(backend) << ": " << throughput << " MB/s, "
+				<< double(tokens.size()) / seconds / 1e6 << " M tokens/s";
+			if (scalar > 0 && backend != Analysis::Scanner::Backend::Scalar)
+				std::cout << " (" << throughput / scalar << "x scalar)";
+			std::cout << "\n";
+		}
+	}
+
+	Analysis::Scanner::Select(best);
+
+	std::string source = Generate(megabytes << 20, std::size(Shapes) - 1);
+	std::size_t count = 0;
+	double pod = Seconds(runs, [&] { count = Analysis::Lexer(source).Tokenize().size(); });
+	double shared = Seconds(runs, [&] { count = TokenizeShared(source).size(); });
+
+	std::cout << "mixed, " << Analysis::Scanner::ToString(best) << ", " << count << " tokens: "
+		<< double(count) / shared / 1e6 << " M tokens/s as shared_ptr<Token>, "
+		<< double(count) / pod / 1e6 << " M tokens/s as Token values (" << shared / pod << "x)\n";
+	return 0;
+}
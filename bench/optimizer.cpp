@@ -0,0 +1,95 @@
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include "vm/chunk.hpp"
+#include "vm/compiler.hpp"
+#include "vm/virtual_machine.hpp"
+
+// Compiles one program at -O0, -O1 and -O2 and reports, per level, the
+// compile time against the instructions a run executes and the time of a
+// run. The program is straight-line, so a run executes every instruction
+// once. It is a generated list of expression statements mixing integer and
+// number literals, or the file given as third argument.
+//
+// usage: ravi_bench_optimizer [statements] [runs] [file]
+
+static std::string Generate(std::size_t statements) {
+
+	std::mt19937_64 random(1);
+	auto below = [&random](std::size_t bound) { return std::size_t(random() % bound); };
+
+	static constexpr const char* Literals[] = { "1", "2", "3", "7", "10", "0.5", "1.25", "4.75" };
+	static constexpr const char* Operators[] = { " + ", " - ", " * ", " / " };
+
+	std::string source;
+	for (std::size_t i = 0; i < statements; i++) {
+		std::size_t terms = 2 + below(6);
+		source += "(";
+		for (std::size_t t = 0; t < terms; t++) {
+			if (t > 0)
+				source += Operators[below(std::size(Operators))];
+			source += below(4) == 0 ? "-" : "";
+			source += Literals[below(std::size(Literals))];
+		}
+		source += ") < 100;\n";
+	}
+	return source;
+}
+
+int main(int argc, char** argv) {
+
+	std::size_t statements = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20000;
+	std::size_t runs = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 100;
+	std::string source = Generate(statements);
+
+	if (argc > 3) {
+		std::ifstream file(argv[3], std::ios::binary);
+		if (!file) {
+			std::cerr << "Error: Cannot open '" << argv[3] << "'\n";
+			return 1;
+		}
+		source.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	}
+
+	std::size_t baseline = 0;
+	for (VM::Optimization level : { VM::Optimization::O0, VM::Optimization::O1, VM::Optimization::O2 }) {
+
+		// The best of a few compiles, against the noise of the allocator.
+		VM::Chunk chunk;
+		double compile = 0;
+		for (int i = 0; i < 5; i++) {
+			chunk = VM::Chunk();
+			auto start = std::chrono::steady_clock::now();
+			VM::Compiler compiler(chunk, source, nullptr, level);
+			try {
+				compiler.Compile();
+			}
+			catch (const std::exception&) {
+				return 1;
+			}
+			double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			compile = i == 0 ? elapsed : std::min(compile, elapsed);
+		}
+
+		VM::RVM rvm(chunk);
+		rvm.SetJitThreshold(0);
+		rvm.Run();
+		auto start = std::chrono::steady_clock::now();
+		for (std::size_t i = 0; i < runs; i++)
+			rvm.Run();
+		double run = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / double(runs);
+
+		std::size_t instructions = chunk.InstructionCount();
+		if (level == VM::Optimization::O0)
+			baseline = instructions;
+
+		std::cout << "-O" << int(level) << ": compile " << compile << " ms, " << instructions << " instructions per run ("
+			<< 100.0 * double(baseline - instructions) / double(baseline) << "% fewer than -O0), " << run << " us per run\n";
+	}
+
+	return 0;
+}
@@ -0,0 +1,120 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "analysis/lexer.hpp"
+#include "analysis/parser.hpp"
+#include "vm/chunk.hpp"
+
+// Parses expressions that stress the Pratt loop: deeply nested groupings,
+// right-nested binary operators, chains of unary minus, and long flat
+// expressions mixing the precedence levels. Each shape is one statement of
+// depth operations, repeated until the input holds about terms of them.
+// The source is lexed once and every statement is parsed into a chunk of
+// its own, made ahead of time, so the time per token is the parser's
+// alone, rule dispatch and code emission included. It is reported with
+// constant folding off, which emits every operation, and on, the default.
+//
+// usage: ravi_bench_parser [depth] [terms] [runs]
+
+static std::string Nested(std::size_t depth) {
+
+	return std::string(depth, '(') + "1" + std::string(depth, ')') + ";\n";
+}
+
+static std::string RightNested(std::size_t depth) {
+
+	std::string source;
+	for (std::size_t i = 0; i < depth; i++)
+		source += std::to_string(i % 10) + (i % 2 ? " * (" : " - (");
+	return source + "1" + std::string(depth, ')') + ";\n";
+}
+
+static std::string Unary(std::size_t depth) {
+
+	std::string source;
+	for (std::size_t i = 0; i < depth; i++)
+		source += "-";
+	return source + "2.5;\n";
+}
+
+static std::string Long(std::size_t terms) {
+
+	static constexpr const char* Operators[] = { " + ", " * ", " - ", " / ", " * ", " + " };
+
+	std::string source = "1";
+	for (std::size_t i = 1; i < terms; i++) {
+		source += Operators[i % std::size(Operators)];
+		source += std::to_string(1 + i % 9);
+	}
+	return source + " < 100;\n";
+}
+
+static double Parse(const std::string& source, const std::vector<Analysis::Token>& tokens, bool folding, std::size_t runs) {
+
+	// Statements end after their ';'.
+	std::vector<std::size_t> ends;
+	for (std::size_t i = 0; i < tokens.size(); i++)
+		if (tokens[i].KindType == Analysis::Token::Kind::Semicolon)
+			ends.push_back(i + 1);
+
+	Analysis::Lexer lexer(source);
+	double best = 0;
+
+	for (std::size_t i = 0; i < runs; i++) {
+		std::vector<VM::Chunk> chunks(ends.size());
+
+		auto start = std::chrono::steady_clock::now();
+		for (std::size_t s = 0, first = 0; s < ends.size(); first = ends[s++]) {
+			Analysis::Parser parser(chunks[s], lexer, tokens.data() + first, tokens.data() + ends[s]);
+			parser.SetFolding(folding);
+			parser.Declaration();
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		if (i == 0 || seconds < best)
+			best = seconds;
+	}
+	return best;
+}
+
+int main(int argc, char** argv) {
+
+	// A chunk holds 256 constants; a statement of depth operations takes
+	// up to depth + 1.
+	std::size_t depth = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200;
+	std::size_t terms = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1000000;
+	std::size_t runs = argc > 3 ? std::max<std::size_t>(1, std::strtoul(argv[3], nullptr, 10)) : 10;
+
+	std::size_t repeat = std::max<std::size_t>(1, terms / std::max<std::size_t>(1, depth));
+	auto times = [repeat](const std::string& statement) {
+		std::string source;
+		for (std::size_t i = 0; i < repeat; i++)
+			source += statement;
+		return source;
+	};
+
+	const std::pair<const char*, std::string> shapes[] = {
+		{ "nested groupings", times(Nested(depth)) },
+		{ "right-nested operators", times(RightNested(depth)) },
+		{ "unary chain", times(Unary(depth)) },
+		{ "long expression", times(Long(depth)) },
+	};
+
+	for (const auto& [name, source] : shapes) {
+
+		// Without EOF, which the parser supplies past the last token.
+		std::vector<Analysis::Token> tokens = Analysis::Lexer(source).Tokenize();
+		tokens.pop_back();
+
+		double unfolded = Parse(source, tokens, false, runs);
+		double folded = Parse(source, tokens, true, runs);
+
+		std::cout << name << ", " << tokens.size() << " tokens: " << unfolded * 1e9 / double(tokens.size())
+			<< " ns/token, " << folded * 1e9 / double(tokens.size()) << " ns/token folding\n";
+	}
+
+	return 0;
+}
@@ -0,0 +1,106 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+#include "vm/session.hpp"
+
+// Loads generated programs of growing size into a Session and times edits
+// that rewrite one digit, as an editor sends them while the user types. The
+// edit-to-result latency (Edit() returning the compile result) should not
+// grow with the file; the full Load() and the link (first GetChunk() after
+// an edit) are reported next to it for scale. The last sessions are checked
+// against a fresh Load() of their text.
+//
+// usage: ravi_bench_session [edits] [statements...]
+
+static std::string Generate(std::size_t statements) {
+
+	std::mt19937_64 random(1);
+	auto below = [&random](std::size_t bound) { return std::size_t(random() % bound); };
+
+	static constexpr const char* Literals[] = { "1", "2", "3", "7", "10", "0.5", "1.25", "4.75" };
+	static constexpr const char* Operators[] = { " + ", " - ", " * ", " / " };
+
+	std::string source;
+	for (std::size_t i = 0; i < statements; i++) {
+		std::size_t terms = 2 + below(6);
+		source += "(";
+		for (std::size_t t = 0; t < terms; t++) {
+			if (t > 0)
+				source += Operators[below(std::size(Operators))];
+			source += Literals[below(std::size(Literals))];
+		}
+		source += ") < 100;\n";
+	}
+	return source;
+}
+
+template<typename Function>
+static double Time(Function&& function) {
+
+	auto start = std::chrono::steady_clock::now();
+	function();
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+
+	std::size_t edits = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000;
+	std::vector<std::size_t> sizes;
+	for (int i = 2; i < argc; i++)
+		sizes.push_back(std::strtoul(argv[i], nullptr, 10));
+	if (sizes.empty())
+		sizes = { 1000, 10000, 100000, 1000000 };
+
+	for (std::size_t statements : sizes) {
+
+		std::string text = Generate(statements);
+		std::vector<std::size_t> digits;
+		for (std::size_t i = 0; i < text.size(); i++)
+			if (text[i] >= '1' && text[i] <= '9')
+				digits.push_back(i);
+
+		VM::Session session;
+		double load = Time([&] { session.Load(text); });
+
+		std::mt19937_64 random(2);
+		std::vector<double> latency;
+		latency.reserve(edits);
+		std::size_t recompiled = 0;
+
+		for (std::size_t i = 0; i < edits; i++) {
+			std::size_t offset = digits[random() % digits.size()];
+			char digit = char('1' + random() % 9);
+			text[offset] = digit;
+			latency.push_back(Time([&] {
+				if (session.Edit(offset, 1, std::string_view(&digit, 1)) != VM::InterpreteResult::OK)
+					std::exit(1);
+			}));
+			recompiled += session.Recompiled();
+		}
+
+		double link = Time([&] { session.GetChunk(); });
+
+		std::sort(latency.begin(), latency.end());
+		double median = latency[latency.size() / 2];
+		double p99 = latency[latency.size() * 99 / 100];
+
+		std::cout << statements << " statements, " << text.size() / 1024 << " KiB: edit " << median << " us median, "
+			<< p99 << " us p99, " << double(recompiled) / double(edits) << " declarations per edit; load "
+			<< load / 1000.0 << " ms, link " << link / 1000.0 << " ms\n";
+
+		// Edited fragments put their constants at the end of the table, so
+		// the code may use longer constant forms than a fresh load's.
+		VM::Session fresh;
+		fresh.Load(text);
+		if (session.Text() != text || session.Declarations() != fresh.Declarations()) {
+			std::cerr << "Error: the edited session differs from a fresh load\n";
+			return 1;
+		}
+	}
+
+	return 0;
+}
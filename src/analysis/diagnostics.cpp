@@ -0,0 +1,27 @@
+#include "analysis/diagnostics.hpp"
+
+#include <iostream>
+
+namespace Analysis {
+
+	void Diagnostics::Report(std::string message) {
+		m_messages.push_back(std::move(message));
+	}
+
+	const std::vector<std::string>& Diagnostics::Messages() const {
+		return m_messages;
+	}
+
+	bool Diagnostics::Empty() const {
+		return m_messages.empty();
+	}
+
+	void Diagnostics::Emit(Diagnostics* sink, std::string message) {
+
+		if (sink != nullptr)
+			sink->Report(std::move(message));
+		else
+			std::cerr << message << "\n";
+	}
+
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace Analysis {
+
+// Collects the messages of one compilation so that several compilations can
+// run concurrently and have their diagnostics printed in a stable order.
+class Diagnostics {
+
+public:
+	void Report(std::string message);
+	const std::vector<std::string>& Messages() const;
+	bool Empty() const;
+
+	// Reports to sink, or straight to std::cerr when there is none.
+	static void Emit(Diagnostics* sink, std::string message);
+
+public:
+	Diagnostics() = default;
+	Diagnostics(const Diagnostics&) = default;
+	Diagnostics(Diagnostics&&) = default;
+	Diagnostics& operator=(const Diagnostics&) = default;
+	Diagnostics& operator=(Diagnostics&&) = default;
+	~Diagnostics() = default;
+
+private:
+	std::vector<std::string> m_messages;
+
+};
+
+}
@@ -1,124 +1,174 @@
-#include <iostream>
+#include <string>
 #include <cctype>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
 
 #include "analysis/lexer.hpp"
+#include "analysis/scanner.hpp"
 
 
 namespace Analysis {
 
-    Lexer::Lexer(const std::string_view text)
-        : m_text(text), m_col(0), m_start(0), m_line(0), m_position(0) {
+    Lexer::Lexer(const std::string_view text, Diagnostics* diagnostics)
+        : m_text(text), m_col(0), m_start(0), m_line(0), m_position(0), m_current_token{},
+          m_diagnostics(diagnostics) {
     }
 
-    void Lexer::NextToken() {
+    Lexer::Lexer(Reader& reader, std::size_t block_size)
+        : m_col(0), m_start(0), m_line(0), m_position(0), m_current_token{},
+          m_reader(&reader), m_block_size(block_size) {
+    }
 
-		m_start = m_position;
+    void Lexer::NextToken() {
 
-		if (IsAtEnd()) {
-			AddToken(Token::Kind::TkEOF);
-			return;
-		}
+        for (;;) {
+
+            m_start = m_position;
+
+            if (IsAtEnd()) {
+                AddToken(Token::Kind::TkEOF);
+                return;
+            }
+
+            const char c = Advance();
+
+            switch (c) {
+
+            case Less:         
+                AddToken(Match(Equal) ? Token::Kind::LessEqual: Token::Kind::Less);
+                break;
+            case Greater:         
+                AddToken(Match(Equal) ? Token::Kind::GreaterEqual : Token::Kind::Greater);
+                break;
+            case Comma: 
+                AddToken(Token::Kind::Comma);
+                break;
+            case BackQuote: 
+                if (!CreateStringToken(BackQuote))
+                    continue;
+                break;
+            case DoubleQuote: 
+                if (!CreateStringToken(DoubleQuote))
+                    continue;
+                break;
+            case OpenParenthesis: 
+                AddToken(Token::Kind::OpenParenthesis);
+                break;
+            case CloseParenthesis: 
+                AddToken(Token::Kind::CloseParenthesis);
+                break;
+            case Bang:
+                AddToken(Match(Equal) ? Token::Kind::NotEqual : Token::Kind::Not);
+                break;
+            case Equal:
+                AddToken(Match(Equal) ? Token::Kind::Equal : Token::Kind::Assign); 
+                break;
+            case Ampersand: 
+                AddToken(Match(Ampersand) ? Token::Kind::LogicalAnd : Token::Kind::BinaryAnd);
+                break;
+            case Pipeline: 
+                AddToken(Match(Pipeline) ? Token::Kind::LogicalOr : Token::Kind::BinaryOr);
+                break;
+            case OpenBrackets:
+                AddToken(Token::Kind::OpenBracket);
+                break;
+            case CloseBrackets: 
+                AddToken(Token::Kind::CloseBracket);
+                break;
+            case Dot: 
+                AddToken(Token::Kind::Dot);
+                break;
+            case Colon: 
+                AddToken(Token::Kind::Colon);
+                break;
+            case Semicolon: 
+                AddToken(Token::Kind::Semicolon);
+                break;
+            case MinusOp: 
+                AddToken(Match(Greater) ? Token::Kind::Arrow : Token::Kind::Minus);
+                break;
+            case PlusOp: 
+                AddToken(Token::Kind::Plus);
+                break;
+            case StartOp: 
+                AddToken(Token::Kind::Star);
+                break;
+            case SlashOp: 
+                if (!AddSlashToken())
+                    continue;
+                break;
+            case BackslashN: {
+                m_line++;
+                m_col = 0;
+                continue;
+            }
+            case Space:
+            case BackslashR: 
+            case BackslashT:
+                SkipRun(Scanner::SkipBlanks);
+                continue;
+            default: 
+                if (!AddDefaultToken(c))
+                    continue;
+                break;
+            }
 
-        const char c = Advance();
-        
-        switch (c) {
-
-        case Less:         
-            AddToken(Match(Equal) ? Token::Kind::LessEqual: Token::Kind::Less);
-            break;
-        case Greater:         
-            AddToken(Match(Equal) ? Token::Kind::GreaterEqual : Token::Kind::Greater);
-            break;
-        case Comma: 
-            AddToken(Token::Kind::Comma);
-            break;
-        case BackQuote: 
-            CreateStringToken(BackQuote);
-            break;
-        case DoubleQuote: 
-            CreateStringToken(DoubleQuote);
-            break;
-        case OpenParenthesis: 
-            AddToken(Token::Kind::OpenParenthesis);
-            break;
-        case CloseParenthesis: 
-            AddToken(Token::Kind::CloseParenthesis);
-            break;
-        case Bang:
-            AddToken(Match(Equal) ? Token::Kind::NotEqual : Token::Kind::Not);
-            break;
-        case Equal:
-            AddToken(Match(Equal) ? Token::Kind::Equal : Token::Kind::Assign); 
-            break;
-        case Ampersand: 
-            AddToken(Match(Ampersand) ? Token::Kind::LogicalAnd : Token::Kind::BinaryAnd);
-            break;
-        case Pipeline: 
-            AddToken(Match(Pipeline) ? Token::Kind::LogicalOr : Token::Kind::BinaryOr);
-            break;
-        case OpenBrackets:
-            AddToken(Token::Kind::OpenBracket);
-            break;
-        case CloseBrackets: 
-            AddToken(Token::Kind::CloseBracket);
-            break;
-        case Dot: 
-            AddToken(Token::Kind::Dot);
-            break;
-        case Colon: 
-            AddToken(Token::Kind::Colon);
-            break;
-        case Semicolon: 
-            AddToken(Token::Kind::Semicolon);
-            break;
-        case MinusOp: 
-            AddToken(Match(Greater) ? Token::Kind::Arrow : Token::Kind::Minus);
-            break;
-        case PlusOp: 
-            AddToken(Token::Kind::Plus);
-            break;
-        case StartOp: 
-            AddToken(Token::Kind::Star);
-            break;
-        case SlashOp: 
-            AddSlashToken();
-            break;
-        case BackslashN: {
-			m_line++;
-			m_col = 0;
-			break;
-        }
-        case Space:
-            NextToken();
-            break;
-        case BackslashR: 
-            NextToken();
-            break;
-        case BackslashT:
-            NextToken();
-			break;
-        default: 
-            AddDefaultToken(c);    
-            break;
+            return;
         }
     }
 
-    Ref<Token> Lexer::PeekNextToken() {
+    Token Lexer::PeekNextToken() {
         
         NextToken();
         return GetCurrentTk();
     }
 
-    void Lexer::AddToken(Token::Kind kind, void* value) {
+    std::vector<Token> Lexer::Tokenize() {
+
+        std::vector<Token> tokens;
+        tokens.reserve(m_text.size() / 4 + 1);
+
+        do {
+            tokens.push_back(PeekNextToken());
+        } while (tokens.back().KindType != Token::Kind::TkEOF);
+
+        return tokens;
+    }
+
+    void Lexer::Seek(std::size_t position, std::size_t line, std::size_t col) {
+
+        m_position = position - m_base;
+        m_start = m_position;
+        m_line = line;
+        m_col = col;
+    }
+
+    std::string_view Lexer::Lexeme(const Token& token) const {
+
+        if (token.Offset < m_base) {
+            for (const Saved& saved : m_saved)
+                if (saved.offset == token.Offset && saved.text.size() >= token.Length)
+                    return std::string_view(saved.text).substr(0, token.Length);
+            return {};
+        }
+
+        return m_text.substr(token.Offset - m_base, token.Length);
+    }
+
+    void Lexer::AddToken(Token::Kind kind) {
 
-        m_current_token = std::make_shared<Token>(
-            kind, value,
-            m_text.substr(m_start, m_position - m_start),
-            m_line, m_col
-        );
+        m_previous_token = m_current_token;
+        m_current_token = Token{
+            kind,
+            static_cast<std::uint32_t>(m_base + m_start),
+            static_cast<std::uint32_t>(m_position - m_start),
+            static_cast<std::uint32_t>(m_line),
+            static_cast<std::uint32_t>(m_col)
+        };
     }
 
-    Ref<Token> Lexer::GetCurrentTk() {
+    const Token& Lexer::GetCurrentTk() const {
 
         return m_current_token;
     }
@@ -147,42 +197,38 @@ namespace Analysis {
         return m_text[m_position];
     }
 
-    void Lexer::AddDefaultToken(const char c) {
+    bool Lexer::AddDefaultToken(const char c) {
 
-        if (std::isdigit(c)) 
+        if (std::isdigit(static_cast<unsigned char>(c))) 
             AddNumberToken();
-        else if (std::isalpha(c)) 
+        else if (std::isalpha(static_cast<unsigned char>(c))) 
             AddIdentifierToken();
-        else 
+        else {
             Report("Unexpected character");
+            return false;
+        }
+
+        return true;
     }
 
     void Lexer::AddNumberToken() {
 
-        while (std::isdigit(Peek())) 
-            Next();
+        SkipWhile(Scanner::SkipDigits);
 
-        if (Peek() == Dot && std::isdigit(PeekNext())) {
+        if (Peek() == Dot && std::isdigit(static_cast<unsigned char>(PeekNext()))) {
             Next();
-            while (std::isdigit(Peek())) 
-                Next();
+            SkipWhile(Scanner::SkipDigits);
         }
 
-        double x = std::stod(m_text.substr(m_start, m_position - m_start));
-        AddToken(Token::Kind::Number, &x);
+        AddToken(Token::Kind::Number);
     }
 
     void Lexer::AddIdentifierToken() {
-        while (std::isalnum(Peek())) Next();
-        try {
-            AddToken(Words.at(m_text.substr(m_start, m_position - m_start)));
-        }
-        catch (const std::exception&) {
-            AddToken(Token::Kind::Identifier);
-        }
+        SkipWhile(Scanner::SkipAlnum);
+        AddToken(Keywords::Lookup(m_text.substr(m_start, m_position - m_start)));
     }
 
-    void Lexer::CreateStringToken(const char q) {
+    bool Lexer::CreateStringToken(const char q) {
 
         while (Peek() != q && !IsAtEnd()) {
 
@@ -194,34 +240,29 @@ namespace Analysis {
 
         if (IsAtEnd()) {
             Report("Unterminated string");
-            return;
+            return false;
         }
 
         Next();
-        std::string value = m_text.substr(m_start + 1, (m_position - 1) - (m_start + 1));
-        AddToken(Token::Kind::String, &value);
+        AddToken(Token::Kind::String);
+        return true;
     }
 
-    void Lexer::AddSlashToken() {
+    bool Lexer::AddSlashToken() {
         if (Match(SlashOp)) {
-            while (Peek() != '\n' && !IsAtEnd())
-                Next();
-        }
-        else {
-            AddToken(Token::Kind::Slash);
+            SkipRun(Scanner::FindNewline);
+            return false;
         }
-    }
-
-    Ref<Token> Lexer::GetLastToken() {
 
-		m_last_token->Line = m_line;
-		m_last_token->Col = m_col;
-		return m_last_token;
+        AddToken(Token::Kind::Slash);
+        return true;
     }
 
     char Lexer::PeekNext() {
 
-        if (m_position + 1 >= m_text.size()) return '\0';
+        while (m_position + 1 >= m_text.size())
+            if (!Refill()) return '\0';
+
         return m_text[m_position + 1];
     }
 
@@ -236,14 +277,101 @@ namespace Analysis {
         return m_position++;
     }
 
+    const char* Lexer::Cursor() const {
+
+        return m_text.data() + m_position;
+    }
+
+    const char* Lexer::End() const {
+
+        return m_text.data() + m_text.size();
+    }
+
+    void Lexer::SkipTo(const char* position) {
+
+        std::size_t count = position - Cursor();
+        m_col += count;
+        m_position += count;
+    }
+
+    void Lexer::SkipWhile(const char* (*scan)(const char*, const char*)) {
+
+        do {
+            SkipTo(scan(Cursor(), End()));
+        } while (m_position >= m_text.size() && Refill());
+    }
+
+    void Lexer::SkipRun(const char* (*scan)(const char*, const char*)) {
+
+        do {
+            SkipTo(scan(Cursor(), End()));
+            // The skipped bytes need not survive a refill.
+            m_start = m_position;
+        } while (m_position >= m_text.size() && Refill());
+    }
+
+    bool Lexer::Refill() {
+
+        if (m_reader == nullptr)
+            return false;
+
+        // Drop everything before the token being scanned, then append a
+        // block. The live tokens' lexemes are copied out first.
+        std::size_t keep = m_start;
+        std::size_t filled = m_text.size() - keep;
+
+        if (keep > 0) {
+            const Token* live[] = { &m_previous_token, &m_current_token };
+            std::array<Saved, 2> saved;
+            for (std::size_t i = 0; i < saved.size(); i++)
+                if (live[i]->Offset < m_base + keep)
+                    saved[i] = Saved{ live[i]->Offset, std::string(Lexeme(*live[i])) };
+            m_saved = std::move(saved);
+
+            std::memmove(m_window.data(), m_window.data() + keep, filled);
+            m_base += keep;
+            m_position -= keep;
+            m_start -= keep;
+        }
+
+        if (m_window.size() < filled + m_block_size)
+            m_window.resize(filled + m_block_size);
+
+        std::size_t count = m_reader->Read(m_window.data() + filled, m_block_size);
+        m_text = std::string_view(m_window.data(), filled + count);
+
+        if (m_base + m_text.size() > MaxStreamSize) {
+            m_reader = nullptr;
+            Report("Source larger than 4 GiB is not supported");
+            throw std::runtime_error("Source larger than 4 GiB is not supported.");
+        }
+
+        if (count == 0)
+            m_reader = nullptr;
+
+        return count > 0;
+    }
+
     bool Lexer::IsAtEnd() {
 
-        return m_position >= m_text.size();
+        return m_position >= m_text.size() && !Refill();
     }
 
     void Lexer::Report(std::string message) {
 
-        std::cerr << "Error: " << message << " at [" << (m_line + 1) << "," << (m_col + 1) << "].\n";
+        m_errors++;
+        Diagnostics::Emit(m_diagnostics,
+            "Error: " + message + " at [" + std::to_string(m_line + 1) + "," + std::to_string(m_col + 1) + "].");
+    }
+
+    void Lexer::SetDiagnostics(Diagnostics* diagnostics) {
+
+        m_diagnostics = diagnostics;
+    }
+
+    Diagnostics* Lexer::GetDiagnostics() const {
+
+        return m_diagnostics;
     }
 
     std::string Token::ToString(Kind kind) {
@@ -1,19 +1,22 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <cstdint>
 #include <vector>
-#include <unordered_map>
-#include <deque>
+#include <array>
+#include <algorithm>
 
 #include "common/common.hpp"
+#include "analysis/reader.hpp"
+#include "analysis/diagnostics.hpp"
 
 namespace Analysis {
 
 class Token {
 
 public:
-	enum class Kind {
+	enum class Kind : Byte {
 		TkEOF,
 		Func,
 		Number,
@@ -58,47 +61,115 @@ public:
 		String
 	};
 
+	// Number of kinds; String must stay the last enumerator.
+	static constexpr std::size_t KindCount = static_cast<std::size_t>(Kind::String) + 1;
+
 public:
-	Token(
-		Kind kindType,
-		void* data,
-		std::string_view text,
-		std::size_t line,
-		std::size_t col
-	) : 
-		KindType(kindType),
-		Data(data),
-		Text(text), 
-		Line(line), 
-		Col(col)
-	{ }
 	Kind KindType;
-	void* Data;
-	std::string Text;
-	std::size_t Line;
-	std::size_t Col;
+	std::uint32_t Offset;
+	std::uint32_t Length;
+	std::uint32_t Line;
+	std::uint32_t Col;
 
 	static std::string ToString(Kind kind);
 
 };
 
-using RToken = Ref<Token>;
-
-static const std::unordered_map<std::string, Token::Kind> Words{
-	{ "func", Token::Kind::Func},
-	{ "true" ,Token::Kind::True},
-	{ "false", Token::Kind::False},
-	{ "let", Token::Kind::Let},
-	{ "mut", Token::Kind::Mut},
-	{ "return", Token::Kind::Return},
-	{ "struct", Token::Kind::Struct},
-	{ "class", Token::Kind::Class},
-	{ "while", Token::Kind::While},
-	{ "for", Token::Kind::For},
-	{ "if", Token::Kind::If},
-	{ "else", Token::Kind::Else},
-	{ "namespace", Token::Kind::Namespace},
-};
+// Keyword classification through a perfect hash generated at compile time.
+// The hash mixes the length with the first and last characters; Build()
+// searches for multipliers that leave no collision among the words below,
+// so adding a keyword only means extending List.
+namespace Keywords {
+
+	struct Entry {
+		std::string_view word;
+		Token::Kind kind;
+	};
+
+	inline constexpr Entry List[] = {
+		{ "func", Token::Kind::Func },
+		{ "true", Token::Kind::True },
+		{ "false", Token::Kind::False },
+		{ "let", Token::Kind::Let },
+		{ "mut", Token::Kind::Mut },
+		{ "return", Token::Kind::Return },
+		{ "struct", Token::Kind::Struct },
+		{ "class", Token::Kind::Class },
+		{ "while", Token::Kind::While },
+		{ "for", Token::Kind::For },
+		{ "if", Token::Kind::If },
+		{ "else", Token::Kind::Else },
+		{ "namespace", Token::Kind::Namespace },
+	};
+
+	inline constexpr std::size_t Size = 32;
+	static_assert(std::size(List) <= Size, "Grow Keywords::Size with the keyword list.");
+
+	struct HashTable {
+		std::array<Entry, Size> entries;
+		std::size_t first;
+		std::size_t last;
+		bool found;
+	};
+
+	constexpr std::size_t Hash(std::string_view word, std::size_t first, std::size_t last) {
+		return (word.size()
+			+ static_cast<unsigned char>(word.front()) * first
+			+ static_cast<unsigned char>(word.back()) * last) & (Size - 1);
+	}
+
+	constexpr HashTable Build() {
+
+		for (std::size_t first = 1; first < 64; first++) {
+			for (std::size_t last = 0; last < 64; last++) {
+
+				HashTable table{ {}, first, last, true };
+
+				for (const Entry& keyword : List) {
+					Entry& slot = table.entries[Hash(keyword.word, first, last)];
+					if (!slot.word.empty()) {
+						table.found = false;
+						break;
+					}
+					slot = keyword;
+				}
+
+				if (table.found)
+					return table;
+			}
+		}
+
+		return HashTable{ {}, 0, 0, false };
+	}
+
+	constexpr std::size_t Length(bool longest) {
+
+		std::size_t length = List[0].word.size();
+		for (const Entry& keyword : List)
+			length = longest ? std::max(length, keyword.word.size()) : std::min(length, keyword.word.size());
+		return length;
+	}
+
+	inline constexpr HashTable Table = Build();
+	static_assert(Table.found, "No collision-free keyword hash; widen the search in Keywords::Build.");
+
+	inline constexpr std::size_t MinLength = Length(false);
+	inline constexpr std::size_t MaxLength = Length(true);
+
+	// Returns Token::Kind::Identifier for anything that is not a keyword.
+	constexpr Token::Kind Lookup(std::string_view word) {
+
+		if (word.size() < MinLength || word.size() > MaxLength)
+			return Token::Kind::Identifier;
+
+		const Entry& entry = Table.entries[Hash(word, Table.first, Table.last)];
+		return entry.word == word ? entry.kind : Token::Kind::Identifier;
+	}
+
+	static_assert(Lookup("namespace") == Token::Kind::Namespace);
+	static_assert(Lookup("name") == Token::Kind::Identifier);
+
+}
 
 class Lexer {
 
@@ -132,39 +203,85 @@ public:
 	
 public:
 	void NextToken();
-	Ref<Token> GetCurrentTk();
-	Ref<Token> PeekNextToken();
+	const Token& GetCurrentTk() const;
+	Token PeekNextToken();
+	std::vector<Token> Tokenize();
+	// Restarts scanning at position with the given line/column state, e.g.
+	// right after a token (Offset + Length, Line, Col) when re-lexing.
+	void Seek(std::size_t position, std::size_t line, std::size_t col);
+	std::string_view Lexeme(const Token& token) const;
 	bool IsAtEnd();
+	// Routes lexer and parser errors to diagnostics instead of std::cerr.
+	void SetDiagnostics(Diagnostics* diagnostics);
+	Diagnostics* GetDiagnostics() const;
+	// Errors reported so far. The lexer skips the bad input and goes on, so
+	// the parser sees none of them; see Compiler::Compile.
+	inline std::size_t Errors() const { return m_errors; }
 
 private:
-	void AddToken(Token::Kind kind, void* value = nullptr);
+	void AddToken(Token::Kind kind);
 	bool Match(const char expected);
 	char Peek();
-	void AddDefaultToken(const char c);
+	bool AddDefaultToken(const char c);
 	void AddNumberToken();
 	void AddIdentifierToken();
-	void CreateStringToken(const char q);
-	void AddSlashToken();
-	Ref<Token> GetLastToken();
+	bool CreateStringToken(const char q);
+	bool AddSlashToken();
 	char PeekNext();
 	char Advance();
 	std::size_t Next();
+	const char* Cursor() const;
+	const char* End() const;
+	void SkipTo(const char* position);
+	void SkipWhile(const char* (*scan)(const char*, const char*));
+	// Like SkipWhile, over text that belongs to no token.
+	void SkipRun(const char* (*scan)(const char*, const char*));
+	bool Refill();
 	void Report(std::string message);
 
 public:
-	Lexer(const std::string_view text);
-	Lexer(const Lexer&) = default;
+	static constexpr std::size_t DefaultBlockSize = 64 * 1024;
+	// Token offsets are 32-bit, see Source::Open for mapped and read files.
+	static constexpr std::size_t MaxStreamSize = UINT32_MAX;
+
+	// The lexer borrows text: it must outlive the lexer and every token
+	// whose lexeme is read back through Lexeme().
+	Lexer(const std::string_view text, Diagnostics* diagnostics = nullptr);
+	// Streaming mode: text is pulled from reader block_size bytes at a time.
+	// Only the token being scanned is retained in the window; the lexemes of
+	// the last two tokens (the parser's previous/current window) are copied
+	// out when a refill drops them, so Lexeme() is valid for those tokens
+	// only. Blank and comment runs are never retained, so memory stays
+	// within a block plus the longest token. Input past MaxStreamSize is
+	// reported and throws std::runtime_error.
+	Lexer(Reader& reader, std::size_t block_size = DefaultBlockSize);
+	Lexer(const Lexer&) = delete;
 	Lexer(Lexer&&) = default;
 	~Lexer() = default;
 
 	std::size_t m_position;
 	std::size_t m_start;
 private:
-	std::string m_text;
+	std::string_view m_text;
 	std::size_t m_line;
 	std::size_t m_col;
-	Ref<Token> m_last_token;
-	Ref<Token> m_current_token;
+	Token m_current_token;
+
+	Diagnostics* m_diagnostics = nullptr;
+	std::size_t m_errors = 0;
+	Reader* m_reader = nullptr;
+	std::vector<char> m_window;
+	std::size_t m_block_size = 0;
+	// Absolute offset of m_text[0].
+	std::size_t m_base = 0;
+	// The token before m_current_token, and the lexemes of both once a
+	// refill dropped them from the window.
+	struct Saved {
+		std::uint32_t offset = 0;
+		std::string text;
+	};
+	Token m_previous_token{};
+	std::array<Saved, 2> m_saved;
 
 };
 
@@ -1,11 +1,23 @@
 #include "analysis/parser.hpp"
 #include "vm/virtual_machine.hpp"
+#include "vm/integer.hpp"
 
 #include <iostream>
-#include <cstdlib>
+#include <charconv>
+#include <cmath>
 
 namespace Analysis {
 
+	void Parser::Declaration() {
+
+		Expression();
+
+		if (!IsAtEnd())
+			Consume(Token::Kind::Semicolon, "Expect ';' after expression.");
+
+		Emit8(VM::OpCode::Pop);
+	}
+
 	void Parser::Expression() {
 		
 		ParsePrecedence(Precedence::ASSIGNMENT);
@@ -13,8 +25,27 @@ namespace Analysis {
 
 	void Parser::Number() {
 		
-		Value value = std::strtod(m_previous->Text.c_str(), nullptr);
+		std::string_view text = lexer.Lexeme(m_previous);
+		const char* end = text.data() + text.size();
+		Value value;
+
+		// Literals without a fraction are integers, and must fit in 32 bits:
+		// falling back to a number would change the type of the expression.
+		if (text.find('.') == std::string_view::npos) {
+			std::int32_t integer = 0;
+			if (std::from_chars(text.data(), end, integer).ec != std::errc())
+				throw Report(m_previous, "Integer literal does not fit in i32.");
+			value = Value::Integer(integer);
+		}
+		else {
+			double number = 0;
+			std::from_chars(text.data(), end, number);
+			value = number;
+		}
+
+		Operand operand = Mark();
 		EmitConstant(value);
+		m_operand = { Operand::Kind::Constant, value, operand.start, operand.constants, TypeChecker::Of(value) };
 	}
 
 	void Parser::Grouping() {
@@ -25,64 +56,259 @@ namespace Analysis {
 
 	void Parser::Binary() {
 		
-		RToken operator_ = m_previous;
-		Rule rule = Rule::Get(operator_->KindType);
+		Token operator_token = m_previous;
+		Token::Kind operator_ = operator_token.KindType;
+		Operand left = m_operand;
+		const Rule& rule = Rule::Get(operator_);
 		ParsePrecedence(Precedence(rule.precedence + 1));
+		Operand right = m_operand;
+
+		std::optional<TypeChecker::Result> checked = TypeChecker::Binary(operator_, left.type, right.type);
+		if (!checked)
+			throw Report(operator_token, std::string(TypeChecker::OperandsError));
+
+		Byte opcode = checked->opcode;
+		Type type = checked->type;
+
+		if (m_folding && left.kind == Operand::Kind::Constant && right.kind == Operand::Kind::Constant) {
+			if (std::optional<Value> value = Fold(opcode, left.value, right.value)) {
+				current_chunk.Truncate(left.start, left.constants);
+				EmitConstant(*value);
+				m_operand = { Operand::Kind::Constant, *value, left.start, left.constants, type };
+				return;
+			}
+		}
 
-		switch (operator_->KindType)
-		{
-		case Token::Kind::Plus:
-			Emit8(VM::OpCode::Add);
-			break;
-		case Token::Kind::Minus:
-			Emit8(VM::OpCode::Substract);
-			break;
-		case Token::Kind::Star:
-			Emit8(VM::OpCode::Multiply);
-			break;
-		case Token::Kind::Slash:
-			Emit8(VM::OpCode::Divide);
-			break;
-		default:
+		// Dropping the constant must not change the type of the result.
+		if (m_folding && right.kind == Operand::Kind::Constant && left.type == type && IsRightIdentity(opcode, right.value)) {
+			current_chunk.Truncate(right.start, right.constants);
+			m_operand = left;
+			return;
+		}
+
+		if (m_folding && left.kind == Operand::Kind::Constant && right.type == type && IsLeftIdentity(opcode, left.value)) {
+			current_chunk.Erase(left.start, right.start);
+			m_operand = right;
+			m_operand.start = left.start;
+			m_operand.constants = left.constants;
 			return;
 		}
+
+		Emit8(opcode);
+		m_operand = { Operand::Kind::Other, 0, left.start, left.constants, type };
 	}
 
 	void Parser::Unary() {
 		
-		RToken operator_ = m_previous;
+		Token operator_token = m_previous;
 		ParsePrecedence(Precedence::UNARY);
+		Operand operand = m_operand;
 		
-		switch (operator_->KindType)
+		switch (operator_token.KindType)
 		{
-		case Token::Kind::Minus:
-			Emit8(VM::OpCode::Negate);
+		case Token::Kind::Minus: {
+			std::optional<TypeChecker::Result> checked = TypeChecker::Negate(operand.type);
+			if (!checked)
+				throw Report(operator_token, std::string(TypeChecker::OperandError));
+
+			if (m_folding && operand.kind == Operand::Kind::Constant) {
+				current_chunk.Truncate(operand.start, operand.constants);
+				Value value = operand.type == Type::Integer
+					? Value::Integer(VM::Integer::Negate(operand.value.AsInteger()))
+					: Value(-operand.value.ToNumber());
+				EmitConstant(value);
+				m_operand = { Operand::Kind::Constant, value, operand.start, operand.constants, checked->type };
+			}
+			else if (m_folding && operand.kind == Operand::Kind::Negate && current_chunk.At(current_chunk.Size() - 1) != VM::OpCode::Negate) {
+				// -(-x) is x for every IEEE value, NaN payloads included, and
+				// for wrapping integers. The generic Negate is kept since it
+				// turns integers into numbers.
+				current_chunk.Truncate(current_chunk.Size() - 1, current_chunk.ConstantCount());
+				m_operand = { Operand::Kind::Other, 0, operand.start, operand.constants, operand.type };
+			}
+			else {
+				Emit8(checked->opcode);
+				m_operand = { Operand::Kind::Negate, 0, operand.start, operand.constants, checked->type };
+			}
+			break;
+		}
+		default:
 			break;
+		}
+	}
+
+	void Parser::SetFolding(bool enabled) {
+
+		m_folding = enabled;
+	}
+
+	Parser::Operand Parser::Mark() const {
+
+		return { Operand::Kind::Other, 0, current_chunk.Size(), current_chunk.ConstantCount() };
+	}
+
+	// See the interpreter's handlers.
+	std::optional<Value> Parser::Fold(Byte opcode, Value left, Value right) {
+
+		std::int32_t x = left.AsInteger();
+		std::int32_t y = right.AsInteger();
+
+		switch (opcode) {
+		case VM::OpCode::Integer_Add:
+			return Value::Integer(VM::Integer::Add(x, y));
+		case VM::OpCode::Integer_Substract:
+			return Value::Integer(VM::Integer::Substract(x, y));
+		case VM::OpCode::Integer_Multiply:
+			return Value::Integer(VM::Integer::Multiply(x, y));
+		case VM::OpCode::Integer_Divide:
+			if (y == 0)
+				return std::nullopt;
+			return Value::Integer(VM::Integer::Divide(x, y));
+		case VM::OpCode::Integer_Equal:
+			return Value::Bool(x == y);
+		case VM::OpCode::Integer_Not_Equal:
+			return Value::Bool(x != y);
+		case VM::OpCode::Integer_Less:
+			return Value::Bool(x < y);
+		case VM::OpCode::Integer_Less_Equal:
+			return Value::Bool(x <= y);
+		case VM::OpCode::Integer_Greater:
+			return Value::Bool(x > y);
+		case VM::OpCode::Integer_Greater_Equal:
+			return Value::Bool(x >= y);
+		case VM::OpCode::Equal:
+			return Value::Bool(left.Equals(right));
+		case VM::OpCode::Not_Equal:
+			return Value::Bool(!left.Equals(right));
 		default:
 			break;
 		}
+
+		if (!left.IsNumeric() || !right.IsNumeric())
+			return std::nullopt;
+
+		double a = left.ToNumber();
+		double b = right.ToNumber();
+
+		switch (opcode) {
+		case VM::OpCode::Add:
+		case VM::OpCode::Number_Add:
+			return a + b;
+		case VM::OpCode::Substract:
+		case VM::OpCode::Number_Substract:
+			return a - b;
+		case VM::OpCode::Multiply:
+		case VM::OpCode::Number_Multiply:
+			return a * b;
+		case VM::OpCode::Divide:
+		case VM::OpCode::Number_Divide:
+			return a / b;
+		case VM::OpCode::Number_Equal:
+			return Value::Bool(a == b);
+		case VM::OpCode::Number_Not_Equal:
+			return Value::Bool(a != b);
+		case VM::OpCode::Less:
+		case VM::OpCode::Number_Less:
+			return Value::Bool(a < b);
+		case VM::OpCode::Less_Equal:
+		case VM::OpCode::Number_Less_Equal:
+			return Value::Bool(a <= b);
+		case VM::OpCode::Greater:
+		case VM::OpCode::Number_Greater:
+			return Value::Bool(a > b);
+		case VM::OpCode::Greater_Equal:
+		case VM::OpCode::Number_Greater_Equal:
+			return Value::Bool(a >= b);
+		default:
+			return std::nullopt;
+		}
+	}
+
+	// Only identities that hold bit for bit under IEEE 754: x + 0 is not one
+	// (-0 + 0 is +0) but x + -0 and x - 0 are. Integer ones always hold.
+	bool Parser::IsRightIdentity(Byte opcode, Value constant) {
+
+		switch (opcode) {
+		case VM::OpCode::Integer_Add:
+		case VM::OpCode::Integer_Substract:
+			return constant.AsInteger() == 0;
+		case VM::OpCode::Integer_Multiply:
+		case VM::OpCode::Integer_Divide:
+			return constant.AsInteger() == 1;
+		default:
+			break;
+		}
+
+		if (!constant.IsNumeric())
+			return false;
+
+		double value = constant.ToNumber();
+
+		switch (opcode) {
+		case VM::OpCode::Add:
+		case VM::OpCode::Number_Add:
+			return value == 0 && std::signbit(value);
+		case VM::OpCode::Substract:
+		case VM::OpCode::Number_Substract:
+			return value == 0 && !std::signbit(value);
+		case VM::OpCode::Multiply:
+		case VM::OpCode::Number_Multiply:
+		case VM::OpCode::Divide:
+		case VM::OpCode::Number_Divide:
+			return value == 1;
+		default:
+			return false;
+		}
+	}
+
+	bool Parser::IsLeftIdentity(Byte opcode, Value constant) {
+
+		switch (opcode) {
+		case VM::OpCode::Integer_Add:
+			return constant.AsInteger() == 0;
+		case VM::OpCode::Integer_Multiply:
+			return constant.AsInteger() == 1;
+		default:
+			break;
+		}
+
+		if (!constant.IsNumeric())
+			return false;
+
+		double value = constant.ToNumber();
+
+		switch (opcode) {
+		case VM::OpCode::Add:
+		case VM::OpCode::Number_Add:
+			return value == 0 && std::signbit(value);
+		case VM::OpCode::Multiply:
+		case VM::OpCode::Number_Multiply:
+			return value == 1;
+		default:
+			return false;
+		}
 	}
 
 	void Parser::ParsePrecedence(Precedence pre) {
 
 		Advance();
-		Rule rule = Rule::Get(m_previous->KindType);
+		m_operand = Mark();
+		const Rule& rule = Rule::Get(m_previous.KindType);
 		
 		if (rule.prefix == nullptr) {
 			throw Report("Expect expression.");
 		}
 		
-		rule.prefix(*this);
+		(this->*rule.prefix)();
 
-		while (pre <= Rule::Get(m_current->KindType).precedence) {
+		while (pre <= Rule::Get(m_current.KindType).precedence) {
 
 			Advance();
-			Rule previous_rule = Rule::Get(m_previous->KindType);
-			previous_rule.infix(*this);
+			(this->*Rule::Get(m_previous.KindType).infix)();
 		}
 	}
 	
-	Ref<Token> Parser::Consume(Token::Kind kind, const std::string_view message) {
+	const Token& Parser::Consume(Token::Kind kind, const std::string_view message) {
 		
 		if (Check(kind)) 
 			return Advance();
@@ -90,62 +316,78 @@ namespace Analysis {
 		throw Report(std::string(message));
 	}
 
-	Ref<Token> Parser::Advance() {
+	const Token& Parser::Advance() {
 
 		m_previous = m_current;
 		m_current = Peek();
-		return m_current;
+		return m_previous;
 	}
 
 	bool Parser::Check(Token::Kind kind) {
 
-		return m_current->KindType == kind;
+		return m_current.KindType == kind;
 	}
 
 	bool Parser::IsAtEnd() {
 
-		return m_current->KindType == Token::Kind::TkEOF;
+		return m_current.KindType == Token::Kind::TkEOF;
 	}
 
-	Ref<Token> Parser::Peek() {
+	Token Parser::Peek() {
 
-		return lexer.PeekNextToken();
+		if (m_last == nullptr)
+			return lexer.PeekNextToken();
+
+		if (m_next != m_last)
+			return *m_next++;
+
+		Token eof = m_previous;
+		eof.KindType = Token::Kind::TkEOF;
+		eof.Offset += eof.Length;
+		eof.Length = 0;
+		return eof;
 	}
 
-	std::exception Parser::Report(Ref<Token> tk, const std::string& msg) {
+	std::exception Parser::Report(const Token& tk, const std::string& msg) {
 		
-		std::cerr << Diagnostic(tk, msg) << "\n";
+		Diagnostics::Emit(lexer.GetDiagnostics(), Diagnostic(tk, msg));
 		return std::exception();
 	}
 
 	std::exception Parser::Report(const std::string& msg) {
 		
-		return Report(Peek(), msg);
+		return Report(m_current, msg);
 	}
 
-	std::string Parser::Diagnostic(Ref<Token> tk, const std::string& msg) {
+	std::string Parser::Diagnostic(const Token& tk, const std::string& msg) {
 		
-		if (tk->KindType == Token::Kind::TkEOF) return "Error: " + msg;
+		if (tk.KindType == Token::Kind::TkEOF) return "Error: " + msg;
 		
 		return "Error: To the line " +
-			std::to_string(tk->Line + 1) + " for '" + tk->Text.c_str() + "' | " + msg;
+			std::to_string(tk.Line + 1) + " for '" + std::string(lexer.Lexeme(tk)) + "' | " + msg;
 	}
 
 	Parser::Parser(VM::Chunk& current_chunk, Lexer& lexer)
-		: current_chunk(current_chunk), lexer(lexer) {
+		: current_chunk(current_chunk), lexer(lexer), m_current{}, m_previous{} {
+
+		Advance();
+	}
+
+	Parser::Parser(VM::Chunk& current_chunk, Lexer& lexer, const Token* first, const Token* last)
+		: current_chunk(current_chunk), lexer(lexer), m_current{}, m_previous{}, m_next(first), m_last(last) {
 
 		Advance();
 	}
 
 	void Parser::Emit8(const Byte& byte) {
 		
-		current_chunk.SetLine(m_previous->Line);
+		current_chunk.SetLine(m_previous.Line);
 		current_chunk.Write8(byte);
 	}
 
 	void Parser::Emit16(const Byte& byte1, const Byte& byte2) {
 
-		current_chunk.SetLine(m_previous->Line);
+		current_chunk.SetLine(m_previous.Line);
 		current_chunk.Write16(byte1, byte2);
 	}
 
@@ -153,54 +395,51 @@ namespace Analysis {
 
 		auto constant = current_chunk.AddConstant(value);
 		
-		if (constant > UINT8_MAX) {
+		if (constant > UINT16_MAX) {
 			throw Report("Too many constants in one chunk.");
 		}
+
+		if (constant > UINT8_MAX) {
+			Emit8(VM::OpCode::Constant_Long);
+			Emit16((constant >> 8) & 0xFF, constant & 0xFF);
+			return;
+		}
 		
 		Emit16(VM::OpCode::Constant, constant);
 	}
 
-	Parser::Rule Parser::Rule::Get(Token::Kind type) {
-		return rules[type];
-	}
-
-	Parser::Rule::Rule(std::function<void(Parser&)> prefix, std::function<void(Parser&)> infix, Precedence precedence)
-		: prefix(prefix), infix(infix), precedence(precedence) { }
-
-	std::unordered_map<Token::Kind, Parser::Rule> Parser::Rule::rules = {
-		{Token::Kind::OpenParenthesis,  Rule(&Parser::Grouping,			nullptr,	Precedence::NONE)},
-		{Token::Kind::CloseParenthesis, Rule(nullptr,					nullptr,	Precedence::NONE)},
-		{Token::Kind::OpenBracket,		Rule(nullptr,					nullptr,	Precedence::NONE)},
-		{Token::Kind::CloseBracket,		Rule(nullptr,					nullptr,	Precedence::NONE)},
-		{Token::Kind::Comma,			Rule(nullptr,					nullptr,	Precedence::NONE)},
-		{Token::Kind::Dot,				Rule(nullptr,					nullptr,	Precedence::NONE)},
-		{Token::Kind::Minus,			Rule(&Parser::Unary,    &Parser::Binary,	Precedence::TERM)},
-		{Token::Kind::Plus,				Rule(nullptr,			&Parser::Binary,	Precedence::TERM)},
-		{Token::Kind::Semicolon,		Rule(nullptr,					nullptr,	Precedence::NONE)},
-		{Token::Kind::Slash,			Rule(nullptr,			&Parser::Binary,	Precedence::FACTOR)},
-		{Token::Kind::Star,				Rule(nullptr,			&Parser::Binary,	Precedence::FACTOR)},
-		{Token::Kind::Assign,			Rule(nullptr,					nullptr,	Precedence::NONE)},
-		{Token::Kind::Not,				Rule(nullptr,					nullptr,	Precedence::NONE)},
-		{Token::Kind::NotEqual,			Rule(nullptr,			&Parser::Binary,	Precedence::COMPARISON)},
-		{Token::Kind::Equal,			Rule(nullptr,			&Parser::Binary,	Precedence::COMPARISON)},
-		{Token::Kind::Greater,			Rule(nullptr,			&Parser::Binary,	Precedence::COMPARISON)},
-		{Token::Kind::GreaterEqual,		Rule(nullptr,			&Parser::Binary,	Precedence::COMPARISON)},
-		{Token::Kind::Less,				Rule(nullptr,			&Parser::Binary,	Precedence::COMPARISON)},
-		{Token::Kind::LessEqual,		Rule(nullptr,			&Parser::Binary,	Precedence::COMPARISON)},
-		{Token::Kind::Identifier,		Rule(nullptr,					nullptr,	Precedence::NONE)},
-		{Token::Kind::String,			Rule(nullptr,					nullptr,	Precedence::NONE)},
-		{Token::Kind::Number,			Rule(&Parser::Number,			nullptr,	Precedence::NONE)},
-		{Token::Kind::LogicalAnd,		Rule(nullptr,					nullptr,	Precedence::NONE)},
-		{Token::Kind::Else,				Rule(nullptr,					nullptr,	Precedence::NONE)},
-		{Token::Kind::False,			Rule(nullptr,					nullptr,	Precedence::NONE)},
-		{Token::Kind::For,				Rule(nullptr,					nullptr,	Precedence::NONE)},
-		{Token::Kind::Func,				Rule(nullptr,					nullptr,	Precedence::NONE)},
-		{Token::Kind::If,				Rule(nullptr,					nullptr,	Precedence::NONE)},
-		{Token::Kind::LogicalOr,		Rule(nullptr,					nullptr,	Precedence::NONE)},
-		{Token::Kind::Return,			Rule(nullptr,					nullptr,	Precedence::NONE)},
-		{Token::Kind::True,				Rule(nullptr,					nullptr,	Precedence::NONE)},
-		{Token::Kind::Let,				Rule(nullptr,					nullptr,	Precedence::NONE)},
-		{Token::Kind::TkEOF,				Rule(nullptr,					nullptr,	Precedence::NONE)},
-	};
+	const Parser::Rule& Parser::Rule::Get(Token::Kind type) {
+
+		return rules[static_cast<std::size_t>(type)];
+	}
+
+	// Kinds that are not listed have no prefix or infix rule and NONE
+	// precedence, which ends an expression.
+	constexpr std::array<Parser::Rule, Token::KindCount> Parser::Rule::Build() {
+
+		std::array<Rule, Token::KindCount> table{};
+
+		auto set = [&table](Token::Kind kind, Function prefix, Function infix, Precedence precedence) {
+			table[static_cast<std::size_t>(kind)] = Rule{ prefix, infix, precedence };
+		};
+
+		set(Token::Kind::OpenParenthesis,  &Parser::Grouping,  nullptr,          Precedence::NONE);
+		set(Token::Kind::Minus,            &Parser::Unary,     &Parser::Binary,  Precedence::TERM);
+		set(Token::Kind::Plus,             nullptr,            &Parser::Binary,  Precedence::TERM);
+		set(Token::Kind::Slash,            nullptr,            &Parser::Binary,  Precedence::FACTOR);
+		set(Token::Kind::Star,             nullptr,            &Parser::Binary,  Precedence::FACTOR);
+		set(Token::Kind::NotEqual,         nullptr,            &Parser::Binary,  Precedence::COMPARISON);
+		set(Token::Kind::Equal,            nullptr,            &Parser::Binary,  Precedence::COMPARISON);
+		set(Token::Kind::Greater,          nullptr,            &Parser::Binary,  Precedence::COMPARISON);
+		set(Token::Kind::GreaterEqual,     nullptr,            &Parser::Binary,  Precedence::COMPARISON);
+		set(Token::Kind::Less,             nullptr,            &Parser::Binary,  Precedence::COMPARISON);
+		set(Token::Kind::LessEqual,        nullptr,            &Parser::Binary,  Precedence::COMPARISON);
+		set(Token::Kind::Number,           &Parser::Number,    nullptr,          Precedence::NONE);
+
+		return table;
+	}
+
+	constexpr std::array<Parser::Rule, Token::KindCount> Parser::Rule::rules = Build();
+
 
 }
@@ -1,10 +1,11 @@
 #pragma once
 
-#include <unordered_map>
-#include <functional>
+#include <array>
+#include <optional>
 
 #include "common/common.hpp"
 #include "analysis/lexer.hpp"
+#include "analysis/type_checker.hpp"
 #include "vm/chunk.hpp"
 
 namespace Analysis {
@@ -26,6 +27,7 @@ enum Precedence : Byte {
 	PRIMARY = 10
 };
 public:
+	void Declaration();
 	void Expression();
     void Number();
     void Grouping();
@@ -34,46 +36,77 @@ public:
     void ParsePrecedence(Precedence pre);
 	bool IsAtEnd();
 	bool Check(Token::Kind kind);
-	Ref<Token> Peek();
-	Ref<Token> Advance();
-	Ref<Token> Consume(Token::Kind kind, const std::string_view message);
+	Token Peek();
+	const Token& Advance();
+	const Token& Consume(Token::Kind kind, const std::string_view message);
 	std::exception Report(const std::string& msg);
-	std::exception Report(Ref<Token> tk, const std::string& msg);
-	std::string Diagnostic(Ref<Token> tk, const std::string& msg);
+	std::exception Report(const Token& tk, const std::string& msg);
+	std::string Diagnostic(const Token& tk, const std::string& msg);
 	void Emit8(const Byte& byte);
 	void Emit16(const Byte& byte1, const Byte& byte2);
 	void EmitConstant(const Value& value);
+	// Constant folding and the algebraic simplifications; on by default.
+	void SetFolding(bool enabled);
+	// Computes what the interpreter would for opcode on two constants.
+	// Empty when the operation must be left to the runtime, which reports
+	// the error.
+	static std::optional<Value> Fold(Byte opcode, Value left, Value right);
 
 public:
     Parser(VM::Chunk& current_chunk, Lexer& lexer);
+	// Parses the already lexed tokens [first, last) instead of pulling from
+	// the lexer, which is then only used to read lexemes back.
+    Parser(VM::Chunk& current_chunk, Lexer& lexer, const Token* first, const Token* last);
     ~Parser() = default;
 
 private:
-    Lexer lexer;
-    Ref<Token> m_current;
-    Ref<Token> m_previous;
+	// What the most recently parsed (sub)expression compiled to, so that
+	// constant operands can be folded as the code is emitted. start and
+	// constants are the chunk size and pool size before its code; type is
+	// its static type, see TypeChecker.
+	struct Operand {
+		enum class Kind : Byte {
+			Constant,
+			Negate,
+			Other
+		};
+
+		Kind kind;
+		Value value;
+		std::size_t start;
+		std::size_t constants;
+		Type type = Type::Unknown;
+	};
+
+	Operand Mark() const;
+	static bool IsRightIdentity(Byte opcode, Value constant);
+	static bool IsLeftIdentity(Byte opcode, Value constant);
+
+private:
+    Lexer& lexer;
+    Token m_current;
+    Token m_previous;
 	VM::Chunk& current_chunk;
+	const Token* m_next = nullptr;
+	const Token* m_last = nullptr;
+	Operand m_operand{};
+	bool m_folding = true;
 
 private:
 
 class Rule {
 
 public:
-	static Rule Get(Token::Kind type);
-	std::function<void(Parser&)> prefix;
-	std::function<void(Parser&)> infix;
-	Parser::Precedence precedence;
-
-public:
-	Rule(std::function<void(Parser&)> prefix, std::function<void(Parser&)> infix, Parser::Precedence precedence);
-	Rule() = default;
-	Rule(const Rule&) = default;
-	Rule(Rule&&) = default;
-	~Rule() = default;
+	using Function = void (Parser::*)();
 
+	static const Rule& Get(Token::Kind type);
+	Function prefix;
+	Function infix;
+	Parser::Precedence precedence;
 
 private:
-	static std::unordered_map<Token::Kind, Rule> rules;
+	static constexpr std::array<Rule, Token::KindCount> Build();
+	static const std::array<Rule, Token::KindCount> rules;
 
 };
 
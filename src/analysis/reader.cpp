@@ -0,0 +1,22 @@
+#include "analysis/reader.hpp"
+
+#include <stdexcept>
+
+namespace Analysis {
+
+	StreamReader::StreamReader(std::istream& stream) : m_stream(stream) { }
+
+	std::size_t StreamReader::Read(char* buffer, std::size_t size) {
+
+		if (!m_stream)
+			return 0;
+
+		m_stream.read(buffer, static_cast<std::streamsize>(size));
+
+		if (m_stream.bad())
+			throw std::runtime_error("Cannot read source.");
+
+		return static_cast<std::size_t>(m_stream.gcount());
+	}
+
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <istream>
+
+namespace Analysis {
+
+// Pull interface for streaming program text into the lexer block by block.
+class Reader {
+
+public:
+	// Fills at most size bytes of buffer and returns how many were written.
+	// Returning 0 means the end of the input.
+	virtual std::size_t Read(char* buffer, std::size_t size) = 0;
+
+public:
+	virtual ~Reader() = default;
+
+};
+
+// Reads from a std::istream (file, pipe or std::cin) without owning it.
+class StreamReader final : public Reader {
+
+public:
+	std::size_t Read(char* buffer, std::size_t size) override;
+
+public:
+	explicit StreamReader(std::istream& stream);
+
+private:
+	std::istream& m_stream;
+
+};
+
+}
@@ -0,0 +1,273 @@
+#include "analysis/scanner.hpp"
+
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define RAVI_SCANNER_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define RAVI_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define RAVI_TARGET_AVX2
+#endif
+
+namespace Analysis {
+
+namespace {
+
+	inline bool IsBlank(char c) {
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	inline bool IsDigit(char c) {
+		return c >= '0' && c <= '9';
+	}
+
+	inline bool IsAlnum(char c) {
+		char lower = c | 0x20;
+		return IsDigit(c) || (lower >= 'a' && lower <= 'z');
+	}
+
+	const char* ScalarSkipBlanks(const char* begin, const char* end) {
+		while (begin < end && IsBlank(*begin)) begin++;
+		return begin;
+	}
+
+	const char* ScalarSkipAlnum(const char* begin, const char* end) {
+		while (begin < end && IsAlnum(*begin)) begin++;
+		return begin;
+	}
+
+	const char* ScalarSkipDigits(const char* begin, const char* end) {
+		while (begin < end && IsDigit(*begin)) begin++;
+		return begin;
+	}
+
+	const char* ScalarFindNewline(const char* begin, const char* end) {
+		while (begin < end && *begin != '\n') begin++;
+		return begin;
+	}
+
+#ifdef RAVI_SCANNER_X86
+
+	inline unsigned CountTrailingZeros(std::uint32_t mask) {
+#if defined(_MSC_VER) && !defined(__clang__)
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return index;
+#else
+		return __builtin_ctz(mask);
+#endif
+	}
+
+	// Signed byte compares are enough for the ranges below: bytes >= 0x80
+	// compare as negative and therefore never fall inside an ASCII range.
+	inline __m128i InRange(__m128i v, char lo, char hi) {
+		return _mm_and_si128(
+			_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)),
+			_mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1))
+		);
+	}
+
+	inline __m128i BlankMask(__m128i v) {
+		return _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+			_mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))
+		);
+	}
+
+	inline __m128i AlnumMask(__m128i v) {
+		__m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+		return _mm_or_si128(InRange(v, '0', '9'), InRange(lower, 'a', 'z'));
+	}
+
+	template<__m128i (*Mask)(__m128i), const char* (*Tail)(const char*, const char*)>
+	const char* SSE2SkipWhile(const char* begin, const char* end) {
+
+		for (; end - begin >= 16; begin += 16) {
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+			std::uint32_t mask = static_cast<std::uint32_t>(_mm_movemask_epi8(Mask(v)));
+			if (mask != 0xFFFF)
+				return begin + CountTrailingZeros(~mask);
+		}
+
+		return Tail(begin, end);
+	}
+
+	inline __m128i DigitMask(__m128i v) {
+		return InRange(v, '0', '9');
+	}
+
+	const char* SSE2FindNewline(const char* begin, const char* end) {
+
+		for (; end - begin >= 16; begin += 16) {
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+			std::uint32_t mask = static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))));
+			if (mask != 0)
+				return begin + CountTrailingZeros(mask);
+		}
+
+		return ScalarFindNewline(begin, end);
+	}
+
+	RAVI_TARGET_AVX2 inline __m256i InRange256(__m256i v, char lo, char hi) {
+		return _mm256_and_si256(
+			_mm256_cmpgt_epi8(v, _mm256_set1_epi8(lo - 1)),
+			_mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), v)
+		);
+	}
+
+	RAVI_TARGET_AVX2 inline __m256i BlankMask256(__m256i v) {
+		return _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+			_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))
+		);
+	}
+
+	RAVI_TARGET_AVX2 inline __m256i AlnumMask256(__m256i v) {
+		__m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+		return _mm256_or_si256(InRange256(v, '0', '9'), InRange256(lower, 'a', 'z'));
+	}
+
+	RAVI_TARGET_AVX2 inline __m256i DigitMask256(__m256i v) {
+		return InRange256(v, '0', '9');
+	}
+
+	RAVI_TARGET_AVX2 inline __m256i NewlineMask256(__m256i v) {
+		return _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'));
+	}
+
+	// Matches 32 bytes per step while the mask holds, then lets the SSE2
+	// variant finish the remaining tail.
+	template<__m256i (*Mask)(__m256i), const char* (*Tail)(const char*, const char*), bool Until>
+	RAVI_TARGET_AVX2 const char* AVX2Scan(const char* begin, const char* end) {
+
+		for (; end - begin >= 32; begin += 32) {
+			__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+			std::uint32_t mask = static_cast<std::uint32_t>(_mm256_movemask_epi8(Mask(v)));
+			if (Until) mask = ~mask;
+			if (mask != 0xFFFFFFFFu)
+				return begin + CountTrailingZeros(~mask);
+		}
+
+		return Tail(begin, end);
+	}
+
+	bool HasAVX2() {
+#if defined(__GNUC__) || defined(__clang__)
+		return __builtin_cpu_supports("avx2");
+#elif defined(_MSC_VER)
+		int info[4];
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+#else
+		return false;
+#endif
+	}
+
+#endif
+
+}
+
+	const char* Scanner::SkipBlanks(const char* begin, const char* end) {
+		return Active()->skip_blanks(begin, end);
+	}
+
+	const char* Scanner::SkipAlnum(const char* begin, const char* end) {
+		return Active()->skip_alnum(begin, end);
+	}
+
+	const char* Scanner::SkipDigits(const char* begin, const char* end) {
+		return Active()->skip_digits(begin, end);
+	}
+
+	const char* Scanner::FindNewline(const char* begin, const char* end) {
+		return Active()->find_newline(begin, end);
+	}
+
+	Scanner::Backend Scanner::Best() {
+#ifdef RAVI_SCANNER_X86
+		return HasAVX2() ? Backend::AVX2 : Backend::SSE2;
+#else
+		return Backend::Scalar;
+#endif
+	}
+
+	Scanner::Backend Scanner::Current() {
+		return Active()->backend;
+	}
+
+	bool Scanner::Select(Backend backend) {
+
+		const Table* table = Lookup(backend);
+		if (table == nullptr)
+			return false;
+
+		Active() = table;
+		return true;
+	}
+
+	std::string_view Scanner::ToString(Backend backend) {
+
+		switch (backend) {
+		case Backend::Scalar:
+			return "scalar";
+		case Backend::SSE2:
+			return "sse2";
+		case Backend::AVX2:
+			return "avx2";
+		default:
+			return "undefined";
+		}
+	}
+
+	const Scanner::Table* Scanner::Lookup(Backend backend) {
+
+		static const Table scalar{
+			Backend::Scalar, ScalarSkipBlanks, ScalarSkipAlnum, ScalarSkipDigits, ScalarFindNewline
+		};
+
+#ifdef RAVI_SCANNER_X86
+		static const Table sse2{
+			Backend::SSE2,
+			SSE2SkipWhile<BlankMask, ScalarSkipBlanks>,
+			SSE2SkipWhile<AlnumMask, ScalarSkipAlnum>,
+			SSE2SkipWhile<DigitMask, ScalarSkipDigits>,
+			SSE2FindNewline
+		};
+
+		static const Table avx2{
+			Backend::AVX2,
+			AVX2Scan<BlankMask256, SSE2SkipWhile<BlankMask, ScalarSkipBlanks>, false>,
+			AVX2Scan<AlnumMask256, SSE2SkipWhile<AlnumMask, ScalarSkipAlnum>, false>,
+			AVX2Scan<DigitMask256, SSE2SkipWhile<DigitMask, ScalarSkipDigits>, false>,
+			AVX2Scan<NewlineMask256, SSE2FindNewline, true>
+		};
+#endif
+
+		switch (backend) {
+		case Backend::Scalar:
+			return &scalar;
+#ifdef RAVI_SCANNER_X86
+		case Backend::SSE2:
+			return &sse2;
+		case Backend::AVX2:
+			return HasAVX2() ? &avx2 : nullptr;
+#endif
+		default:
+			return nullptr;
+		}
+	}
+
+	const Scanner::Table*& Scanner::Active() {
+
+		static const Table* active = Lookup(Best());
+		return active;
+	}
+
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <string_view>
+
+namespace Analysis {
+
+// Byte-class scanning primitives used by the lexer on its hot paths.
+// Every function returns the first position in [begin, end) that is not
+// part of the run, or end when the whole range matches.
+class Scanner {
+
+public:
+	enum class Backend {
+		Scalar,
+		SSE2,
+		AVX2
+	};
+
+public:
+	// Spaces, tabs and carriage returns. Newlines are left to the caller
+	// since they advance the line counter.
+	static const char* SkipBlanks(const char* begin, const char* end);
+	// [A-Za-z0-9]
+	static const char* SkipAlnum(const char* begin, const char* end);
+	// [0-9]
+	static const char* SkipDigits(const char* begin, const char* end);
+	static const char* FindNewline(const char* begin, const char* end);
+
+	// The widest backend supported by the running CPU is picked on first use.
+	// Select() overrides it, e.g. to compare backends; it must not be called
+	// while another thread is lexing.
+	static Backend Best();
+	static Backend Current();
+	static bool Select(Backend backend);
+	static std::string_view ToString(Backend backend);
+
+private:
+	struct Table {
+		Backend backend;
+		const char* (*skip_blanks)(const char*, const char*);
+		const char* (*skip_alnum)(const char*, const char*);
+		const char* (*skip_digits)(const char*, const char*);
+		const char* (*find_newline)(const char*, const char*);
+	};
+
+	static const Table* Lookup(Backend backend);
+	static const Table*& Active();
+
+};
+
+}
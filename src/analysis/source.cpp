@@ -0,0 +1,171 @@
+#include "analysis/source.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Analysis {
+
+namespace {
+
+	// Token offsets are 32-bit.
+	constexpr std::size_t MaxSourceSize = UINT32_MAX;
+	constexpr std::size_t ReadBlockSize = 64 * 1024;
+
+	std::runtime_error SystemError(const std::string& what) {
+		return std::runtime_error(what + ": " + std::strerror(errno));
+	}
+
+}
+
+	Source Source::Open(const std::string& path) {
+
+		if (path == "-")
+			return FromDescriptor(0);
+
+#ifdef _WIN32
+		int fd = _open(path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+		int fd = ::open(path.c_str(), O_RDONLY);
+#endif
+		if (fd < 0)
+			throw SystemError("Cannot open '" + path + "'");
+
+		try {
+			Source source = FromDescriptor(fd);
+#ifdef _WIN32
+			_close(fd);
+#else
+			::close(fd);
+#endif
+			return source;
+		}
+		catch (...) {
+#ifdef _WIN32
+			_close(fd);
+#else
+			::close(fd);
+#endif
+			throw;
+		}
+	}
+
+	Source Source::FromDescriptor(int fd) {
+
+		Source source;
+
+#ifndef _WIN32
+		struct stat info;
+		if (::fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+
+			std::size_t size = static_cast<std::size_t>(info.st_size);
+			if (size > MaxSourceSize)
+				throw std::runtime_error("Source files larger than 4 GiB are not supported.");
+
+			void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (mapping != MAP_FAILED) {
+#ifdef MADV_SEQUENTIAL
+				::madvise(mapping, size, MADV_SEQUENTIAL);
+#endif
+				source.m_kind = Kind::Mapped;
+				source.m_data = static_cast<const char*>(mapping);
+				source.m_size = size;
+				return source;
+			}
+		}
+#endif
+
+		for (;;) {
+
+			std::size_t used = source.m_buffer.size();
+			source.m_buffer.resize(used + ReadBlockSize);
+
+#ifdef _WIN32
+			int count = _read(fd, source.m_buffer.data() + used, ReadBlockSize);
+#else
+			ssize_t count = ::read(fd, source.m_buffer.data() + used, ReadBlockSize);
+			if (count < 0 && errno == EINTR) {
+				source.m_buffer.resize(used);
+				continue;
+			}
+#endif
+			if (count < 0)
+				throw SystemError("Cannot read source");
+
+			source.m_buffer.resize(used + static_cast<std::size_t>(count));
+			if (count == 0)
+				break;
+
+			if (source.m_buffer.size() > MaxSourceSize)
+				throw std::runtime_error("Source files larger than 4 GiB are not supported.");
+		}
+
+		source.m_buffer.shrink_to_fit();
+		source.m_kind = Kind::Buffered;
+		source.m_data = source.m_buffer.data();
+		source.m_size = source.m_buffer.size();
+		return source;
+	}
+
+	std::string_view Source::Text() const {
+
+		return std::string_view(m_data, m_size);
+	}
+
+	Source::Kind Source::GetKind() const {
+
+		return m_kind;
+	}
+
+	Source::Source(Source&& other) noexcept {
+
+		*this = std::move(other);
+	}
+
+	Source& Source::operator=(Source&& other) noexcept {
+
+		if (this == &other)
+			return *this;
+
+		Release();
+		m_kind = other.m_kind;
+		m_size = other.m_size;
+		m_buffer = std::move(other.m_buffer);
+		m_data = m_kind == Kind::Mapped ? other.m_data : m_buffer.data();
+
+		other.m_kind = Kind::Buffered;
+		other.m_data = nullptr;
+		other.m_size = 0;
+		return *this;
+	}
+
+	Source::~Source() {
+
+		Release();
+	}
+
+	void Source::Release() {
+
+#ifndef _WIN32
+		if (m_kind == Kind::Mapped && m_data != nullptr)
+			::munmap(const_cast<char*>(m_data), m_size);
+#endif
+		m_kind = Kind::Buffered;
+		m_data = nullptr;
+		m_size = 0;
+		m_buffer.clear();
+	}
+
+}
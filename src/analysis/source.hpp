@@ -0,0 +1,51 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "common/common.hpp"
+
+namespace Analysis {
+
+// Read-only program text. Regular files are memory-mapped and lexed in
+// place; pipes, terminals and stdin are drained into a growable buffer.
+// Tokens and diagnostics reference these bytes, so a Source must outlive
+// the compilation that reads it.
+class Source {
+
+public:
+	enum class Kind {
+		Mapped,
+		Buffered
+	};
+
+public:
+	// "-" reads standard input. Throws std::runtime_error when the input
+	// cannot be opened or read.
+	static Source Open(const std::string& path);
+	static Source FromDescriptor(int fd);
+
+	std::string_view Text() const;
+	Kind GetKind() const;
+
+public:
+	Source(const Source&) = delete;
+	Source(Source&& other) noexcept;
+	Source& operator=(const Source&) = delete;
+	Source& operator=(Source&& other) noexcept;
+	~Source();
+
+private:
+	Source() = default;
+	void Release();
+
+private:
+	Kind m_kind = Kind::Buffered;
+	const char* m_data = nullptr;
+	std::size_t m_size = 0;
+	std::vector<char> m_buffer;
+
+};
+
+}
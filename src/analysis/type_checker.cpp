@@ -0,0 +1,99 @@
+#include "analysis/type_checker.hpp"
+#include "vm/virtual_machine.hpp"
+
+namespace Analysis {
+
+	namespace {
+
+		// Generic, Number_* and Integer_* opcodes of one operation.
+		struct Family {
+			VM::OpCode generic;
+			VM::OpCode number;
+			VM::OpCode integer;
+			bool comparison;
+		};
+
+		std::optional<Family> FamilyOf(Token::Kind op) {
+
+			using VM::OpCode;
+
+			switch (op) {
+			case Token::Kind::Plus:
+				return Family{ OpCode::Add, OpCode::Number_Add, OpCode::Integer_Add, false };
+			case Token::Kind::Minus:
+				return Family{ OpCode::Substract, OpCode::Number_Substract, OpCode::Integer_Substract, false };
+			case Token::Kind::Star:
+				return Family{ OpCode::Multiply, OpCode::Number_Multiply, OpCode::Integer_Multiply, false };
+			case Token::Kind::Slash:
+				return Family{ OpCode::Divide, OpCode::Number_Divide, OpCode::Integer_Divide, false };
+			case Token::Kind::Equal:
+				return Family{ OpCode::Equal, OpCode::Number_Equal, OpCode::Integer_Equal, true };
+			case Token::Kind::NotEqual:
+				return Family{ OpCode::Not_Equal, OpCode::Number_Not_Equal, OpCode::Integer_Not_Equal, true };
+			case Token::Kind::Less:
+				return Family{ OpCode::Less, OpCode::Number_Less, OpCode::Integer_Less, true };
+			case Token::Kind::LessEqual:
+				return Family{ OpCode::Less_Equal, OpCode::Number_Less_Equal, OpCode::Integer_Less_Equal, true };
+			case Token::Kind::Greater:
+				return Family{ OpCode::Greater, OpCode::Number_Greater, OpCode::Integer_Greater, true };
+			case Token::Kind::GreaterEqual:
+				return Family{ OpCode::Greater_Equal, OpCode::Number_Greater_Equal, OpCode::Integer_Greater_Equal, true };
+			default:
+				return std::nullopt;
+			}
+		}
+
+	}
+
+	std::optional<TypeChecker::Result> TypeChecker::Binary(Token::Kind op, Type left, Type right) {
+
+		std::optional<Family> family = FamilyOf(op);
+		if (!family)
+			return std::nullopt;
+
+		bool equality = op == Token::Kind::Equal || op == Token::Kind::NotEqual;
+
+		// Equality is defined between any two values; the other operations
+		// need numbers or integers, which only bools are known not to be.
+		if (!equality && (left == Type::Bool || right == Type::Bool))
+			return std::nullopt;
+
+		Type numeric = family->comparison ? Type::Bool : Type::Number;
+
+		if (left == Type::Integer && right == Type::Integer)
+			return Result{ family->integer, family->comparison ? Type::Bool : Type::Integer };
+
+		if (left == Type::Number && right == Type::Number)
+			return Result{ family->number, numeric };
+
+		// Mixed and unknown operands: the generic opcodes promote integers, so
+		// their arithmetic always yields a number.
+		return Result{ family->generic, numeric };
+	}
+
+	std::optional<TypeChecker::Result> TypeChecker::Negate(Type operand) {
+
+		switch (operand) {
+		case Type::Integer:
+			return Result{ VM::OpCode::Integer_Negate, Type::Integer };
+		case Type::Number:
+			return Result{ VM::OpCode::Number_Negate, Type::Number };
+		case Type::Bool:
+			return std::nullopt;
+		default:
+			return Result{ VM::OpCode::Negate, Type::Number };
+		}
+	}
+
+	Type TypeChecker::Of(const Value& constant) {
+
+		if (constant.IsInteger())
+			return Type::Integer;
+		if (constant.IsNumber())
+			return Type::Number;
+		if (constant.IsBool())
+			return Type::Bool;
+		return Type::Unknown;
+	}
+
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <optional>
+#include <string_view>
+
+#include "common/common.hpp"
+#include "analysis/lexer.hpp"
+
+namespace Analysis {
+
+// Static type of an expression. Unknown is for operands whose type cannot be
+// proven; they only get the generic opcodes, which check tags at runtime.
+enum class Type : Byte {
+	Unknown,
+	Number,
+	Integer,
+	Bool
+};
+
+// Type rules of the expression language, applied by the parser to every
+// operation before its code is emitted. When both operand types are proven
+// it selects an opcode specialized for them that skips the runtime tag
+// checks: Number_* for doubles and Integer_* for integers. Mixed numbers
+// and integers, and unknown operands, get the generic opcodes.
+class TypeChecker {
+
+public:
+	struct Result {
+		Byte opcode;
+		Type type;
+	};
+
+	// The opcode and result type of 'left op right', or empty when the
+	// operation can never succeed, which is then a compile error.
+	static std::optional<Result> Binary(Token::Kind op, Type left, Type right);
+	static std::optional<Result> Negate(Type operand);
+	static Type Of(const Value& constant);
+
+	static constexpr std::string_view OperandError = "Operand must be a number.";
+	static constexpr std::string_view OperandsError = "Operands must be numbers.";
+
+};
+
+}
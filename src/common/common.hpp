@@ -8,5 +8,5 @@ using Ref = std::shared_ptr<T>;
 
 using Byte = std::uint8_t;
 
-typedef double Value;
+#include "common/value.hpp"
 
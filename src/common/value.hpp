@@ -0,0 +1,90 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+
+// Heap objects are not implemented yet; values only carry their address.
+struct Object;
+
+// A NaN-boxed value in 8 bytes. Doubles are stored as themselves. Every
+// other type lives in the quiet NaN space with bit 50 set:
+//
+//   number   any double except the NaNs with bit 50 set
+//   nil      QNaN | 1,  false QNaN | 2,  true QNaN | 3
+//   integer  QNaN | IntegerTag | 32-bit payload
+//   object   Sign | QNaN | 48-bit pointer
+class Value {
+
+public:
+	static constexpr std::uint64_t SignBit = 0x8000000000000000;
+	static constexpr std::uint64_t QNaN = 0x7ffc000000000000;
+	static constexpr std::uint64_t IntegerTag = 0x0001000000000000;
+	static constexpr std::uint64_t CanonicalNaN = 0x7ff8000000000000;
+	// NaNs with bit 50 set: quiet ones collide with the boxed encodings and
+	// signaling ones would once arithmetic quiets them.
+	static constexpr std::uint64_t CollidingNaN = 0x7ff4000000000000;
+
+	static constexpr std::uint64_t NilBits = QNaN | 1;
+	static constexpr std::uint64_t FalseBits = QNaN | 2;
+	static constexpr std::uint64_t TrueBits = QNaN | 3;
+
+	static inline Value Nil() { return FromBits(NilBits); }
+	static inline Value Bool(bool value) { return FromBits(FalseBits | std::uint64_t(value)); }
+	static inline Value Integer(std::int32_t value) { return FromBits(QNaN | IntegerTag | std::uint32_t(value)); }
+	static inline Value Pointer(Object* object) { return FromBits(SignBit | QNaN | std::uint64_t(std::uintptr_t(object))); }
+	static inline Value FromBits(std::uint64_t bits) { Value value; value.m_bits = bits; return value; }
+	// Skips canonicalization: arithmetic on numbers only ever sets the quiet
+	// bit of a NaN operand, so its result cannot collide.
+	static inline Value Arithmetic(double result) { return FromBits(std::bit_cast<std::uint64_t>(result)); }
+
+	inline bool IsNumber() const { return (m_bits & QNaN) != QNaN; }
+	inline bool IsNil() const { return m_bits == NilBits; }
+	inline bool IsBool() const { return (m_bits | 1) == TrueBits; }
+	inline bool IsInteger() const { return (m_bits & (SignBit | QNaN | IntegerTag)) == (QNaN | IntegerTag); }
+	// Both are integers, tested with a single branch.
+	static inline bool AreIntegers(const Value& a, const Value& b) {
+
+		constexpr std::uint64_t tag = QNaN | IntegerTag;
+		return (((a.m_bits ^ tag) | (b.m_bits ^ tag)) & (SignBit | tag)) == 0;
+	}
+	inline bool IsObject() const { return (m_bits & (SignBit | QNaN)) == (SignBit | QNaN); }
+	// Numbers and small integers, which arithmetic accepts.
+	inline bool IsNumeric() const { return IsNumber() || IsInteger(); }
+
+	inline double AsNumber() const { return std::bit_cast<double>(m_bits); }
+	inline bool AsBool() const { return m_bits == TrueBits; }
+	inline std::int32_t AsInteger() const { return std::int32_t(std::uint32_t(m_bits)); }
+	inline Object* AsObject() const { return reinterpret_cast<Object*>(std::uintptr_t(m_bits & ~(SignBit | QNaN))); }
+	// The numeric value of a number or small integer.
+	inline double ToNumber() const { return IsInteger() ? double(AsInteger()) : AsNumber(); }
+	inline std::uint64_t Bits() const { return m_bits; }
+
+	// Identity of the encoding: equal numbers with different bits (0 and -0)
+	// are different values here.
+	inline bool operator==(const Value& other) const { return m_bits == other.m_bits; }
+	// Equality of the language: numbers and integers compare by value, the
+	// other values by identity.
+	inline bool Equals(const Value& other) const {
+
+		if (IsNumeric() && other.IsNumeric())
+			return ToNumber() == other.ToNumber();
+		return m_bits == other.m_bits;
+	}
+
+public:
+	// Nil.
+	constexpr Value() = default;
+	// Numbers convert implicitly since they are the common case. A colliding
+	// NaN is canonicalized, keeping its sign.
+	inline Value(double number)
+		: m_bits(std::bit_cast<std::uint64_t>(number)) {
+
+		if ((m_bits & CollidingNaN) == CollidingNaN)
+			m_bits = CanonicalNaN | (m_bits & SignBit);
+	}
+
+private:
+	std::uint64_t m_bits = NilBits;
+};
+
+static_assert(sizeof(Value) == 8, "Value must stay NaN-boxed");
@@ -1,11 +1,168 @@
 #include <iostream>
+#include <algorithm>
+#include <fstream>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <string_view>
 #include "analysis/lexer.hpp"
+#include "analysis/source.hpp"
+#include "analysis/reader.hpp"
 #include "vm/chunk.hpp"
+#include "vm/compiler.hpp"
+#include "vm/compile_cache.hpp"
+#include "vm/image.hpp"
 #include "vm/memory.hpp"
 #include "vm/virtual_machine.hpp"
+#include "vm/driver.hpp"
+#include "vm/trace.hpp"
+
+#include <csignal>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
 
 std::string source = "func main () { let mut m : i32 = 3 if (1 != 0) return 0; }";
 
+static VM::RingTrace* s_ring = nullptr;
+static const char* s_ring_path = nullptr;
+
+#ifndef _WIN32
+static void DumpRingOnSignal(int) {
+
+	s_ring->Dump(s_ring_path);
+}
+#endif
+
+// Records the run into a ring buffer that is dumped to path when the
+// program fails, or at any time on SIGUSR1. top also records the value on
+// top of the stack before each instruction.
+static void EnableRingTrace(VM::RVM& rvm, VM::RingTrace& ring, const char* path, bool top) {
+
+	s_ring = &ring;
+	s_ring_path = path;
+	ring.SetCaptureTop(top);
+	rvm.SetTraceRing(&ring);
+
+#ifndef _WIN32
+	std::signal(SIGUSR1, DumpRingOnSignal);
+#endif
+}
+
+static int Finish(VM::InterpreteResult result) {
+
+	if (result == VM::InterpreteResult::RUNTIME_ERROR && s_ring) {
+		if (s_ring->Dump(s_ring_path))
+			std::cerr << "trace: " << s_ring->Count() << " instructions, last "
+				<< std::min<std::uint64_t>(s_ring->Count(), s_ring->Capacity()) << " written to " << s_ring_path << "\n";
+		else
+			std::cerr << "Error: Cannot write trace to '" << s_ring_path << "'\n";
+	}
+
+	return result == VM::InterpreteResult::OK ? 0 : 1;
+}
+
+static void PrintPeakRSS() {
+
+#ifndef _WIN32
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+		std::cerr << "peak rss: " << usage.ru_maxrss << " KiB\n";
+#endif
+}
+
+static int Build(const std::vector<std::string>& paths, std::size_t jobs, bool stats, VM::Optimization level) {
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<VM::Driver::Unit> units = VM::Driver::CompileAll(paths, jobs, level);
+	auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+
+	std::size_t compiled = 0, instructions = 0;
+	for (const VM::Driver::Unit& unit : units) {
+		for (const std::string& message : unit.diagnostics.Messages())
+			std::cerr << unit.path << ": " << message << "\n";
+		compiled += unit.ok;
+		instructions += unit.chunk.InstructionCount();
+	}
+
+	std::cerr << "compiled " << compiled << "/" << units.size() << " files";
+	if (stats)
+		std::cerr << " in " << elapsed.count() << " ms at -O" << int(level) << ", " << instructions << " instructions";
+	std::cerr << "\n";
+
+	return compiled == units.size() ? 0 : 1;
+}
+
+// Compiles path at level into a bytecode image at output, by default path
+// with its extension replaced by .rbc.
+static int CompileImage(const std::string& path, std::string output, VM::Optimization level, bool stats) {
+
+	if (output.empty()) {
+		std::size_t dot = path.find_last_of('.');
+		std::size_t slash = path.find_last_of("/\\");
+		output = (dot != std::string::npos && (slash == std::string::npos || dot > slash) ? path.substr(0, dot) : path) + ".rbc";
+	}
+
+	try {
+		Analysis::Source input = Analysis::Source::Open(path);
+		VM::Chunk chunk;
+		VM::Compiler compiler(chunk, input.Text(), nullptr, level);
+		compiler.Compile();
+		VM::Image::Write(chunk, output);
+
+		if (stats)
+			std::cerr << "image: " << output << ", " << chunk.InstructionCount() << " instructions, "
+				<< chunk.ConstantCount() << " constants at -O" << int(level) << "\n";
+		return 0;
+	}
+	catch (const std::runtime_error& e) {
+		std::cerr << "Error: " << e.what() << "\n";
+		return 1;
+	}
+	catch (const std::exception&) {
+		// The compiler reported it.
+		return 1;
+	}
+}
+
+// The code is straight-line, so a run that completes executes every
+// instruction once.
+static void PrintCode(const VM::RVM& rvm, const VM::Chunk& chunk) {
+
+	std::cerr << "code: " << chunk.InstructionCount() << " instructions at -O" << int(rvm.GetOptimization()) << "\n";
+}
+
+template<typename Code>
+static void PrintQuickening(const Code& code) {
+
+	std::cerr << "quickening: " << code.Quickened() << " quickened, "
+		<< code.Deoptimized() << " deoptimized\n";
+}
+
+static void PrintJit(const VM::RVM& rvm) {
+
+	std::cerr << "jit: " << rvm.JitCompiled() << " compiled, " << rvm.JitRuns() << " runs, "
+		<< rvm.JitExits() << " side exits, "
+		<< std::chrono::duration<double, std::micro>(rvm.JitTime()).count() << " us in machine code\n";
+}
+
+static void PrintCache(const VM::CompileCache& cache) {
+
+	std::cerr << "compile cache: " << cache.Hits() << " hits, " << cache.DiskHits() << " loaded from "
+		<< cache.Directory() << ", " << cache.Misses() << " misses, " << cache.Evictions() << " evictions\n";
+}
+
+static void PrintStats(const Analysis::Source& input) {
+
+	std::cerr << "source: " << input.Text().size() << " bytes ("
+		<< (input.GetKind() == Analysis::Source::Kind::Mapped ? "mapped" : "buffered") << ")\n";
+	PrintPeakRSS();
+}
+
 int main(int argc, char** argv) {
 	
 	/*
@@ -14,7 +171,7 @@ int main(int argc, char** argv) {
 	for (int i = 0; i < 24; i++) {
 
 		auto t = lexer.PeekNextToken();
-		std::cout << t->Text << " " << Analysis::Token::ToString(t->KindType) << "\n";
+		std::cout << lexer.Lexeme(t) << " " << Analysis::Token::ToString(t.KindType) << "\n";
 	
 	}
 	*/
@@ -34,8 +191,162 @@ int main(int argc, char** argv) {
 	vm.Run();
 	*/
 	
+	bool stats = false;
+	bool stream = false;
+	bool build = false;
+	bool compile = false;
+	bool image = false;
+	std::string output;
+	const char* cache_dir = nullptr;
+	bool trace = false;
+	const char* ring_path = nullptr;
+	bool ring_top = false;
+	VM::Engine engine = VM::Engine::Stack;
+	bool profile_opcodes = false;
+	std::size_t jobs = 0;
+	VM::Optimization level = VM::Optimization::O1;
+	std::vector<std::string> paths;
+
+	for (int i = 1; i < argc; i++) {
+		std::string_view arg = argv[i];
+		if (arg == "--stats")
+			stats = true;
+		else if (arg == "--stream")
+			stream = true;
+		else if (arg == "--build")
+			build = true;
+		else if (arg == "--compile")
+			compile = true;
+		else if (arg == "--run")
+			image = true;
+		else if (arg.substr(0, 9) == "--output=" && arg.size() > 9)
+			output = argv[i] + 9;
+		else if (arg.substr(0, 12) == "--cache-dir=" && arg.size() > 12)
+			cache_dir = argv[i] + 12;
+		else if (arg == "--trace")
+			trace = true;
+		else if (arg.substr(0, 13) == "--trace-ring=" && arg.size() > 13)
+			ring_path = argv[i] + 13;
+		else if (arg == "--trace-top")
+			ring_top = true;
+		else if (arg == "--profile-opcodes")
+			profile_opcodes = true;
+		else if (arg == "--engine=register")
+			engine = VM::Engine::Register;
+		else if (arg == "--engine=stack")
+			engine = VM::Engine::Stack;
+		else if (arg == "-O0" || arg == "-O1" || arg == "-O2")
+			level = VM::Optimization(arg[2] - '0');
+		else if (arg.substr(0, 2) == "-j" && arg.size() > 2)
+			jobs = std::strtoul(argv[i] + 2, nullptr, 10);
+		else
+			paths.push_back(argv[i]);
+	}
+
+	if (build)
+		return Build(paths, jobs, stats, level);
+
+	const char* path = paths.empty() ? nullptr : paths.back().c_str();
+
+	if (compile) {
+		if (path == nullptr) {
+			std::cerr << "Error: --compile needs a source file\n";
+			return 1;
+		}
+		return CompileImage(path, output, level, stats);
+	}
+
 	VM::RVM rvm;
-	rvm.Run("2 + (6 * 2) ");
-	
-    return 0;
+	VM::RingTrace ring;
+	VM::OpcodeProfile profile;
+	rvm.SetEngine(engine);
+	rvm.SetOptimization(level);
+	if (profile_opcodes)
+		rvm.SetProfile(&profile);
+	if (trace)
+		rvm.SetTrace(&std::cout);
+	if (ring_path)
+		EnableRingTrace(rvm, ring, ring_path, ring_top);
+
+	// Keeps compiled sources in cache_dir, so running an unchanged script
+	// again skips the compiler.
+	std::unique_ptr<VM::CompileCache> cache;
+	if (cache_dir) {
+		cache = std::make_unique<VM::CompileCache>(VM::CompileCache::DefaultCapacity, cache_dir);
+		rvm.SetCompileCache(cache.get());
+	}
+
+	if (path == nullptr) {
+		rvm.Run("2 + (6 * 2) ");
+		return 0;
+	}
+
+	if (stream) {
+		std::ifstream file;
+		if (std::string_view(path) != "-") {
+			file.open(path, std::ios::binary);
+			if (!file) {
+				std::cerr << "Error: Cannot open '" << path << "'\n";
+				return 1;
+			}
+		}
+
+		Analysis::StreamReader reader(file.is_open() ? static_cast<std::istream&>(file) : std::cin);
+		VM::InterpreteResult result = rvm.Run(reader);
+
+		if (stats) {
+			PrintPeakRSS();
+			PrintCode(rvm, rvm.CurrentChunk());
+			PrintQuickening(rvm.CurrentChunk());
+			PrintJit(rvm);
+		}
+		if (profile_opcodes)
+			profile.Report(std::cerr);
+
+		return Finish(result);
+	}
+
+	if (image) {
+		try {
+			VM::Image loaded = VM::Image::Open(path);
+			VM::InterpreteResult result = rvm.Run(loaded);
+
+			if (stats) {
+				std::cerr << "image: " << loaded.Size() << " bytes of code, " << loaded.ConstantCount() << " constants ("
+					<< (loaded.IsMapped() ? "mapped" : "buffered") << ")\n";
+				PrintPeakRSS();
+				PrintQuickening(loaded);
+			}
+			if (profile_opcodes)
+				profile.Report(std::cerr);
+
+			return Finish(result);
+		}
+		catch (const std::runtime_error& e) {
+			std::cerr << "Error: " << e.what() << "\n";
+			return 1;
+		}
+	}
+
+	try {
+		Analysis::Source input = Analysis::Source::Open(path);
+		VM::InterpreteResult result = rvm.Run(input.Text());
+		
+		if (stats) {
+			PrintStats(input);
+			PrintCode(rvm, rvm.CurrentChunk());
+			PrintQuickening(rvm.CurrentChunk());
+			PrintJit(rvm);
+			if (cache)
+				PrintCache(*cache);
+		}
+		if (profile_opcodes)
+			profile.Report(std::cerr);
+
+		return Finish(result);
+	}
+	catch (const std::runtime_error& e) {
+		std::cerr << "Error: " << e.what() << "\n";
+		return 1;
+	}
 }
@@ -2,79 +2,358 @@
 #include <cstdio>
 #include <bitset>
 #include <cmath>
+#include <cstring>
 #include "vm/chunk.hpp"
 #include "vm/memory.hpp"
 #include "vm/virtual_machine.hpp"
 
 namespace VM {
 
+	Chunk::Chunk(Ref<Memory> constants) : m_memory(std::move(constants)) { }
+
 	void Chunk::Disassemble(std::string_view name) {
-		std::cout << name << "\n";
+		std::string out(name);
+		out += '\n';
 		for (std::size_t offset = 0; offset < m_bytes.size();) {
-			offset = Disassemble(offset);
+			offset = Disassemble(offset, out);
 		}
+		std::fwrite(out.data(), 1, out.size(), stdout);
 	}
 
 	std::size_t Chunk::Disassemble(std::size_t offset) {
 
-		std::printf("%04zu ", offset);
+		std::string out;
+		offset = Disassemble(offset, out);
+		std::fwrite(out.data(), 1, out.size(), stdout);
+		return offset;
+	}
+
+	std::size_t Chunk::Disassemble(std::size_t offset, std::string& out) const {
+
+		char buffer[16];
+		std::snprintf(buffer, sizeof(buffer), "%04zu ", offset);
+		out += buffer;
 
 		if (offset > 0 && m_lines[offset] == m_lines[offset - 1])
-			std::cout << "   | ";
-		else 
-			std::printf("%4d ", m_lines[offset]);
+			out += "   | ";
+		else {
+			std::snprintf(buffer, sizeof(buffer), "%4u ", m_lines[offset]);
+			out += buffer;
+		}
 
 		Byte instruction = m_bytes[offset];
 
 		switch (instruction) {
 
 		case OpCode::End :
-			return SimpleInstruction("Return", offset);
+			return SimpleInstruction("Return", offset, out);
 		case OpCode::Constant:
-			return ConstantInstruction("Constant", offset);
+			return ConstantInstruction("Constant", offset, out);
 		case OpCode::Constant_Long:
-			return ConstantInstructionLong("Constant Long", offset);
+			return ConstantInstructionLong("Constant Long", offset, out);
 		case OpCode::Negate:
-			return SimpleInstruction("Negate", offset);
+			return SimpleInstruction("Negate", offset, out);
 		case OpCode::Add:
-			return  SimpleInstruction("Add", offset);
+			return  SimpleInstruction("Add", offset, out);
 		case OpCode::Substract:
-			return  SimpleInstruction("Substract", offset);
+			return  SimpleInstruction("Substract", offset, out);
 		case OpCode::Multiply:
-			return  SimpleInstruction("Multiply", offset);
+			return  SimpleInstruction("Multiply", offset, out);
 		case OpCode::Divide:
-			return  SimpleInstruction("Divide", offset);
+			return  SimpleInstruction("Divide", offset, out);
+		case OpCode::Pop:
+			return  SimpleInstruction("Pop", offset, out);
+		case OpCode::Add_Constant:
+			return ConstantInstruction("Add Constant", offset, out);
+		case OpCode::Substract_Constant:
+			return ConstantInstruction("Substract Constant", offset, out);
+		case OpCode::Multiply_Constant:
+			return ConstantInstruction("Multiply Constant", offset, out);
+		case OpCode::Divide_Constant:
+			return ConstantInstruction("Divide Constant", offset, out);
+		case OpCode::Constant_Negated:
+			return ConstantInstruction("Constant Negated", offset, out);
+		case OpCode::Integer_Negate:
+			return SimpleInstruction("Integer Negate", offset, out);
+		case OpCode::Integer_Add:
+			return SimpleInstruction("Integer Add", offset, out);
+		case OpCode::Integer_Substract:
+			return SimpleInstruction("Integer Substract", offset, out);
+		case OpCode::Integer_Multiply:
+			return SimpleInstruction("Integer Multiply", offset, out);
+		case OpCode::Integer_Divide:
+			return SimpleInstruction("Integer Divide", offset, out);
+		case OpCode::Equal:
+			return SimpleInstruction("Equal", offset, out);
+		case OpCode::Not_Equal:
+			return SimpleInstruction("Not Equal", offset, out);
+		case OpCode::Less:
+			return SimpleInstruction("Less", offset, out);
+		case OpCode::Less_Equal:
+			return SimpleInstruction("Less Equal", offset, out);
+		case OpCode::Greater:
+			return SimpleInstruction("Greater", offset, out);
+		case OpCode::Greater_Equal:
+			return SimpleInstruction("Greater Equal", offset, out);
+		case OpCode::Integer_Equal:
+			return SimpleInstruction("Integer Equal", offset, out);
+		case OpCode::Integer_Not_Equal:
+			return SimpleInstruction("Integer Not Equal", offset, out);
+		case OpCode::Integer_Less:
+			return SimpleInstruction("Integer Less", offset, out);
+		case OpCode::Integer_Less_Equal:
+			return SimpleInstruction("Integer Less Equal", offset, out);
+		case OpCode::Integer_Greater:
+			return SimpleInstruction("Integer Greater", offset, out);
+		case OpCode::Integer_Greater_Equal:
+			return SimpleInstruction("Integer Greater Equal", offset, out);
+		case OpCode::Number_Negate:
+			return SimpleInstruction("Number Negate", offset, out);
+		case OpCode::Number_Add:
+			return SimpleInstruction("Number Add", offset, out);
+		case OpCode::Number_Substract:
+			return SimpleInstruction("Number Substract", offset, out);
+		case OpCode::Number_Multiply:
+			return SimpleInstruction("Number Multiply", offset, out);
+		case OpCode::Number_Divide:
+			return SimpleInstruction("Number Divide", offset, out);
+		case OpCode::Number_Equal:
+			return SimpleInstruction("Number Equal", offset, out);
+		case OpCode::Number_Not_Equal:
+			return SimpleInstruction("Number Not Equal", offset, out);
+		case OpCode::Number_Less:
+			return SimpleInstruction("Number Less", offset, out);
+		case OpCode::Number_Less_Equal:
+			return SimpleInstruction("Number Less Equal", offset, out);
+		case OpCode::Number_Greater:
+			return SimpleInstruction("Number Greater", offset, out);
+		case OpCode::Number_Greater_Equal:
+			return SimpleInstruction("Number Greater Equal", offset, out);
+		case OpCode::Negate_Integer:
+			return SimpleInstruction("Negate Integer", offset, out);
+		case OpCode::Add_Integers:
+			return SimpleInstruction("Add Integers", offset, out);
+		case OpCode::Substract_Integers:
+			return SimpleInstruction("Substract Integers", offset, out);
+		case OpCode::Multiply_Integers:
+			return SimpleInstruction("Multiply Integers", offset, out);
+		case OpCode::Divide_Integers:
+			return SimpleInstruction("Divide Integers", offset, out);
+		case OpCode::Equal_Integers:
+			return SimpleInstruction("Equal Integers", offset, out);
+		case OpCode::Not_Equal_Integers:
+			return SimpleInstruction("Not Equal Integers", offset, out);
+		case OpCode::Less_Integers:
+			return SimpleInstruction("Less Integers", offset, out);
+		case OpCode::Less_Equal_Integers:
+			return SimpleInstruction("Less Equal Integers", offset, out);
+		case OpCode::Greater_Integers:
+			return SimpleInstruction("Greater Integers", offset, out);
+		case OpCode::Greater_Equal_Integers:
+			return SimpleInstruction("Greater Equal Integers", offset, out);
+		case OpCode::Register_Load:
+			return RegisterInstruction("Load", offset, out);
+		case OpCode::Register_Negate:
+			return RegisterInstruction("Negate", offset, out);
+		case OpCode::Register_Add:
+			return RegisterInstruction("Add", offset, out);
+		case OpCode::Register_Substract:
+			return RegisterInstruction("Substract", offset, out);
+		case OpCode::Register_Multiply:
+			return RegisterInstruction("Multiply", offset, out);
+		case OpCode::Register_Divide:
+			return RegisterInstruction("Divide", offset, out);
+		case OpCode::Register_Integer_Negate:
+			return RegisterInstruction("Integer Negate", offset, out);
+		case OpCode::Register_Integer_Add:
+			return RegisterInstruction("Integer Add", offset, out);
+		case OpCode::Register_Integer_Substract:
+			return RegisterInstruction("Integer Substract", offset, out);
+		case OpCode::Register_Integer_Multiply:
+			return RegisterInstruction("Integer Multiply", offset, out);
+		case OpCode::Register_Integer_Divide:
+			return RegisterInstruction("Integer Divide", offset, out);
+		case OpCode::Register_Equal:
+			return RegisterInstruction("Equal", offset, out);
+		case OpCode::Register_Not_Equal:
+			return RegisterInstruction("Not Equal", offset, out);
+		case OpCode::Register_Less:
+			return RegisterInstruction("Less", offset, out);
+		case OpCode::Register_Less_Equal:
+			return RegisterInstruction("Less Equal", offset, out);
+		case OpCode::Register_Greater:
+			return RegisterInstruction("Greater", offset, out);
+		case OpCode::Register_Greater_Equal:
+			return RegisterInstruction("Greater Equal", offset, out);
 		default:
-			std::cout << "Unknown opcode" << instruction << "\n";
+			out += "Unknown opcode ";
+			out += std::to_string(instruction);
+			out += '\n';
 			return offset + 1;
 		}
 	}
 
-	std::size_t Chunk::SimpleInstruction(std::string_view name, std::size_t offset) {
-		std::cout << name << "\n";
+	std::size_t Chunk::SimpleInstruction(std::string_view name, std::size_t offset, std::string& out) const {
+		out += name;
+		out += '\n';
 		return offset + 1;
 	}
 
-	std::size_t Chunk::ConstantInstruction(std::string_view name, std::size_t offset) {
+	std::size_t Chunk::ConstantInstruction(std::string_view name, std::size_t offset, std::string& out) const {
 
 		Byte constant = m_bytes[offset + 1];
-		std::printf("%-16s %4d '", name.data(), constant);
-		Memory::PrintValue(m_memory.GetHandle()[constant]);
-		std::printf("'\n");
+		char buffer[64];
+		std::snprintf(buffer, sizeof(buffer), "%-16s %4d '", name.data(), constant);
+		out += buffer;
+		out += Memory::ToString(m_memory->GetHandle()[constant]);
+		out += "'\n";
 		return offset + 2;
 	}
 
-	std::size_t Chunk::ConstantInstructionLong(std::string_view name, std::size_t offset) {
+	std::size_t Chunk::ConstantInstructionLong(std::string_view name, std::size_t offset, std::string& out) const {
 
-		Byte bytes[] = { m_bytes[offset + 1],  m_bytes[offset + 2] };
-		std::size_t addr;
-		std::memcpy(&addr, bytes, sizeof(std::size_t));
-		std::printf("%-16s %4zu '", name.data(), addr);
-		Memory::PrintValue(m_memory.GetHandle()[addr]);
-		std::printf("'\n");
+		std::size_t addr = (std::size_t(m_bytes[offset + 1]) << 8) | m_bytes[offset + 2];
+		char buffer[64];
+		std::snprintf(buffer, sizeof(buffer), "%-16s %4zu '", name.data(), addr);
+		out += buffer;
+		out += Memory::ToString(m_memory->GetHandle()[addr]);
+		out += "'\n";
 		return offset + 3;
 	}
 
+	// Register_Load takes a register and a 16-bit constant index; the other
+	// register instructions a destination and one or two operands.
+	std::size_t Chunk::RegisterInstruction(std::string_view name, std::size_t offset, std::string& out) const {
+
+		Byte opcode = m_bytes[offset];
+		std::size_t size = InstructionSize(opcode);
+		char buffer[64];
+		std::snprintf(buffer, sizeof(buffer), "%-16s r%u", name.data(), m_bytes[offset + 1]);
+		out += buffer;
+
+		if (opcode == OpCode::Register_Load) {
+			std::size_t addr = (std::size_t(m_bytes[offset + 2]) << 8) | m_bytes[offset + 3];
+			std::snprintf(buffer, sizeof(buffer), " k%zu '", addr);
+			out += buffer;
+			out += Memory::ToString(m_memory->GetHandle()[addr]);
+			out += '\'';
+		}
+		else {
+			for (std::size_t i = 2; i < size; i++)
+				RegisterOperand(m_bytes[offset + i], out);
+		}
+
+		out += '\n';
+		return offset + size;
+	}
+
+	void Chunk::RegisterOperand(Byte operand, std::string& out) const {
+
+		char buffer[16];
+		if (operand & RegisterConstantBit) {
+			std::size_t addr = operand & ~RegisterConstantBit;
+			std::snprintf(buffer, sizeof(buffer), " k%zu '", addr);
+			out += buffer;
+			out += Memory::ToString(m_memory->GetHandle()[addr]);
+			out += '\'';
+		}
+		else {
+			std::snprintf(buffer, sizeof(buffer), " r%u", operand);
+			out += buffer;
+		}
+	}
+
+	std::size_t Chunk::InstructionSize(Byte opcode) {
+
+		switch (opcode) {
+		case OpCode::Constant:
+		case OpCode::Add_Constant:
+		case OpCode::Substract_Constant:
+		case OpCode::Multiply_Constant:
+		case OpCode::Divide_Constant:
+		case OpCode::Constant_Negated:
+			return 2;
+		case OpCode::Constant_Long:
+		case OpCode::Register_Negate:
+		case OpCode::Register_Integer_Negate:
+			return 3;
+		case OpCode::Register_Load:
+		case OpCode::Register_Add:
+		case OpCode::Register_Substract:
+		case OpCode::Register_Multiply:
+		case OpCode::Register_Divide:
+		case OpCode::Register_Integer_Add:
+		case OpCode::Register_Integer_Substract:
+		case OpCode::Register_Integer_Multiply:
+		case OpCode::Register_Integer_Divide:
+		case OpCode::Register_Equal:
+		case OpCode::Register_Not_Equal:
+		case OpCode::Register_Less:
+		case OpCode::Register_Less_Equal:
+		case OpCode::Register_Greater:
+		case OpCode::Register_Greater_Equal:
+			return 4;
+		default:
+			return 1;
+		}
+	}
+
+	Byte Chunk::Unfused(Byte opcode) {
+
+		switch (opcode) {
+		case OpCode::Add_Constant:
+			return OpCode::Add;
+		case OpCode::Substract_Constant:
+			return OpCode::Substract;
+		case OpCode::Multiply_Constant:
+			return OpCode::Multiply;
+		case OpCode::Divide_Constant:
+			return OpCode::Divide;
+		case OpCode::Constant_Negated:
+			return OpCode::Negate;
+		default:
+			return opcode;
+		}
+	}
+
+	Byte Chunk::Unquickened(Byte opcode) {
+
+		switch (opcode) {
+		case OpCode::Negate_Integer:
+			return OpCode::Negate;
+		case OpCode::Add_Integers:
+			return OpCode::Add;
+		case OpCode::Substract_Integers:
+			return OpCode::Substract;
+		case OpCode::Multiply_Integers:
+			return OpCode::Multiply;
+		case OpCode::Divide_Integers:
+			return OpCode::Divide;
+		case OpCode::Equal_Integers:
+			return OpCode::Equal;
+		case OpCode::Not_Equal_Integers:
+			return OpCode::Not_Equal;
+		case OpCode::Less_Integers:
+			return OpCode::Less;
+		case OpCode::Less_Equal_Integers:
+			return OpCode::Less_Equal;
+		case OpCode::Greater_Integers:
+			return OpCode::Greater;
+		case OpCode::Greater_Equal_Integers:
+			return OpCode::Greater_Equal;
+		default:
+			return opcode;
+		}
+	}
+
+	std::size_t Chunk::InstructionCount() const {
+
+		std::size_t count = 0;
+		for (std::size_t offset = 0; offset < m_bytes.size(); offset += InstructionSize(m_bytes[offset]))
+			count++;
+		return count;
+	}
+
 	void Chunk::Write8(const Byte& byte) {
 		m_bytes.push_back(byte);
 		m_lines.push_back(m_current_line);
@@ -101,9 +380,87 @@ namespace VM {
 		Write16(OpCode::Constant, AddConstant(value));
 	}
 
+	void Chunk::Append(const Chunk& other, std::int64_t line_offset) {
+
+		// Same constant table: the operands stay valid and the code is copied.
+		if (other.m_memory == m_memory) {
+			m_bytes.insert(m_bytes.end(), other.m_bytes.begin(), other.m_bytes.end());
+			for (std::uint32_t line : other.m_lines)
+				m_lines.push_back(static_cast<std::uint32_t>(line + line_offset));
+			if (!m_lines.empty())
+				SetLine(m_lines.back());
+			return;
+		}
+
+		for (std::size_t offset = 0; offset < other.m_bytes.size();) {
+
+			SetLine(static_cast<std::size_t>(other.m_lines[offset] + line_offset));
+			Byte instruction = other.m_bytes[offset];
+
+			switch (instruction) {
+
+			case OpCode::Constant: {
+				WriteConstantAuto(other.m_memory->GetHandle()[other.m_bytes[offset + 1]]);
+				offset += 2;
+				break;
+			}
+
+			case OpCode::Constant_Long: {
+				std::size_t addr = (std::size_t(other.m_bytes[offset + 1]) << 8) | other.m_bytes[offset + 2];
+				WriteConstantAuto(other.m_memory->GetHandle()[addr]);
+				offset += 3;
+				break;
+			}
+
+			// The re-interned index may not fit a superinstruction's operand,
+			// so they are split back into a constant and the plain opcode.
+			case OpCode::Add_Constant:
+			case OpCode::Substract_Constant:
+			case OpCode::Multiply_Constant:
+			case OpCode::Divide_Constant:
+			case OpCode::Constant_Negated: {
+				WriteConstantAuto(other.m_memory->GetHandle()[other.m_bytes[offset + 1]]);
+				Write8(Unfused(instruction));
+				offset += 2;
+				break;
+			}
+
+			default:
+				Write8(Unquickened(instruction));
+				offset += 1;
+				break;
+			}
+		}
+	}
+
+	void Chunk::WriteConstantAuto(const Value& value) {
+
+		std::size_t addr = AddConstant(value);
+
+		if (addr <= UINT8_MAX) {
+			Write16(OpCode::Constant, static_cast<Byte>(addr));
+			return;
+		}
+
+		Write8(OpCode::Constant_Long);
+		Write16((addr >> 8) & 0xFF, addr & 0xFF);
+	}
+
+	void Chunk::Truncate(std::size_t size, std::size_t constants) {
+
+		m_bytes.resize(size);
+		m_lines.resize(size);
+		m_memory->Truncate(constants);
+	}
+
+	void Chunk::Erase(std::size_t begin, std::size_t end) {
+
+		m_bytes.erase(m_bytes.begin() + begin, m_bytes.begin() + end);
+		m_lines.erase(m_lines.begin() + begin, m_lines.begin() + end);
+	}
+
 	std::size_t Chunk::AddConstant(const Value& value) {
-		m_memory.Write(value);
-		return m_memory.Size() - 1;
+		return m_memory->Intern(value);
 	}
 
 
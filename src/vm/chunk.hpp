@@ -15,29 +15,74 @@ class Chunk {
 public:
 	std::size_t AddConstant(const Value& value);
 	std::size_t Disassemble(std::size_t offset);
+	// Appends the listing of the instruction at offset to out and returns
+	// the offset of the next one.
+	std::size_t Disassemble(std::size_t offset, std::string& out) const;
 	void Disassemble(std::string_view name);
 	void Write8(const Byte& byte);
 	void Write16(const Byte& byte1, const Byte& byte2);
 	void WriteConstantLong(const Value& value);
 	void WriteConstant(const Value& value);
+	// Picks the short or long constant form depending on the pool index.
+	void WriteConstantAuto(const Value& value);
+	// Appends another chunk's code, re-interning its constants into this
+	// chunk unless both share a table, and shifting its line numbers by
+	// line_offset.
+	void Append(const Chunk& other, std::int64_t line_offset = 0);
+	inline std::size_t Size() const { return m_bytes.size(); }
+	inline Byte At(std::size_t offset) const { return m_bytes[offset]; }
+	inline std::uint32_t Line(std::size_t offset) const { return m_lines[offset]; }
+	// Number of instructions in the code, whichever engine it is for.
+	std::size_t InstructionCount() const;
+	// Length in bytes of an instruction, operands included.
+	static std::size_t InstructionSize(Byte opcode);
+	// The opcode a superinstruction applies after its constant, or opcode
+	// itself for a plain instruction.
+	static Byte Unfused(Byte opcode);
+	// The generic opcode a quickened one was rewritten from, or opcode
+	// itself.
+	static Byte Unquickened(Byte opcode);
+	// Generic instructions the stack engine quickened in place, and
+	// quickened ones it reverted after their guard failed, over all runs.
+	inline std::uint64_t Quickened() const { return m_quickened; }
+	inline std::uint64_t Deoptimized() const { return m_deoptimized; }
+	// Times RVM ran the chunk, on any engine.
+	inline std::uint64_t Executions() const { return m_executions; }
+	inline std::size_t ConstantCount() const { return m_memory->Size(); }
+	inline const Ref<Memory>& Constants() const { return m_memory; }
+	// Drops the code from size on and the constants from constants on. Only
+	// valid when nothing before size refers to the dropped constants.
+	void Truncate(std::size_t size, std::size_t constants);
+	// Removes the code in [begin, end), keeping the constant pool.
+	void Erase(std::size_t begin, std::size_t end);
 	inline void SetLine(std::size_t line) { m_current_line = line; }
 
 public:
 	Chunk() = default;
+	// Compiles against an existing constant table, e.g. one shared by the
+	// chunks of several files. Copies of a chunk share its table as well.
+	explicit Chunk(Ref<Memory> constants);
 	Chunk(const Chunk&) = default;
 	Chunk(Chunk&&) = default;
+	Chunk& operator=(const Chunk&) = default;
+	Chunk& operator=(Chunk&&) = default;
 	~Chunk() = default;
 
 private:
-	std::size_t SimpleInstruction(std::string_view name, std::size_t offset);
-	std::size_t ConstantInstruction(std::string_view name, std::size_t offset);
-	std::size_t ConstantInstructionLong(std::string_view name, std::size_t offset);
+	std::size_t SimpleInstruction(std::string_view name, std::size_t offset, std::string& out) const;
+	std::size_t ConstantInstruction(std::string_view name, std::size_t offset, std::string& out) const;
+	std::size_t ConstantInstructionLong(std::string_view name, std::size_t offset, std::string& out) const;
+	std::size_t RegisterInstruction(std::string_view name, std::size_t offset, std::string& out) const;
+	void RegisterOperand(Byte operand, std::string& out) const;
 
 private:
-	Memory m_memory;
+	Ref<Memory> m_memory = std::make_shared<Memory>();
 	std::size_t m_current_line = 0;
 	std::vector<std::uint32_t> m_lines;
 	std::vector<Byte> m_bytes;
+	std::uint64_t m_quickened = 0;
+	std::uint64_t m_deoptimized = 0;
+	std::uint64_t m_executions = 0;
 	
 	friend class RVM;
 };
@@ -0,0 +1,236 @@
+#include "vm/compile_cache.hpp"
+#include "vm/compiler.hpp"
+#include "vm/image.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <stdexcept>
+#include <system_error>
+
+namespace VM {
+
+	namespace {
+
+		constexpr std::uint64_t K0 = 0x9e3779b97f4a7c15;
+		constexpr std::uint64_t K1 = 0xbf58476d1ce4e5b9;
+		constexpr std::uint64_t K2 = 0x94d049bb133111eb;
+
+		// The splitmix64 finalizer: every input bit flips each output bit
+		// with probability close to one half.
+		std::uint64_t Mix(std::uint64_t x) {
+
+			x ^= x >> 30;
+			x *= K1;
+			x ^= x >> 27;
+			x *= K2;
+			return x ^ (x >> 31);
+		}
+
+		std::uint64_t Rotate(std::uint64_t x, int bits) {
+
+			return (x << bits) | (x >> (64 - bits));
+		}
+
+	}
+
+	CompileCache::CompileCache(std::size_t capacity, std::string directory)
+		: m_capacity(capacity), m_directory(std::move(directory)) {
+
+		if (!m_directory.empty()) {
+			std::error_code error;
+			std::filesystem::create_directories(m_directory, error);
+		}
+	}
+
+	std::uint64_t CompileCache::Hash(std::string_view text, std::uint64_t seed) {
+
+		const char* data = text.data();
+		std::size_t size = text.size();
+		std::uint64_t hash = seed ^ (size * K0);
+
+		for (; size >= 8; data += 8, size -= 8) {
+			std::uint64_t word;
+			std::memcpy(&word, data, 8);
+			hash = Rotate(hash ^ (word * K1), 31) * K0;
+		}
+
+		std::uint64_t tail = 0;
+		std::memcpy(&tail, data, size);
+		hash = Rotate(hash ^ (tail * K1), 31) * K0;
+
+		return Mix(hash ^ text.size());
+	}
+
+	std::shared_ptr<const Chunk> CompileCache::Get(std::string_view source, Optimization level) {
+
+		std::uint64_t key = Hash(source, std::uint64_t(level) + 1);
+
+		auto find = [&]() -> std::shared_ptr<const Chunk> {
+			auto [begin, end] = m_index.equal_range(key);
+			for (auto it = begin; it != end; ++it) {
+				Entry& entry = *it->second;
+				if (entry.level == level && entry.source == source) {
+					m_entries.splice(m_entries.begin(), m_entries, it->second);
+					return entry.chunk;
+				}
+			}
+			return nullptr;
+		};
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (std::shared_ptr<const Chunk> chunk = find()) {
+				m_hits++;
+				return chunk;
+			}
+		}
+
+		// Loaded or compiled outside the lock, so other sources are served
+		// meanwhile.
+		std::string path = m_directory.empty() ? std::string() : PathOf(key, source.size());
+		std::shared_ptr<const Chunk> chunk = path.empty() ? nullptr : Load(path, source, level);
+		bool loaded = chunk != nullptr;
+
+		if (!loaded) {
+			auto compiled = std::make_shared<Chunk>();
+			try {
+				Compiler compiler(*compiled, source, nullptr, level);
+				compiler.Compile();
+			}
+			catch (const std::exception&) {
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_misses++;
+				return nullptr;
+			}
+
+			compiled->Constants()->Seal();
+			if (!path.empty())
+				Store(*compiled, path, source, level);
+			chunk = std::move(compiled);
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (loaded)
+			m_disk_hits++;
+		else
+			m_misses++;
+
+		// Another thread may have added the same source meanwhile.
+		if (std::shared_ptr<const Chunk> existing = find())
+			return existing;
+
+		if (m_capacity > 0)
+			Insert(Entry{ key, level, std::string(source), chunk });
+		return chunk;
+	}
+
+	void CompileCache::Insert(Entry entry) {
+
+		std::uint64_t key = entry.key;
+		m_entries.push_front(std::move(entry));
+		m_index.emplace(key, m_entries.begin());
+
+		while (m_entries.size() > m_capacity) {
+			auto last = std::prev(m_entries.end());
+			auto [begin, end] = m_index.equal_range(last->key);
+			for (auto it = begin; it != end; ++it)
+				if (it->second == last) {
+					m_index.erase(it);
+					break;
+				}
+			m_entries.pop_back();
+			m_evictions++;
+		}
+	}
+
+	std::string CompileCache::PathOf(std::uint64_t key, std::size_t length) const {
+
+		char name[64];
+		std::snprintf(name, sizeof(name), "%016llx-%zu.rbc", static_cast<unsigned long long>(key), length);
+		return (std::filesystem::path(m_directory) / name).string();
+	}
+
+	std::shared_ptr<const Chunk> CompileCache::Load(const std::string& path, std::string_view source, Optimization level) const {
+
+		std::error_code error;
+		if (!std::filesystem::is_regular_file(path, error))
+			return nullptr;
+
+		try {
+			Image image = Image::Open(path);
+
+			// The level byte, then the text, see Store.
+			std::string_view stored = image.Source();
+			if (stored.size() != source.size() + 1 || stored[0] != char(level) || stored.substr(1) != source)
+				return nullptr;
+
+			auto chunk = std::make_shared<Chunk>(image.ToChunk());
+			chunk->Constants()->Seal();
+			return chunk;
+		}
+		catch (const std::runtime_error&) {
+			// Stale or foreign; compiling rewrites it.
+			return nullptr;
+		}
+	}
+
+	// Written under a temporary name and renamed, so concurrent readers,
+	// other processes included, never see a partial image.
+	void CompileCache::Store(const Chunk& chunk, const std::string& path, std::string_view source, Optimization level) const {
+
+		std::string temporary = path + "." + std::to_string(std::random_device{}()) + ".tmp";
+		std::string stored = char(level) + std::string(source);
+		std::error_code error;
+
+		try {
+			Image::Write(chunk, temporary, stored);
+			std::filesystem::rename(temporary, path, error);
+		}
+		catch (const std::runtime_error&) {
+			error = std::make_error_code(std::errc::io_error);
+		}
+
+		if (error)
+			std::filesystem::remove(temporary, error);
+	}
+
+	void CompileCache::Clear() {
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_entries.clear();
+		m_index.clear();
+	}
+
+	std::size_t CompileCache::Size() const {
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_entries.size();
+	}
+
+	std::uint64_t CompileCache::Hits() const {
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_hits;
+	}
+
+	std::uint64_t CompileCache::DiskHits() const {
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_disk_hits;
+	}
+
+	std::uint64_t CompileCache::Misses() const {
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_misses;
+	}
+
+	std::uint64_t CompileCache::Evictions() const {
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_evictions;
+	}
+
+}
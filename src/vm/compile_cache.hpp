@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "vm/chunk.hpp"
+#include "vm/optimizer.hpp"
+
+namespace VM {
+
+// Compiled chunks keyed by a hash of the source text and the optimization
+// level, for programs that run the same script many times. Entries are
+// immutable: their constant tables are sealed, and an RVM copies the code
+// on its first run of an entry and keeps the copy, which it quickens and
+// compiles to machine code, for the next ones. The most recently used
+// Capacity() chunks are kept; a memory hit compares the whole text, so a
+// hash collision costs a compile and never runs the wrong code.
+//
+// With a directory, misses also look for an image there (see Image) before
+// compiling, and compiled chunks are written there, so the cache survives
+// the process. Files are named by the hash and the length of the text and
+// hold the level and the text with the code; a file whose text differs, as
+// a collision on the name would, is treated as a miss and overwritten.
+// Writing is best effort: a directory that cannot be written only leaves
+// the cache in memory.
+//
+// One cache can be shared by RVMs on several threads.
+class CompileCache {
+
+public:
+	// The chunk for source at level, compiled on a miss; nullptr when the
+	// source does not compile, whose errors go to std::cerr and which is not
+	// cached.
+	std::shared_ptr<const Chunk> Get(std::string_view source, Optimization level);
+	void Clear();
+	std::size_t Size() const;
+	inline std::size_t Capacity() const { return m_capacity; }
+	inline const std::string& Directory() const { return m_directory; }
+	// Lookups served from memory, served from the directory and compiled,
+	// and entries dropped to stay within Capacity(). Totals since
+	// construction.
+	std::uint64_t Hits() const;
+	std::uint64_t DiskHits() const;
+	std::uint64_t Misses() const;
+	std::uint64_t Evictions() const;
+
+	// 64-bit hash of text, reading 8 bytes per step; seed separates the
+	// compiler options.
+	static std::uint64_t Hash(std::string_view text, std::uint64_t seed = 0);
+
+public:
+	static constexpr std::size_t DefaultCapacity = 256;
+
+	// capacity == 0 keeps nothing in memory; an empty directory keeps
+	// nothing on disk.
+	explicit CompileCache(std::size_t capacity = DefaultCapacity, std::string directory = {});
+	CompileCache(const CompileCache&) = delete;
+	CompileCache& operator=(const CompileCache&) = delete;
+	~CompileCache() = default;
+
+private:
+	struct Entry {
+		std::uint64_t key;
+		Optimization level;
+		std::string source;
+		std::shared_ptr<const Chunk> chunk;
+	};
+
+	std::string PathOf(std::uint64_t key, std::size_t length) const;
+	std::shared_ptr<const Chunk> Load(const std::string& path, std::string_view source, Optimization level) const;
+	void Store(const Chunk& chunk, const std::string& path, std::string_view source, Optimization level) const;
+	// Adds an entry at the front, evicting from the back. Expects m_mutex.
+	void Insert(Entry entry);
+
+private:
+	std::size_t m_capacity;
+	std::string m_directory;
+	mutable std::mutex m_mutex;
+	// Most recently used first; m_index points into it.
+	std::list<Entry> m_entries;
+	std::unordered_multimap<std::uint64_t, std::list<Entry>::iterator> m_index;
+	std::uint64_t m_hits = 0;
+	std::uint64_t m_disk_hits = 0;
+	std::uint64_t m_misses = 0;
+	std::uint64_t m_evictions = 0;
+};
+
+}
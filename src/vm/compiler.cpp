@@ -1,22 +1,47 @@
 #include "vm/compiler.hpp"
 #include "vm/virtual_machine.hpp"
+#include "vm/peephole.hpp"
+
+#include <exception>
 
 namespace VM {
 
     void Compiler::Compile() {
 
-        parser.Expression();
+        while (!parser.IsAtEnd())
+            parser.Declaration();
+
+        // Parsing goes on past a lexer error to report what follows, but the
+        // program is still rejected, as on a parse error.
+        if (lexer.Errors() > 0)
+            throw std::exception();
+
+		chunk.Write8(OpCode::End);
 
-		parser.Consume(Analysis::Token::Kind::TkEOF, "Wait end expression.");
-		vm.CurrentChunk().Write8(OpCode::End);
+		if (level >= Optimization::O2)
+			Optimizer(chunk).Optimize();
+		if (level >= Optimization::O1)
+			Peephole::Optimize(chunk);
 
     }
 
     Compiler::Compiler(RVM& vm, std::string_view source)
-        : lexer(source), parser(vm.CurrentChunk(), lexer), vm(vm)
+        : Compiler(vm.CurrentChunk(), source, nullptr, vm.GetOptimization())
     {
        
     }
 
+    Compiler::Compiler(RVM& vm, Analysis::Reader& reader)
+        : chunk(vm.CurrentChunk()), lexer(reader), parser(chunk, lexer), level(vm.GetOptimization())
+    {
+        parser.SetFolding(level != Optimization::O0);
+    }
+
+    Compiler::Compiler(Chunk& chunk, std::string_view source, Analysis::Diagnostics* diagnostics, Optimization level)
+        : chunk(chunk), lexer(source, diagnostics), parser(chunk, lexer), level(level)
+    {
+        parser.SetFolding(level != Optimization::O0);
+    }
+
    
 }
@@ -4,6 +4,8 @@
 
 #include "analysis/lexer.hpp"
 #include "analysis/parser.hpp"
+#include "analysis/diagnostics.hpp"
+#include "vm/optimizer.hpp"
 
 namespace VM {
    
@@ -16,14 +18,22 @@ public:
 
 public:
     Compiler(RVM& vm, std::string_view source);
-    Compiler(const Compiler&) = default;
-    Compiler(Compiler&&) = default;
+    // Pulls the source from reader while compiling; bytecode is emitted
+    // into the chunk as soon as each expression is parsed.
+    Compiler(RVM& vm, Analysis::Reader& reader);
+    // Compiles into a standalone chunk. Errors go to diagnostics when given,
+    // otherwise to std::cerr. The RVM constructors use the RVM's level.
+    Compiler(Chunk& chunk, std::string_view source, Analysis::Diagnostics* diagnostics = nullptr,
+        Optimization level = Optimization::O1);
+    Compiler(const Compiler&) = delete;
+    Compiler(Compiler&&) = delete;
     ~Compiler() = default;
    
 private:
-    RVM& vm;
+    Chunk& chunk;
     Analysis::Lexer lexer;
     Analysis::Parser parser;
+    Optimization level;
 
 };
 
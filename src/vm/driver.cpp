@@ -0,0 +1,61 @@
+#include "vm/driver.hpp"
+#include "vm/compiler.hpp"
+#include "analysis/source.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+
+namespace VM {
+
+	std::vector<Driver::Unit> Driver::CompileAll(const std::vector<std::string>& paths, std::size_t jobs, Optimization level) {
+
+		std::vector<Unit> units(paths.size());
+		for (std::size_t i = 0; i < paths.size(); i++)
+			units[i].path = paths[i];
+
+		if (jobs == 0)
+			jobs = std::max(1u, std::thread::hardware_concurrency());
+		jobs = std::min(jobs, units.size());
+
+		// Workers claim files one at a time so a few large files do not leave
+		// the other threads idle.
+		std::atomic<std::size_t> next{ 0 };
+		auto worker = [&units, &next, level]() {
+			for (std::size_t i = next++; i < units.size(); i = next++)
+				Compile(units[i], level);
+		};
+
+		std::vector<std::thread> workers;
+		for (std::size_t i = 1; i < jobs; i++)
+			workers.emplace_back(worker);
+
+		worker();
+
+		for (std::thread& thread : workers)
+			thread.join();
+
+		return units;
+	}
+
+	bool Driver::Compile(Unit& unit, Optimization level) {
+
+		try {
+			Analysis::Source source = Analysis::Source::Open(unit.path);
+			Compiler compiler(unit.chunk, source.Text(), &unit.diagnostics, level);
+			compiler.Compile();
+			unit.ok = unit.diagnostics.Empty();
+		}
+		catch (const std::runtime_error& e) {
+			unit.diagnostics.Report(std::string("Error: ") + e.what());
+			unit.ok = false;
+		}
+		catch (const std::exception&) {
+			unit.ok = false;
+		}
+
+		return unit.ok;
+	}
+
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "analysis/diagnostics.hpp"
+#include "vm/chunk.hpp"
+#include "vm/optimizer.hpp"
+
+namespace VM {
+
+// Compiles a set of source files on a pool of worker threads, one Chunk per
+// file. Each file gets its own Source, Lexer, Parser and Diagnostics, so
+// workers share nothing but the read-only keyword and rule tables.
+class Driver {
+
+public:
+	struct Unit {
+		std::string path;
+		Chunk chunk;
+		Analysis::Diagnostics diagnostics;
+		bool ok = false;
+	};
+
+public:
+	// Results are in the order of paths whatever the scheduling was. jobs == 0
+	// uses one worker per hardware thread.
+	static std::vector<Unit> CompileAll(const std::vector<std::string>& paths, std::size_t jobs = 0,
+		Optimization level = Optimization::O1);
+	static bool Compile(Unit& unit, Optimization level = Optimization::O1);
+
+};
+
+}
@@ -0,0 +1,297 @@
+#include "vm/image.hpp"
+#include "vm/virtual_machine.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <utility>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace VM {
+
+	namespace {
+
+		std::size_t Align(std::size_t offset, std::size_t alignment) {
+
+			return (offset + alignment - 1) / alignment * alignment;
+		}
+
+		// Whether [offset, offset + count * width) lies within size bytes.
+		bool Within(std::uint64_t offset, std::uint64_t count, std::uint64_t width, std::size_t size) {
+
+			return offset <= size && count <= (size - offset) / width;
+		}
+
+		bool IsConstantInstruction(Byte opcode) {
+
+			switch (opcode) {
+			case OpCode::Constant:
+			case OpCode::Add_Constant:
+			case OpCode::Substract_Constant:
+			case OpCode::Multiply_Constant:
+			case OpCode::Divide_Constant:
+			case OpCode::Constant_Negated:
+				return true;
+			default:
+				return false;
+			}
+		}
+
+		// Values a stack instruction pops and pushes.
+		std::pair<std::size_t, std::size_t> StackEffect(Byte opcode) {
+
+			switch (Chunk::Unquickened(opcode)) {
+			case OpCode::End:
+				return { 0, 0 };
+			case OpCode::Constant:
+			case OpCode::Constant_Long:
+			case OpCode::Constant_Negated:
+				return { 0, 1 };
+			case OpCode::Pop:
+				return { 1, 0 };
+			case OpCode::Negate:
+			case OpCode::Integer_Negate:
+			case OpCode::Number_Negate:
+			case OpCode::Add_Constant:
+			case OpCode::Substract_Constant:
+			case OpCode::Multiply_Constant:
+			case OpCode::Divide_Constant:
+				return { 1, 1 };
+			default:
+				return { 2, 1 };
+			}
+		}
+
+	}
+
+	void Image::Write(const Chunk& chunk, const std::string& path, std::string_view source) {
+
+		const std::vector<Value>& constants = chunk.Constants()->GetHandle();
+		bool ended = chunk.Size() > 0 && chunk.At(chunk.Size() - 1) == OpCode::End;
+
+		// An object constant is a pointer into this process.
+		for (const Value& value : constants)
+			if (value.IsObject())
+				throw std::runtime_error("Cannot write '" + path + "': the chunk holds object constants.");
+
+		// Quickened opcodes are written back as the generic ones they came
+		// from.
+		std::vector<Byte> code;
+		std::vector<std::uint32_t> lines;
+		for (std::size_t offset = 0; offset < chunk.Size();) {
+			Byte instruction = Chunk::Unquickened(chunk.At(offset));
+			std::size_t size = Chunk::InstructionSize(instruction);
+			for (std::size_t i = 0; i < size && offset + i < chunk.Size(); i++) {
+				code.push_back(i == 0 ? instruction : chunk.At(offset + i));
+				lines.push_back(chunk.Line(offset + i));
+			}
+			offset += size;
+		}
+		if (!ended) {
+			code.push_back(OpCode::End);
+			lines.push_back(lines.empty() ? 0 : lines.back());
+		}
+
+		Header header{};
+		std::memcpy(header.magic, Magic, sizeof(Magic));
+		header.version = Version;
+		header.opcodes = std::uint32_t(OpCodeCount);
+		header.encoding = Value::QNaN;
+		header.constants_offset = sizeof(Header);
+		header.constant_count = constants.size();
+		header.code_offset = header.constants_offset + constants.size() * sizeof(Value);
+		header.code_size = code.size();
+		header.lines_offset = Align(header.code_offset + code.size(), alignof(std::uint32_t));
+		header.source_offset = header.lines_offset + lines.size() * sizeof(std::uint32_t);
+		header.source_size = source.size();
+
+		std::ofstream out(path, std::ios::binary | std::ios::trunc);
+		if (!out)
+			throw std::runtime_error("Cannot write '" + path + "': " + std::strerror(errno));
+
+		static constexpr char Padding[alignof(std::uint32_t)] = {};
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.write(reinterpret_cast<const char*>(constants.data()), std::streamsize(constants.size() * sizeof(Value)));
+		out.write(reinterpret_cast<const char*>(code.data()), std::streamsize(code.size()));
+		out.write(Padding, std::streamsize(header.lines_offset - header.code_offset - code.size()));
+		out.write(reinterpret_cast<const char*>(lines.data()), std::streamsize(lines.size() * sizeof(std::uint32_t)));
+		out.write(source.data(), std::streamsize(source.size()));
+
+		if (!out.flush())
+			throw std::runtime_error("Cannot write '" + path + "'");
+	}
+
+	Image Image::Open(const std::string& path) {
+
+		Image image;
+
+#ifndef _WIN32
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			throw std::runtime_error("Cannot open '" + path + "': " + std::strerror(errno));
+
+		struct stat info;
+		if (::fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+			std::size_t size = static_cast<std::size_t>(info.st_size);
+			void* mapping = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+			if (mapping != MAP_FAILED) {
+				::close(fd);
+				image.m_mapping = mapping;
+				image.m_mapping_size = size;
+				image.Attach(static_cast<Byte*>(mapping), size, path);
+				return image;
+			}
+		}
+		::close(fd);
+#endif
+
+		std::ifstream in(path, std::ios::binary);
+		if (!in)
+			throw std::runtime_error("Cannot open '" + path + "': " + std::strerror(errno));
+
+		std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		image.m_buffer.resize(Align(bytes.size(), sizeof(std::uint64_t)) / sizeof(std::uint64_t));
+		std::memcpy(image.m_buffer.data(), bytes.data(), bytes.size());
+		image.Attach(reinterpret_cast<Byte*>(image.m_buffer.data()), bytes.size(), path);
+		return image;
+	}
+
+	void Image::Attach(Byte* base, std::size_t size, const std::string& path) {
+
+		auto invalid = [&path](const std::string& why) {
+			return std::runtime_error("'" + path + "' is not a bytecode image for this build: " + why + ".");
+		};
+
+		Header header;
+		if (size < sizeof(header))
+			throw invalid("too short");
+		std::memcpy(&header, base, sizeof(header));
+
+		if (std::memcmp(header.magic, Magic, sizeof(Magic)) != 0)
+			throw invalid("bad magic");
+		if (header.version != Version)
+			throw invalid("format version " + std::to_string(header.version) + ", expected " + std::to_string(Version));
+		if (header.opcodes != OpCodeCount || header.encoding != Value::QNaN)
+			throw invalid("different opcodes or value encoding");
+		if (header.constants_offset % alignof(Value) != 0 || header.lines_offset % alignof(std::uint32_t) != 0
+			|| !Within(header.constants_offset, header.constant_count, sizeof(Value), size)
+			|| !Within(header.code_offset, header.code_size, 1, size)
+			|| !Within(header.lines_offset, header.code_size, sizeof(std::uint32_t), size)
+			|| !Within(header.source_offset, header.source_size, 1, size))
+			throw invalid("sections out of bounds");
+
+		m_code = base + header.code_offset;
+		m_size = std::size_t(header.code_size);
+		m_constants = reinterpret_cast<const Value*>(base + header.constants_offset);
+		m_constant_count = std::size_t(header.constant_count);
+		m_lines = reinterpret_cast<const std::uint32_t*>(base + header.lines_offset);
+		m_source = std::string_view(reinterpret_cast<const char*>(base + header.source_offset), std::size_t(header.source_size));
+
+		for (std::size_t i = 0; i < m_constant_count; i++)
+			if (m_constants[i].IsObject())
+				throw invalid("object constant " + std::to_string(i));
+
+		// Stack code only, with every operand in range, no instruction below
+		// the bottom of the stack and End last: the interpreter checks none of
+		// these.
+		Byte last = 0;
+		std::size_t depth = 0;
+		for (std::size_t offset = 0; offset < m_size;) {
+			Byte instruction = m_code[offset];
+			if (instruction >= OpCodeCount || (instruction >= OpCode::Register_Load && instruction <= OpCode::Register_Divide) ||
+				instruction >= OpCode::Register_Integer_Negate)
+				throw invalid("bad opcode at " + std::to_string(offset));
+
+			std::size_t length = Chunk::InstructionSize(instruction);
+			if (length > m_size - offset)
+				throw invalid("truncated instruction at " + std::to_string(offset));
+
+			std::size_t constant = SIZE_MAX;
+			if (IsConstantInstruction(instruction))
+				constant = m_code[offset + 1];
+			else if (instruction == OpCode::Constant_Long)
+				constant = (std::size_t(m_code[offset + 1]) << 8) | m_code[offset + 2];
+			if (constant != SIZE_MAX && constant >= m_constant_count)
+				throw invalid("constant out of range at " + std::to_string(offset));
+
+			auto [pops, pushes] = StackEffect(instruction);
+			if (pops > depth)
+				throw invalid("stack underflow at " + std::to_string(offset));
+			depth = depth - pops + pushes;
+
+			last = instruction;
+			offset += length;
+		}
+
+		if (m_size == 0 || last != OpCode::End)
+			throw invalid("code does not end with End");
+	}
+
+	Chunk Image::ToChunk() const {
+
+		Chunk chunk;
+		for (std::size_t i = 0; i < m_constant_count; i++)
+			chunk.Constants()->Write(m_constants[i]);
+
+		for (std::size_t offset = 0; offset < m_size; offset++) {
+			chunk.SetLine(m_lines[offset]);
+			chunk.Write8(m_code[offset]);
+		}
+		return chunk;
+	}
+
+	Image::Image(Image&& other) noexcept {
+
+		*this = std::move(other);
+	}
+
+	Image& Image::operator=(Image&& other) noexcept {
+
+		if (this == &other)
+			return *this;
+
+		Release();
+		m_mapping = std::exchange(other.m_mapping, nullptr);
+		m_mapping_size = std::exchange(other.m_mapping_size, 0);
+		m_buffer = std::move(other.m_buffer);
+		m_code = std::exchange(other.m_code, nullptr);
+		m_size = std::exchange(other.m_size, 0);
+		m_constants = std::exchange(other.m_constants, nullptr);
+		m_constant_count = std::exchange(other.m_constant_count, 0);
+		m_lines = std::exchange(other.m_lines, nullptr);
+		m_source = std::exchange(other.m_source, std::string_view());
+		m_quickened = std::exchange(other.m_quickened, 0);
+		m_deoptimized = std::exchange(other.m_deoptimized, 0);
+		return *this;
+	}
+
+	Image::~Image() {
+
+		Release();
+	}
+
+	void Image::Release() {
+
+#ifndef _WIN32
+		if (m_mapping != nullptr)
+			::munmap(m_mapping, m_mapping_size);
+#endif
+		m_mapping = nullptr;
+		m_mapping_size = 0;
+		m_buffer.clear();
+		m_code = nullptr;
+		m_size = 0;
+		m_constants = nullptr;
+		m_constant_count = 0;
+		m_lines = nullptr;
+		m_source = {};
+	}
+
+}
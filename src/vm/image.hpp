@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "common/common.hpp"
+#include "vm/chunk.hpp"
+
+namespace VM {
+
+// Precompiled chunk on disk, laid out to be executed where it is mapped:
+//
+//   Header     magic, format version and the build's opcode count and value
+//              encoding; images from another build are rejected
+//   constants  the pool as NaN-boxed Values, 8-byte aligned
+//   code       the opcode stream, ending with End
+//   lines      one 32-bit source line per code byte, read on errors only
+//   source     optionally, the text the chunk was compiled from, which
+//              CompileCache compares before trusting a file
+//
+// Regular files are mapped copy-on-write, so quickening can rewrite the
+// code without touching the file; other inputs are read into a buffer.
+// Loading validates the code once, since the interpreter trusts opcodes.
+class Image {
+
+public:
+	static constexpr std::uint32_t Version = 2;
+
+	// Throws std::runtime_error when the file cannot be written. source, when
+	// given, is stored with the code and read back by Source().
+	static void Write(const Chunk& chunk, const std::string& path, std::string_view source = {});
+	// Throws std::runtime_error when the file cannot be read or is not a
+	// valid image for this build.
+	static Image Open(const std::string& path);
+
+	inline Byte* Code() { return m_code; }
+	inline std::size_t Size() const { return m_size; }
+	inline const Value* Constants() const { return m_constants; }
+	inline std::size_t ConstantCount() const { return m_constant_count; }
+	inline std::uint32_t Line(std::size_t offset) const { return m_lines[offset]; }
+	inline std::string_view Source() const { return m_source; }
+	inline bool IsMapped() const { return m_mapping != nullptr; }
+	// Instructions RVM quickened and deoptimized in this image's code, as
+	// Chunk counts them for its own.
+	inline std::uint64_t Quickened() const { return m_quickened; }
+	inline std::uint64_t Deoptimized() const { return m_deoptimized; }
+	// A copy as a Chunk, for the tracers, the register engine and the JIT.
+	Chunk ToChunk() const;
+
+public:
+	Image(const Image&) = delete;
+	Image(Image&& other) noexcept;
+	Image& operator=(const Image&) = delete;
+	Image& operator=(Image&& other) noexcept;
+	~Image();
+
+private:
+	struct Header {
+		char magic[8];
+		std::uint32_t version;
+		std::uint32_t opcodes;
+		std::uint64_t encoding;
+		std::uint64_t constants_offset;
+		std::uint64_t constant_count;
+		std::uint64_t code_offset;
+		std::uint64_t code_size;
+		std::uint64_t lines_offset;
+		std::uint64_t source_offset;
+		std::uint64_t source_size;
+	};
+
+	static constexpr char Magic[8] = { 'R', 'A', 'V', 'I', 'R', 'B', 'C', '\n' };
+
+	Image() = default;
+	// Points into base, of size bytes, after checking the header and code.
+	void Attach(Byte* base, std::size_t size, const std::string& path);
+	void Release();
+
+private:
+	void* m_mapping = nullptr;
+	std::size_t m_mapping_size = 0;
+	std::vector<std::uint64_t> m_buffer;
+	Byte* m_code = nullptr;
+	std::size_t m_size = 0;
+	const Value* m_constants = nullptr;
+	std::size_t m_constant_count = 0;
+	const std::uint32_t* m_lines = nullptr;
+	std::string_view m_source;
+	std::uint64_t m_quickened = 0;
+	std::uint64_t m_deoptimized = 0;
+
+	friend class RVM;
+};
+
+}
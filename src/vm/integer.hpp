@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+
+namespace VM::Integer {
+
+	// i32 semantics shared by the interpreter and constant folding. Overflow
+	// wraps around in two's complement instead of being undefined; division
+	// truncates toward zero and callers reject a zero divisor.
+
+	inline std::int32_t Negate(std::int32_t a) {
+
+		return std::int32_t(0u - std::uint32_t(a));
+	}
+
+	inline std::int32_t Add(std::int32_t a, std::int32_t b) {
+
+		return std::int32_t(std::uint32_t(a) + std::uint32_t(b));
+	}
+
+	inline std::int32_t Substract(std::int32_t a, std::int32_t b) {
+
+		return std::int32_t(std::uint32_t(a) - std::uint32_t(b));
+	}
+
+	inline std::int32_t Multiply(std::int32_t a, std::int32_t b) {
+
+		return std::int32_t(std::uint32_t(a) * std::uint32_t(b));
+	}
+
+	// INT32_MIN / -1 overflows like the other operations and wraps to
+	// INT32_MIN.
+	inline std::int32_t Divide(std::int32_t a, std::int32_t b) {
+
+		return b == -1 ? Negate(a) : a / b;
+	}
+
+}
@@ -0,0 +1,842 @@
+#include "vm/jit.hpp"
+#include "vm/integer.hpp"
+#include "vm/virtual_machine.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <vector>
+
+#if defined(RAVI_JIT) && defined(__x86_64__) && defined(__linux__)
+#define RAVI_JIT_X86_64
+#include <sys/mman.h>
+#endif
+
+namespace VM {
+
+#ifdef RAVI_JIT_X86_64
+
+	namespace {
+
+		// Stack slots below XmmSlots live in xmm0..xmm13 for the whole chunk.
+		// xmm14 holds a deeper slot while an instruction works on it and xmm15
+		// the sign mask of Negate. All XMM registers are caller-saved in the
+		// System V ABI, and rdi keeps the operand stack passed as first
+		// argument.
+		constexpr std::size_t XmmSlots = 14;
+		constexpr int Scratch = 14;
+		constexpr int Mask = 15;
+
+		constexpr Byte PrefixDouble = 0xF2;
+		constexpr Byte PrefixPacked = 0x66;
+		constexpr Byte SseLoad = 0x10;
+		constexpr Byte SseStore = 0x11;
+		constexpr Byte SseAdd = 0x58;
+		constexpr Byte SseMultiply = 0x59;
+		constexpr Byte SseSubstract = 0x5C;
+		constexpr Byte SseDivide = 0x5E;
+		constexpr Byte SseXor = 0x57;
+		constexpr Byte SseCompare = 0x2E;
+
+		// General purpose registers of the integer and comparison templates,
+		// all caller-saved; rdi is the operand stack.
+		constexpr int Rax = 0;
+		constexpr int Rcx = 1;
+		constexpr int Rdx = 2;
+
+		// Condition codes of jcc and setcc.
+		namespace Condition {
+			constexpr Byte AboveEqual = 0x3;
+			constexpr Byte Equal = 0x4;
+			constexpr Byte NotEqual = 0x5;
+			constexpr Byte Above = 0x7;
+			constexpr Byte Parity = 0xA;
+			constexpr Byte NoParity = 0xB;
+			constexpr Byte Less = 0xC;
+			constexpr Byte GreaterEqual = 0xD;
+			constexpr Byte LessEqual = 0xE;
+			constexpr Byte Greater = 0xF;
+		}
+
+		// Emits the templates and keeps the 8-byte constants they load
+		// RIP-relative, which are placed after the code.
+		class Assembler {
+
+		public:
+			// op xmm, xmm
+			void Register(Byte prefix, Byte opcode, int reg, int rm) {
+
+				Header(prefix, opcode, reg, rm);
+				m_code.push_back(Byte(0xC0 | ((reg & 7) << 3) | (rm & 7)));
+			}
+
+			// op xmm, [rdi + slot * 8] (or the store the other way round)
+			void Slot(Byte prefix, Byte opcode, int reg, std::size_t slot) {
+
+				Header(prefix, opcode, reg, 0);
+				m_code.push_back(Byte(0x80 | ((reg & 7) << 3) | 7));
+				Imm32(std::uint32_t(slot * sizeof(Value)));
+			}
+
+			// op xmm, [rip + constant]
+			void Constant(Byte prefix, Byte opcode, int reg, std::uint64_t bits) {
+
+				Header(prefix, opcode, reg, 0);
+				m_code.push_back(Byte(((reg & 7) << 3) | 5));
+				m_constant_fixups.push_back({ m_code.size(), Intern(bits) });
+				Imm32(0);
+			}
+
+			// jp to the stub of side exit 'exit': the last ucomisd saw a NaN.
+			inline void JumpIfNaN(std::size_t exit) { Jump(Condition::Parity, exit); }
+
+			// jcc to the stub of side exit 'exit'.
+			void Jump(Byte condition, std::size_t exit) {
+
+				m_code.push_back(0x0F);
+				m_code.push_back(Byte(0x80 | condition));
+				m_exit_fixups.push_back({ m_code.size(), exit });
+				Imm32(0);
+			}
+
+			// movq gpr, xmm
+			void MoveToGeneral(int gpr, int xmm) {
+
+				m_code.insert(m_code.end(), { PrefixPacked, Byte(0x48 | (xmm >= 8 ? 0x04 : 0)), 0x0F, 0x7E });
+				m_code.push_back(Byte(0xC0 | ((xmm & 7) << 3) | gpr));
+			}
+
+			// movq xmm, gpr
+			void MoveFromGeneral(int xmm, int gpr) {
+
+				m_code.insert(m_code.end(), { PrefixPacked, Byte(0x48 | (xmm >= 8 ? 0x04 : 0)), 0x0F, 0x6E });
+				m_code.push_back(Byte(0xC0 | ((xmm & 7) << 3) | gpr));
+			}
+
+			// mov gpr, [rdi + slot * 8] or mov [rdi + slot * 8], gpr
+			void GeneralSlot(bool store, int gpr, std::size_t slot) {
+
+				m_code.insert(m_code.end(), { 0x48, Byte(store ? 0x89 : 0x8B), Byte(0x80 | (gpr << 3) | 7) });
+				Imm32(std::uint32_t(slot * sizeof(Value)));
+			}
+
+			// mov gpr, imm64
+			void MoveImmediate(int gpr, std::uint64_t bits) {
+
+				m_code.push_back(0x48);
+				m_code.push_back(Byte(0xB8 | gpr));
+				for (int i = 0; i < 8; i++)
+					m_code.push_back(Byte(bits >> (8 * i)));
+			}
+
+			// setcc r8 for the first four registers (al, cl, dl, bl).
+			void Set(Byte condition, int gpr) {
+
+				m_code.insert(m_code.end(), { 0x0F, Byte(0x90 | condition), Byte(0xC0 | gpr) });
+			}
+
+			// Instructions without operands to patch.
+			void Emit(std::initializer_list<Byte> bytes) {
+
+				m_code.insert(m_code.end(), bytes);
+			}
+
+			// mov rax, value; ret
+			void Return(std::int32_t value) {
+
+				m_code.insert(m_code.end(), { 0x48, 0xC7, 0xC0 });
+				Imm32(std::uint32_t(value));
+				m_code.push_back(0xC3);
+			}
+
+			// Appends the side exits and the constants, resolving every
+			// reference to them. Each exit stub loads its result and joins a
+			// shared path that stores the first 'spilled' register slots.
+			std::vector<Byte> Finish(std::size_t exits, std::size_t spilled) {
+
+				std::size_t spill = m_code.size();
+				if (exits > 0) {
+					for (std::size_t slot = 0; slot < spilled; slot++)
+						Slot(PrefixDouble, SseStore, int(slot), slot);
+					m_code.push_back(0xC3);
+				}
+
+				std::vector<std::size_t> stubs(exits);
+				for (std::size_t exit = 0; exit < exits; exit++) {
+					stubs[exit] = m_code.size();
+					m_code.insert(m_code.end(), { 0x48, 0xC7, 0xC0 });
+					Imm32(std::uint32_t(-1 - std::int32_t(exit)));
+					m_code.push_back(0xE9);
+					Imm32(0);
+					Patch(m_code.size() - 4, spill);
+				}
+
+				for (const Fixup& fixup : m_exit_fixups)
+					Patch(fixup.at, stubs[fixup.index]);
+
+				while (m_code.size() % sizeof(std::uint64_t) != 0)
+					m_code.push_back(0xCC);
+
+				std::size_t data = m_code.size();
+				for (std::uint64_t bits : m_constants) {
+					Byte bytes[sizeof(bits)];
+					std::memcpy(bytes, &bits, sizeof(bits));
+					m_code.insert(m_code.end(), bytes, bytes + sizeof(bits));
+				}
+
+				for (const Fixup& fixup : m_constant_fixups)
+					Patch(fixup.at, data + fixup.index * sizeof(std::uint64_t));
+
+				return std::move(m_code);
+			}
+
+		private:
+			struct Fixup {
+				std::size_t at;
+				std::size_t index;
+			};
+
+			void Header(Byte prefix, Byte opcode, int reg, int rm) {
+
+				m_code.push_back(prefix);
+				Byte rex = Byte(0x40 | (reg >= 8 ? 0x04 : 0) | (rm >= 8 ? 0x01 : 0));
+				if (rex != 0x40)
+					m_code.push_back(rex);
+				m_code.push_back(0x0F);
+				m_code.push_back(opcode);
+			}
+
+			void Imm32(std::uint32_t value) {
+
+				for (int i = 0; i < 4; i++)
+					m_code.push_back(Byte(value >> (8 * i)));
+			}
+
+			// The 32-bit displacement at 'at' ends its instruction.
+			void Patch(std::size_t at, std::size_t target) {
+
+				std::uint32_t displacement = std::uint32_t(std::int32_t(target - (at + 4)));
+				for (int i = 0; i < 4; i++)
+					m_code[at + i] = Byte(displacement >> (8 * i));
+			}
+
+			std::size_t Intern(std::uint64_t bits) {
+
+				auto found = std::find(m_constants.begin(), m_constants.end(), bits);
+				if (found != m_constants.end())
+					return std::size_t(found - m_constants.begin());
+				m_constants.push_back(bits);
+				return m_constants.size() - 1;
+			}
+
+		private:
+			std::vector<Byte> m_code;
+			std::vector<std::uint64_t> m_constants;
+			std::vector<Fixup> m_constant_fixups;
+			std::vector<Fixup> m_exit_fixups;
+		};
+
+		// What the translator knows about a stack slot. A pending slot holds a
+		// constant that no code has loaded yet, so operations on constants fold
+		// and constants that are popped unused cost nothing.
+		struct Known {
+			bool number;
+			bool pending;
+			std::uint64_t bits;
+		};
+
+		// Translates the chunk instruction by instruction, tracking the depth
+		// and what is known about each slot.
+		class Translator {
+
+		public:
+			Translator(const Chunk& chunk, std::size_t stack_size, bool fold)
+				: m_chunk(chunk), m_stack_size(stack_size), m_fold(fold) { }
+
+			bool Translate() {
+
+				const std::vector<Value>& constants = m_chunk.Constants()->GetHandle();
+
+				for (std::size_t offset = 0; offset < m_chunk.Size();) {
+
+					Byte instruction = Chunk::Unquickened(m_chunk.At(offset));
+
+					switch (instruction) {
+
+					case OpCode::Constant:
+						if (!Push(constants[m_chunk.At(offset + 1)]))
+							return false;
+						break;
+
+					case OpCode::Constant_Long:
+						if (!Push(constants[(std::size_t(m_chunk.At(offset + 1)) << 8) | m_chunk.At(offset + 2)]))
+							return false;
+						break;
+
+					case OpCode::Pop:
+						if (m_known.empty())
+							return false;
+						m_known.pop_back();
+						break;
+
+					case OpCode::Negate:
+					case OpCode::Number_Negate:
+						if (m_known.empty())
+							return false;
+						Negate(offset, instruction == OpCode::Negate);
+						break;
+
+					case OpCode::Add:
+					case OpCode::Substract:
+					case OpCode::Multiply:
+					case OpCode::Divide:
+					case OpCode::Number_Add:
+					case OpCode::Number_Substract:
+					case OpCode::Number_Multiply:
+					case OpCode::Number_Divide:
+						if (m_known.size() < 2)
+							return false;
+						Binary(offset, SseOpcode(instruction), IsGeneric(instruction), nullptr);
+						m_known.pop_back();
+						break;
+
+					case OpCode::Add_Constant:
+					case OpCode::Substract_Constant:
+					case OpCode::Multiply_Constant:
+					case OpCode::Divide_Constant:
+						if (m_known.empty())
+							return false;
+						Binary(offset, SseOpcode(Chunk::Unfused(instruction)), true, &constants[m_chunk.At(offset + 1)]);
+						break;
+
+					case OpCode::Integer_Negate:
+						if (m_known.empty())
+							return false;
+						IntegerNegate();
+						break;
+
+					case OpCode::Integer_Add:
+					case OpCode::Integer_Substract:
+					case OpCode::Integer_Multiply:
+					case OpCode::Integer_Divide:
+						if (m_known.size() < 2)
+							return false;
+						IntegerBinary(offset, instruction);
+						m_known.pop_back();
+						break;
+
+					case OpCode::Equal:
+					case OpCode::Not_Equal:
+					case OpCode::Less:
+					case OpCode::Less_Equal:
+					case OpCode::Greater:
+					case OpCode::Greater_Equal:
+					case OpCode::Integer_Equal:
+					case OpCode::Integer_Not_Equal:
+					case OpCode::Integer_Less:
+					case OpCode::Integer_Less_Equal:
+					case OpCode::Integer_Greater:
+					case OpCode::Integer_Greater_Equal:
+					case OpCode::Number_Equal:
+					case OpCode::Number_Not_Equal:
+					case OpCode::Number_Less:
+					case OpCode::Number_Less_Equal:
+					case OpCode::Number_Greater:
+					case OpCode::Number_Greater_Equal:
+						if (m_known.size() < 2)
+							return false;
+						Compare(offset, instruction);
+						m_known.pop_back();
+						break;
+
+					// Only number constants: negating others converts them.
+					case OpCode::Constant_Negated: {
+						const Value& constant = constants[m_chunk.At(offset + 1)];
+						if (!constant.IsNumber() || !Push(Value::Arithmetic(-constant.AsNumber())))
+							return false;
+						break;
+					}
+
+					case OpCode::End:
+						End();
+						return true;
+
+					default:
+						return false;
+					}
+
+					offset += Chunk::InstructionSize(instruction);
+				}
+
+				End();
+				return true;
+			}
+
+			inline std::vector<Byte> Finish() { return m_assembler.Finish(m_exits.size(), std::min(m_stack_size, XmmSlots)); }
+			inline std::vector<Jit::Exit> Exits() { return std::move(m_exits); }
+
+		private:
+			static Byte SseOpcode(Byte instruction) {
+
+				switch (instruction) {
+				case OpCode::Add:
+				case OpCode::Number_Add:
+					return SseAdd;
+				case OpCode::Substract:
+				case OpCode::Number_Substract:
+					return SseSubstract;
+				case OpCode::Multiply:
+				case OpCode::Number_Multiply:
+					return SseMultiply;
+				default:
+					return SseDivide;
+				}
+			}
+
+			static bool IsGeneric(Byte instruction) {
+
+				return instruction == OpCode::Add || instruction == OpCode::Substract
+					|| instruction == OpCode::Multiply || instruction == OpCode::Divide;
+			}
+
+			// The interpreter's result for two numbers, computed now.
+			static std::uint64_t Fold(Byte opcode, std::uint64_t left, std::uint64_t right) {
+
+				double a = std::bit_cast<double>(left), b = std::bit_cast<double>(right);
+
+				switch (opcode) {
+				case SseAdd:
+					return Value::Arithmetic(a + b).Bits();
+				case SseSubstract:
+					return Value::Arithmetic(a - b).Bits();
+				case SseMultiply:
+					return Value::Arithmetic(a * b).Bits();
+				default:
+					return Value::Arithmetic(a / b).Bits();
+				}
+			}
+
+			// comparison is the offset from Equal in each group of six.
+			template<typename T>
+			static bool Holds(std::size_t comparison, T a, T b) {
+
+				switch (comparison) {
+				case 0:
+					return a == b;
+				case 1:
+					return a != b;
+				case 2:
+					return a < b;
+				case 3:
+					return a <= b;
+				case 4:
+					return a > b;
+				default:
+					return a >= b;
+				}
+			}
+
+			bool Push(const Value& value) {
+
+				if (m_known.size() == m_stack_size)
+					return false;
+
+				m_known.push_back({ value.IsNumber(), true, value.Bits() });
+				if (!m_fold)
+					Materialize(m_known.size() - 1);
+				return true;
+			}
+
+			void Materialize(std::size_t slot) {
+
+				Known& known = m_known[slot];
+				if (!known.pending)
+					return;
+
+				known.pending = false;
+				if (slot < XmmSlots) {
+					m_assembler.Constant(PrefixDouble, SseLoad, int(slot), known.bits);
+					return;
+				}
+
+				m_assembler.Constant(PrefixDouble, SseLoad, Scratch, known.bits);
+				m_assembler.Slot(PrefixDouble, SseStore, Scratch, slot);
+			}
+
+			// A side exit needs every slot in its place.
+			std::size_t Exit(std::size_t offset) {
+
+				for (std::size_t slot = 0; slot < m_known.size(); slot++)
+					Materialize(slot);
+
+				m_exits.push_back({ offset, m_known.size() });
+				return m_exits.size() - 1;
+			}
+
+			// The register that holds slot while an instruction works on it.
+			int Acquire(std::size_t slot) {
+
+				if (slot < XmmSlots)
+					return int(slot);
+
+				m_assembler.Slot(PrefixDouble, SseLoad, Scratch, slot);
+				return Scratch;
+			}
+
+			void Release(std::size_t slot) {
+
+				if (slot >= XmmSlots)
+					m_assembler.Slot(PrefixDouble, SseStore, Scratch, slot);
+			}
+
+			// left = left op right, where right is the top slot or the fused
+			// constant. Generic operations keep the guard of RAVI_BINARY
+			// unless both operands are proven numbers; a guarded one works
+			// on a copy of left, which the side exit still needs.
+			void Binary(std::size_t offset, Byte opcode, bool generic, const Value* fused) {
+
+				std::size_t left = m_known.size() - (fused ? 1 : 2), right = left + 1;
+				Known rhs = fused ? Known{ fused->IsNumber(), true, fused->Bits() } : m_known[right];
+				Known& lhs = m_known[left];
+
+				if (lhs.pending && rhs.pending && lhs.number && rhs.number) {
+					lhs.bits = Fold(opcode, lhs.bits, rhs.bits);
+					return;
+				}
+
+				bool numbers = lhs.number && rhs.number;
+				bool guard = generic && !numbers;
+				std::size_t exit = guard ? Exit(offset) : 0;
+				if (guard && !fused)
+					rhs = m_known[right];
+
+				int target = Scratch;
+				if (lhs.pending)
+					m_assembler.Constant(PrefixDouble, SseLoad, target = left < XmmSlots ? int(left) : Scratch, lhs.bits);
+				else if (left >= XmmSlots)
+					m_assembler.Slot(PrefixDouble, SseLoad, Scratch, left);
+				else if (guard)
+					m_assembler.Register(PrefixDouble, SseLoad, Scratch, int(left));
+				else
+					target = int(left);
+
+				if (rhs.pending)
+					m_assembler.Constant(PrefixDouble, opcode, target, rhs.bits);
+				else if (right < XmmSlots)
+					m_assembler.Register(PrefixDouble, opcode, target, int(right));
+				else
+					m_assembler.Slot(PrefixDouble, opcode, target, right);
+
+				if (guard) {
+					m_assembler.Register(PrefixPacked, SseCompare, target, target);
+					m_assembler.JumpIfNaN(exit);
+				}
+
+				if (target == Scratch && left < XmmSlots)
+					m_assembler.Register(PrefixDouble, SseLoad, int(left), Scratch);
+				else if (target == Scratch)
+					m_assembler.Slot(PrefixDouble, SseStore, Scratch, left);
+
+				lhs = { generic || numbers, false, 0 };
+			}
+
+			// The generic Negate gives up on any NaN operand, boxed or not,
+			// unless it is a proven number.
+			void Negate(std::size_t offset, bool generic) {
+
+				std::size_t slot = m_known.size() - 1;
+				Known& known = m_known[slot];
+
+				if (known.pending && (known.number || !generic)) {
+					known.bits ^= Value::SignBit;
+					return;
+				}
+
+				bool guard = generic && !known.number;
+				std::size_t exit = guard ? Exit(offset) : 0;
+				Materialize(slot);
+				int target = Acquire(slot);
+
+				if (guard) {
+					m_assembler.Register(PrefixPacked, SseCompare, target, target);
+					m_assembler.JumpIfNaN(exit);
+				}
+
+				// xorpd only takes 16-byte aligned memory, so the mask is loaded
+				// with movsd first.
+				m_assembler.Constant(PrefixDouble, SseLoad, Mask, Value::SignBit);
+				m_assembler.Register(PrefixPacked, SseXor, target, Mask);
+				Release(slot);
+				known.number = known.number || generic;
+			}
+
+			// slot in gpr: from its register, from the operand stack or, while
+			// it is pending, the constant itself.
+			void LoadGeneral(int gpr, std::size_t slot) {
+
+				const Known& known = m_known[slot];
+				if (known.pending)
+					m_assembler.MoveImmediate(gpr, known.bits);
+				else if (slot < XmmSlots)
+					m_assembler.MoveToGeneral(gpr, int(slot));
+				else
+					m_assembler.GeneralSlot(false, gpr, slot);
+			}
+
+			// Boxes the 32-bit payload in eax, whose upper half the template
+			// cleared, with tag and stores it to slot.
+			void StoreGeneral(std::size_t slot, std::uint64_t tag) {
+
+				m_assembler.MoveImmediate(Rdx, tag);
+				m_assembler.Emit({ 0x48, 0x09, 0xD0 });	// or rax, rdx
+				if (slot < XmmSlots)
+					m_assembler.MoveFromGeneral(int(slot), Rax);
+				else
+					m_assembler.GeneralSlot(true, Rax, slot);
+				m_known[slot] = { false, false, 0 };
+			}
+
+			// The Integer_* operands are proven integers, so the templates
+			// work on the payloads and wrap like VM::Integer.
+			void IntegerNegate() {
+
+				std::size_t slot = m_known.size() - 1;
+				Known& known = m_known[slot];
+
+				if (known.pending) {
+					known.bits = Value::Integer(Integer::Negate(Value::FromBits(known.bits).AsInteger())).Bits();
+					return;
+				}
+
+				LoadGeneral(Rax, slot);
+				m_assembler.Emit({ 0xF7, 0xD8 });	// neg eax
+				StoreGeneral(slot, Value::QNaN | Value::IntegerTag);
+			}
+
+			// Division takes a side exit on a zero divisor, which the
+			// interpreter reports, and on -1, where idiv traps on INT32_MIN.
+			void IntegerBinary(std::size_t offset, Byte instruction) {
+
+				std::size_t left = m_known.size() - 2, right = left + 1;
+				Known& lhs = m_known[left];
+				const Known& rhs = m_known[right];
+				bool divide = instruction == OpCode::Integer_Divide;
+
+				if (lhs.pending && rhs.pending) {
+					std::int32_t a = Value::FromBits(lhs.bits).AsInteger(), b = Value::FromBits(rhs.bits).AsInteger();
+					if (instruction == OpCode::Integer_Add)
+						lhs.bits = Value::Integer(Integer::Add(a, b)).Bits();
+					else if (instruction == OpCode::Integer_Substract)
+						lhs.bits = Value::Integer(Integer::Substract(a, b)).Bits();
+					else if (instruction == OpCode::Integer_Multiply)
+						lhs.bits = Value::Integer(Integer::Multiply(a, b)).Bits();
+					else if (b != 0)
+						lhs.bits = Value::Integer(Integer::Divide(a, b)).Bits();
+					if (!divide || b != 0)
+						return;
+				}
+
+				std::size_t exit = divide ? Exit(offset) : 0;
+				LoadGeneral(Rax, left);
+				LoadGeneral(Rcx, right);
+
+				switch (instruction) {
+				case OpCode::Integer_Add:
+					m_assembler.Emit({ 0x01, 0xC8 });	// add eax, ecx
+					break;
+				case OpCode::Integer_Substract:
+					m_assembler.Emit({ 0x29, 0xC8 });	// sub eax, ecx
+					break;
+				case OpCode::Integer_Multiply:
+					m_assembler.Emit({ 0x0F, 0xAF, 0xC1 });	// imul eax, ecx
+					break;
+				default:
+					m_assembler.Emit({ 0x85, 0xC9 });	// test ecx, ecx
+					m_assembler.Jump(Condition::Equal, exit);
+					m_assembler.Emit({ 0x83, 0xF9, 0xFF });	// cmp ecx, -1
+					m_assembler.Jump(Condition::Equal, exit);
+					m_assembler.Emit({ 0x99, 0xF7, 0xF9 });	// cdq; idiv ecx
+					break;
+				}
+
+				StoreGeneral(left, Value::QNaN | Value::IntegerTag);
+			}
+
+			// Comparisons push a bool. The Integer_* ones compare payloads,
+			// the others doubles; a generic one takes a side exit unless its
+			// operands are proven numbers, and the interpreter compares the
+			// integers or raises on the other values. ucomisd sets CF for
+			// below, ZF for equal and all three with PF for unordered, which
+			// only != accepts; < and <= swap the operands to test above.
+			void Compare(std::size_t offset, Byte instruction) {
+
+				std::size_t left = m_known.size() - 2, right = left + 1;
+				Known& lhs = m_known[left];
+				bool integers = instruction >= OpCode::Integer_Equal && instruction <= OpCode::Integer_Greater_Equal;
+				bool generic = instruction <= OpCode::Greater_Equal;
+				std::size_t comparison = instruction - (integers ? OpCode::Integer_Equal : generic ? OpCode::Equal : OpCode::Number_Equal);
+				bool numbers = !generic || (lhs.number && m_known[right].number);
+
+				if (lhs.pending && m_known[right].pending && (integers || numbers)) {
+					Value a = Value::FromBits(lhs.bits), b = Value::FromBits(m_known[right].bits);
+					bool holds = integers ? Holds(comparison, a.AsInteger(), b.AsInteger()) : Holds(comparison, a.AsNumber(), b.AsNumber());
+					lhs = { false, true, Value::Bool(holds).Bits() };
+					return;
+				}
+
+				if (integers) {
+					static constexpr Byte Conditions[] = {
+						Condition::Equal, Condition::NotEqual, Condition::Less,
+						Condition::LessEqual, Condition::Greater, Condition::GreaterEqual
+					};
+
+					LoadGeneral(Rax, left);
+					LoadGeneral(Rcx, right);
+					m_assembler.Emit({ 0x39, 0xC8 });	// cmp eax, ecx
+					m_assembler.Set(Conditions[comparison], Rax);
+				}
+				else {
+					if (!numbers) {
+						std::size_t exit = Exit(offset);
+						for (std::size_t slot : { left, right }) {
+							if (m_known[slot].number)
+								continue;
+							int target = Acquire(slot);
+							m_assembler.Register(PrefixPacked, SseCompare, target, target);
+							m_assembler.JumpIfNaN(exit);
+						}
+					}
+
+					bool swap = comparison == 2 || comparison == 3;
+					std::size_t first = swap ? right : left, second = swap ? left : right;
+					const Known& known = m_known[second];
+
+					int target = Scratch;
+					if (m_known[first].pending)
+						m_assembler.Constant(PrefixDouble, SseLoad, Scratch, m_known[first].bits);
+					else
+						target = Acquire(first);
+
+					if (known.pending)
+						m_assembler.Constant(PrefixPacked, SseCompare, target, known.bits);
+					else if (second < XmmSlots)
+						m_assembler.Register(PrefixPacked, SseCompare, target, int(second));
+					else
+						m_assembler.Slot(PrefixPacked, SseCompare, target, second);
+
+					switch (comparison) {
+					case 0:
+						m_assembler.Set(Condition::Equal, Rax);
+						m_assembler.Set(Condition::NoParity, Rcx);
+						m_assembler.Emit({ 0x20, 0xC8 });	// and al, cl
+						break;
+					case 1:
+						m_assembler.Set(Condition::NotEqual, Rax);
+						m_assembler.Set(Condition::Parity, Rcx);
+						m_assembler.Emit({ 0x08, 0xC8 });	// or al, cl
+						break;
+					case 2:
+					case 4:
+						m_assembler.Set(Condition::Above, Rax);
+						break;
+					default:
+						m_assembler.Set(Condition::AboveEqual, Rax);
+						break;
+					}
+				}
+
+				m_assembler.Emit({ 0x0F, 0xB6, 0xC0 });	// movzx eax, al
+				StoreGeneral(left, Value::FalseBits);
+			}
+
+			// Stores the slots to the operand stack and returns the depth.
+			void End() {
+
+				for (std::size_t slot = 0; slot < m_known.size(); slot++)
+					Materialize(slot);
+				for (std::size_t slot = 0; slot < std::min(m_known.size(), XmmSlots); slot++)
+					m_assembler.Slot(PrefixDouble, SseStore, int(slot), slot);
+				m_assembler.Return(std::int32_t(m_known.size()));
+			}
+
+		private:
+			const Chunk& m_chunk;
+			std::size_t m_stack_size;
+			bool m_fold;
+			std::vector<Known> m_known;
+			std::vector<Jit::Exit> m_exits;
+			Assembler m_assembler;
+		};
+
+	}
+
+	std::unique_ptr<Jit> Jit::Compile(const Chunk& chunk, std::size_t stack_size, bool fold) {
+
+		Translator translator(chunk, std::min<std::size_t>(stack_size, INT32_MAX / sizeof(Value)), fold);
+		if (!translator.Translate())
+			return nullptr;
+
+		std::vector<Byte> code = translator.Finish();
+		std::vector<Exit> exits = translator.Exits();
+
+		// Written while writable, then switched to executable: never both.
+		void* memory = mmap(nullptr, code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (memory == MAP_FAILED)
+			return nullptr;
+
+		std::memcpy(memory, code.data(), code.size());
+		if (mprotect(memory, code.size(), PROT_READ | PROT_EXEC) != 0) {
+			munmap(memory, code.size());
+			return nullptr;
+		}
+
+		return std::unique_ptr<Jit>(new Jit(memory, code.size(), std::move(exits)));
+	}
+
+	bool Jit::Available() {
+
+		return true;
+	}
+
+	Jit::Jit(void* memory, std::size_t size, std::vector<Exit> exits)
+		: m_memory(memory), m_size(size), m_entry(reinterpret_cast<Entry>(memory)), m_exits(std::move(exits)) { }
+
+	Jit::~Jit() {
+
+		munmap(m_memory, m_size);
+	}
+
+#else
+
+	std::unique_ptr<Jit> Jit::Compile(const Chunk&, std::size_t, bool) {
+
+		return nullptr;
+	}
+
+	bool Jit::Available() {
+
+		return false;
+	}
+
+	Jit::Jit(void* memory, std::size_t size, std::vector<Exit> exits)
+		: m_memory(memory), m_size(size), m_entry(nullptr), m_exits(std::move(exits)) { }
+
+	Jit::~Jit() = default;
+
+#endif
+
+	const Jit::Exit* Jit::Run(Value* stack, std::size_t& depth) {
+
+		std::int64_t result = m_entry(stack);
+		if (result >= 0) {
+			depth = std::size_t(result);
+			return nullptr;
+		}
+
+		Exit& exit = m_exits[std::size_t(-1 - result)];
+		exit.taken++;
+		depth = exit.depth;
+		return &exit;
+	}
+
+}
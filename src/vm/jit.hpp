@@ -0,0 +1,63 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "vm/chunk.hpp"
+#include "common/common.hpp"
+
+namespace VM {
+
+// Baseline compiler from stack bytecode to x86-64 machine code, for Linux
+// (System V ABI). Each instruction expands to a fixed template. The code has
+// no jumps, so the stack depth before every instruction is known and the
+// first stack slots are assigned XMM registers for the whole chunk; deeper
+// slots stay in the operand stack. Generic arithmetic keeps the guard of
+// the interpreter's fast path, a NaN result may come from a boxed operand,
+// unless both operands are proven numbers. Integer_* arithmetic and the
+// comparisons work on the payloads in general purpose registers and box
+// their results. A failed guard takes a side exit: the code stores the
+// stack as it was before the instruction and the interpreter resumes there.
+// Integer division exits on divisors 0 and -1.
+class Jit {
+
+public:
+	// Where the interpreter resumes after a side exit.
+	struct Exit {
+		std::size_t offset;
+		std::size_t depth;
+		std::uint64_t taken = 0;
+	};
+
+	// Machine code for chunk, or nullptr when it uses an opcode without a
+	// template, needs more than stack_size slots, or there is no JIT for
+	// this platform. fold propagates constants through the arithmetic;
+	// without it every constant is loaded when pushed.
+	static std::unique_ptr<Jit> Compile(const Chunk& chunk, std::size_t stack_size, bool fold = true);
+	static bool Available();
+
+	// Runs the code on stack and sets depth to the number of values it left
+	// there. Returns nullptr when the code finished, otherwise the side exit
+	// it took; the interpreter then resumes at its offset.
+	const Exit* Run(Value* stack, std::size_t& depth);
+	inline std::size_t CodeSize() const { return m_size; }
+	inline const std::vector<Exit>& Exits() const { return m_exits; }
+
+public:
+	Jit(const Jit&) = delete;
+	Jit& operator=(const Jit&) = delete;
+	~Jit();
+
+private:
+	// Returns the depth, or -1 - index of the exit taken.
+	using Entry = std::int64_t (*)(Value* stack);
+
+	Jit(void* memory, std::size_t size, std::vector<Exit> exits);
+
+private:
+	void* m_memory;
+	std::size_t m_size;
+	Entry m_entry;
+	std::vector<Exit> m_exits;
+};
+
+}
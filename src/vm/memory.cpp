@@ -1,21 +1,79 @@
 #include "vm/memory.hpp"
 
 #include <cstring>
+#include <cstdio>
+#include <stdexcept>
 
 namespace VM {
 
+	std::string Memory::ToString(const Value& value) {
+
+		char buffer[32];
+
+		if (value.IsNumber())
+			std::snprintf(buffer, sizeof(buffer), "%g", value.AsNumber());
+		else if (value.IsInteger())
+			std::snprintf(buffer, sizeof(buffer), "%d", value.AsInteger());
+		else if (value.IsBool())
+			return value.AsBool() ? "true" : "false";
+		else if (value.IsObject())
+			std::snprintf(buffer, sizeof(buffer), "<object %p>", static_cast<void*>(value.AsObject()));
+		else
+			return "nil";
+
+		return buffer;
+	}
+
 	void Memory::PrintValue(const Value& value) {
-		std::printf("%g", value);
+		std::fputs(ToString(value).c_str(), stdout);
 	}
 
 	void Memory::PrintlnValue(const Value& value) {
-		std::printf("%g\n", value);
+		std::puts(ToString(value).c_str());
 	}
 
 	void Memory::Write(const Value& value) {
+		CheckWritable();
 		m_values.push_back(value);
 	}
 
+	std::size_t Memory::Intern(const Value& value) {
+
+		CheckWritable();
+
+		auto [entry, inserted] = m_index.try_emplace(value.Bits(), m_values.size());
+		if (inserted)
+			m_values.push_back(value);
+
+		return entry->second;
+	}
+
+	void Memory::Truncate(std::size_t size) {
+
+		CheckWritable();
+
+		for (std::size_t i = size; i < m_values.size(); i++) {
+			auto entry = m_index.find(m_values[i].Bits());
+			if (entry != m_index.end() && entry->second == i)
+				m_index.erase(entry);
+		}
+
+		m_values.resize(size);
+	}
+
+	void Memory::Seal() {
+		m_sealed = true;
+	}
+
+	bool Memory::IsSealed() const {
+		return m_sealed;
+	}
+
+	void Memory::CheckWritable() const {
+		if (m_sealed)
+			throw std::logic_error("Cannot add constants to a sealed constant table.");
+	}
+
 	std::size_t Memory::Size() const {
 		return m_values.size();
 	}
@@ -24,4 +82,8 @@ namespace VM {
 		return m_values;
 	}
 
+	const std::vector<Value>& Memory::GetHandle() const {
+		return m_values;
+	}
+
 }
\ No newline at end of file
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <vector>
+#include <string>
+#include <unordered_map>
 #include "common/common.hpp"
 
 namespace VM {
@@ -8,20 +10,37 @@ namespace VM {
 class Memory {
 
 public:
+	static std::string ToString(const Value& value);
 	static void PrintValue(const Value& value);
 	static void PrintlnValue(const Value& value);
 	void Write(const Value& value);
+	// Returns the index of a constant with the same bit pattern, appending it
+	// first if needed. Keying on bits keeps -0.0 apart from 0.0, keeps NaN
+	// payloads distinct and never confuses a number with a boxed value.
+	std::size_t Intern(const Value& value);
 	std::size_t Size() const;
+	void Truncate(std::size_t size);
+	// A sealed table is immutable and can be shared by any number of chunks.
+	void Seal();
+	bool IsSealed() const;
 	std::vector<Value>& GetHandle();
+	const std::vector<Value>& GetHandle() const;
 	
 public:
 	Memory() = default;
 	Memory(const Memory&) = default;
 	Memory(Memory&&) = default;
+	Memory& operator=(const Memory&) = default;
+	Memory& operator=(Memory&&) = default;
 	~Memory() = default;
 
+private:
+	void CheckWritable() const;
+
 private:
 	std::vector<Value> m_values;
+	std::unordered_map<std::uint64_t, std::size_t> m_index;
+	bool m_sealed = false;
 };
 
 }
@@ -0,0 +1,298 @@
+#include "vm/optimizer.hpp"
+#include "vm/virtual_machine.hpp"
+#include "vm/integer.hpp"
+#include "analysis/parser.hpp"
+
+namespace VM {
+
+	namespace {
+
+		std::size_t Arity(Byte opcode) {
+
+			switch (opcode) {
+			case OpCode::Constant:
+				return 0;
+			case OpCode::Pop:
+			case OpCode::Negate:
+			case OpCode::Integer_Negate:
+			case OpCode::Number_Negate:
+				return 1;
+			case OpCode::Add:
+			case OpCode::Substract:
+			case OpCode::Multiply:
+			case OpCode::Divide:
+			case OpCode::Equal:
+			case OpCode::Not_Equal:
+			case OpCode::Less:
+			case OpCode::Less_Equal:
+			case OpCode::Greater:
+			case OpCode::Greater_Equal:
+			case OpCode::Integer_Add:
+			case OpCode::Integer_Substract:
+			case OpCode::Integer_Multiply:
+			case OpCode::Integer_Divide:
+			case OpCode::Integer_Equal:
+			case OpCode::Integer_Not_Equal:
+			case OpCode::Integer_Less:
+			case OpCode::Integer_Less_Equal:
+			case OpCode::Integer_Greater:
+			case OpCode::Integer_Greater_Equal:
+			case OpCode::Number_Add:
+			case OpCode::Number_Substract:
+			case OpCode::Number_Multiply:
+			case OpCode::Number_Divide:
+			case OpCode::Number_Equal:
+			case OpCode::Number_Not_Equal:
+			case OpCode::Number_Less:
+			case OpCode::Number_Less_Equal:
+			case OpCode::Number_Greater:
+			case OpCode::Number_Greater_Equal:
+				return 2;
+			default:
+				return SIZE_MAX;
+			}
+		}
+
+		bool IsNumberOpcode(Byte opcode) {
+
+			return opcode >= OpCode::Number_Negate && opcode <= OpCode::Number_Greater_Equal;
+		}
+
+		bool IsIntegerOpcode(Byte opcode) {
+
+			return (opcode >= OpCode::Integer_Negate && opcode <= OpCode::Integer_Divide)
+				|| (opcode >= OpCode::Integer_Equal && opcode <= OpCode::Integer_Greater_Equal);
+		}
+
+	}
+
+	Optimizer::Optimizer(Chunk& chunk)
+		: m_chunk(chunk) { }
+
+	bool Optimizer::Optimize() {
+
+		m_block = Block();
+		m_folded = 0;
+		m_eliminated = 0;
+
+		// Folded constants are interned into the chunk's table.
+		if (m_chunk.Constants()->IsSealed() || !Build())
+			return false;
+
+		Propagate();
+		Truncate();
+		Eliminate();
+		return Lower();
+	}
+
+	bool Optimizer::Build() {
+
+		const std::vector<Value>& constants = m_chunk.Constants()->GetHandle();
+		std::vector<Id> stack;
+
+		auto add = [&](Byte opcode, Value constant, std::uint32_t line) {
+
+			std::size_t arity = opcode == OpCode::End ? stack.size() : Arity(opcode);
+			if (arity == SIZE_MAX || arity > stack.size())
+				return false;
+
+			Instruction instruction{ opcode, std::vector<Id>(stack.end() - arity, stack.end()), constant, line };
+			stack.resize(stack.size() - arity);
+			if (opcode != OpCode::Pop && opcode != OpCode::End)
+				stack.push_back(Id(m_block.code.size()));
+			m_block.code.push_back(std::move(instruction));
+			return true;
+		};
+
+		for (std::size_t offset = 0; offset < m_chunk.Size();) {
+
+			Byte instruction = Chunk::Unquickened(m_chunk.At(offset));
+			std::uint32_t line = m_chunk.Line(offset);
+			bool ok = true;
+
+			switch (instruction) {
+
+			case OpCode::Constant:
+				ok = add(OpCode::Constant, constants[m_chunk.At(offset + 1)], line);
+				break;
+
+			case OpCode::Constant_Long:
+				ok = add(OpCode::Constant, constants[(std::size_t(m_chunk.At(offset + 1)) << 8) | m_chunk.At(offset + 2)], line);
+				break;
+
+			// Superinstructions split back into their constant and opcode.
+			case OpCode::Add_Constant:
+			case OpCode::Substract_Constant:
+			case OpCode::Multiply_Constant:
+			case OpCode::Divide_Constant:
+			case OpCode::Constant_Negated:
+				ok = add(OpCode::Constant, constants[m_chunk.At(offset + 1)], line)
+					&& add(Chunk::Unfused(instruction), Value(), line);
+				break;
+
+			case OpCode::End:
+				return add(OpCode::End, Value(), line);
+
+			default:
+				ok = add(instruction, Value(), line);
+				break;
+			}
+
+			if (!ok)
+				return false;
+
+			offset += Chunk::InstructionSize(instruction);
+		}
+
+		return add(OpCode::End, Value(), m_block.code.empty() ? 0 : m_block.code.back().line);
+	}
+
+	bool Optimizer::IsConstant(Id value) const {
+
+		return m_block.code[value].opcode == OpCode::Constant;
+	}
+
+	// Folds the way the parser does, see Parser::Fold, but only operands of
+	// the types the opcode was emitted for: the unchecked opcodes read other
+	// values differently than the folding would.
+	void Optimizer::Propagate() {
+
+		for (Instruction& instruction : m_block.code) {
+
+			if (instruction.opcode == OpCode::Constant || instruction.opcode == OpCode::Pop
+				|| instruction.opcode == OpCode::End)
+				continue;
+
+			bool constants = true;
+			bool typed = true;
+			for (Id operand : instruction.operands) {
+				const Value& value = m_block.code[operand].constant;
+				constants = constants && IsConstant(operand);
+				if (IsNumberOpcode(instruction.opcode))
+					typed = typed && value.IsNumber();
+				if (IsIntegerOpcode(instruction.opcode))
+					typed = typed && value.IsInteger();
+			}
+
+			if (!constants || !typed)
+				continue;
+
+			std::optional<Value> value;
+			if (instruction.operands.size() == 2)
+				value = Analysis::Parser::Fold(instruction.opcode,
+					m_block.code[instruction.operands[0]].constant, m_block.code[instruction.operands[1]].constant);
+			else {
+				const Value& operand = m_block.code[instruction.operands[0]].constant;
+				if (instruction.opcode == OpCode::Integer_Negate)
+					value = Value::Integer(Integer::Negate(operand.AsInteger()));
+				else if (operand.IsNumeric())
+					value = Value(-operand.ToNumber());
+			}
+
+			if (!value)
+				continue;
+
+			instruction.opcode = OpCode::Constant;
+			instruction.operands.clear();
+			instruction.constant = *value;
+			m_folded++;
+		}
+	}
+
+	// Every instruction that may raise and is left on constants after
+	// propagation raises: the program stops there.
+	void Optimizer::Truncate() {
+
+		for (std::size_t i = 0; i + 1 < m_block.code.size(); i++) {
+
+			const Instruction& instruction = m_block.code[i];
+			if (!MayRaise(instruction))
+				continue;
+
+			bool constants = true;
+			for (Id operand : instruction.operands)
+				constants = constants && IsConstant(operand);
+
+			if (constants) {
+				Instruction end = std::move(m_block.code.back());
+				end.operands.clear();
+				m_block.code.resize(i + 1);
+				m_block.code.push_back(std::move(end));
+				return;
+			}
+		}
+	}
+
+	// Uses follow definitions, so one backward pass finds every live value.
+	void Optimizer::Eliminate() {
+
+		for (std::size_t i = m_block.code.size(); i-- > 0;) {
+
+			Instruction& instruction = m_block.code[i];
+			if (instruction.opcode == OpCode::End || MayRaise(instruction))
+				instruction.live = true;
+
+			if (instruction.live)
+				for (Id operand : instruction.operands)
+					m_block.code[operand].live = true;
+		}
+	}
+
+	// The live operands of a dead instruction are on top of the stack where
+	// it was, since every value is used once, so they are popped there.
+	// Fails when folding added more constants than Constant_Long can name.
+	bool Optimizer::Lower() {
+
+		std::size_t before = m_chunk.InstructionCount();
+		Chunk out(m_chunk.Constants());
+
+		for (const Instruction& instruction : m_block.code) {
+
+			out.SetLine(instruction.line);
+
+			if (instruction.opcode == OpCode::End) {
+				out.Write8(OpCode::End);
+				break;
+			}
+
+			if (!instruction.live) {
+				for (Id operand : instruction.operands)
+					if (m_block.code[operand].live)
+						out.Write8(OpCode::Pop);
+				continue;
+			}
+
+			if (instruction.opcode == OpCode::Constant) {
+				if (out.AddConstant(instruction.constant) > UINT16_MAX)
+					return false;
+				out.WriteConstantAuto(instruction.constant);
+			}
+			else
+				out.Write8(instruction.opcode);
+		}
+
+		m_chunk = std::move(out);
+		m_eliminated = before - std::min(before, m_chunk.InstructionCount());
+		return true;
+	}
+
+	bool Optimizer::MayRaise(const Instruction& instruction) {
+
+		switch (instruction.opcode) {
+		case OpCode::Negate:
+		case OpCode::Add:
+		case OpCode::Substract:
+		case OpCode::Multiply:
+		case OpCode::Divide:
+		case OpCode::Less:
+		case OpCode::Less_Equal:
+		case OpCode::Greater:
+		case OpCode::Greater_Equal:
+		case OpCode::Integer_Divide:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+}
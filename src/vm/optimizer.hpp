@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "vm/chunk.hpp"
+
+namespace VM {
+
+// Optimization levels of Compiler. O0 emits the code as parsed, O1 folds
+// constants while parsing and runs Peephole, O2 also runs Optimizer.
+enum class Optimization : Byte {
+	O0 = 0,
+	O1,
+	O2
+};
+
+// Middle end over an SSA form of a chunk's stack code. The parser emits
+// postfix code, which is its parse tree, so the stack is simulated to
+// name every value by the instruction defining it; each value is then used
+// at most once. The code has no jumps, so the function is a single basic
+// block. The passes are:
+//
+//   constant propagation  folds instructions on constants the way the
+//                         parser does, across statement boundaries too
+//   unreachable code      drops everything after an instruction that
+//                         always raises a runtime error
+//   dead code             drops values nothing observes, keeping the
+//                         instructions that may raise and their operands
+//
+// Lowering walks the block in order and emits the live instructions; a
+// dead instruction becomes a Pop of each of its live operands. Without
+// loops or variables every pure value is a constant after propagation, so
+// common subexpressions and loop invariants are left to when the language
+// has them.
+class Optimizer {
+
+public:
+	// Rewrites the chunk in place. Returns false, leaving it unchanged, when
+	// it holds code other than stack arithmetic.
+	bool Optimize();
+	// Instructions folded into constants and instructions removed by the
+	// last Optimize().
+	inline std::size_t Folded() const { return m_folded; }
+	inline std::size_t Eliminated() const { return m_eliminated; }
+
+public:
+	explicit Optimizer(Chunk& chunk);
+	Optimizer(const Optimizer&) = delete;
+	~Optimizer() = default;
+
+private:
+	using Id = std::uint32_t;
+
+	// Defines value 'its index in the block' unless it is a Pop or End.
+	struct Instruction {
+		Byte opcode;
+		std::vector<Id> operands;
+		Value constant;
+		std::uint32_t line;
+		bool live = false;
+	};
+
+	struct Block {
+		std::vector<Instruction> code;
+	};
+
+	bool Build();
+	void Propagate();
+	void Truncate();
+	void Eliminate();
+	bool Lower();
+	// Whether the instruction raises an error on some operands. The Integer_*
+	// and Number_* opcodes trust the type checker, except for division by
+	// zero.
+	static bool MayRaise(const Instruction& instruction);
+	bool IsConstant(Id value) const;
+
+private:
+	Chunk& m_chunk;
+	Block m_block;
+	std::size_t m_folded = 0;
+	std::size_t m_eliminated = 0;
+};
+
+}
@@ -0,0 +1,61 @@
+#include "vm/peephole.hpp"
+#include "vm/virtual_machine.hpp"
+
+namespace VM {
+
+	std::size_t Peephole::Optimize(Chunk& chunk) {
+
+		Chunk out(chunk.Constants());
+		std::size_t fused = 0;
+
+		for (std::size_t offset = 0; offset < chunk.Size();) {
+
+			Byte instruction = chunk.At(offset);
+			std::size_t size = Chunk::InstructionSize(instruction);
+			std::size_t next = offset + size;
+			out.SetLine(chunk.Line(offset));
+
+			if (instruction == OpCode::Constant && next < chunk.Size()) {
+				if (Byte superinstruction = Fuse(chunk.At(next))) {
+					out.Write16(superinstruction, chunk.At(offset + 1));
+					offset = next + 1;
+					fused++;
+					continue;
+				}
+			}
+
+			for (std::size_t i = offset; i < next; i++)
+				out.Write8(chunk.At(i));
+			offset = next;
+		}
+
+		if (fused > 0)
+			chunk = std::move(out);
+
+		return fused;
+	}
+
+	Byte Peephole::Fuse(Byte opcode) {
+
+		switch (opcode) {
+		case OpCode::Add:
+		case OpCode::Number_Add:
+			return OpCode::Add_Constant;
+		case OpCode::Substract:
+		case OpCode::Number_Substract:
+			return OpCode::Substract_Constant;
+		case OpCode::Multiply:
+		case OpCode::Number_Multiply:
+			return OpCode::Multiply_Constant;
+		case OpCode::Divide:
+		case OpCode::Number_Divide:
+			return OpCode::Divide_Constant;
+		case OpCode::Negate:
+		case OpCode::Number_Negate:
+			return OpCode::Constant_Negated;
+		default:
+			return 0;
+		}
+	}
+
+}
@@ -0,0 +1,242 @@
+#include "vm/register_compiler.hpp"
+#include "vm/virtual_machine.hpp"
+
+#include <algorithm>
+
+namespace VM {
+
+	RegisterCompiler::RegisterCompiler(const Chunk& source, Chunk& target)
+		: m_source(source), m_target(target) { }
+
+	bool RegisterCompiler::Compile() {
+
+		m_target = Chunk(m_source.Constants());
+		m_slots.clear();
+		m_registers = 0;
+		m_results = 0;
+
+		for (std::size_t offset = 0; offset < m_source.Size();) {
+
+			Byte instruction = Chunk::Unquickened(m_source.At(offset));
+			m_target.SetLine(m_source.Line(offset));
+
+			switch (instruction) {
+
+			case OpCode::Constant:
+				m_slots.push_back({ true, m_source.At(offset + 1) });
+				break;
+
+			case OpCode::Constant_Long:
+				m_slots.push_back({ true, (std::size_t(m_source.At(offset + 1)) << 8) | m_source.At(offset + 2) });
+				break;
+
+			case OpCode::Pop:
+				if (m_slots.empty())
+					return false;
+				m_slots.pop_back();
+				break;
+
+			case OpCode::Negate:
+			case OpCode::Add:
+			case OpCode::Substract:
+			case OpCode::Multiply:
+			case OpCode::Divide:
+			case OpCode::Integer_Negate:
+			case OpCode::Integer_Add:
+			case OpCode::Integer_Substract:
+			case OpCode::Integer_Multiply:
+			case OpCode::Integer_Divide:
+			case OpCode::Number_Negate:
+			case OpCode::Number_Add:
+			case OpCode::Number_Substract:
+			case OpCode::Number_Multiply:
+			case OpCode::Number_Divide:
+			case OpCode::Equal:
+			case OpCode::Not_Equal:
+			case OpCode::Less:
+			case OpCode::Less_Equal:
+			case OpCode::Greater:
+			case OpCode::Greater_Equal:
+			case OpCode::Integer_Equal:
+			case OpCode::Integer_Not_Equal:
+			case OpCode::Integer_Less:
+			case OpCode::Integer_Less_Equal:
+			case OpCode::Integer_Greater:
+			case OpCode::Integer_Greater_Equal:
+			case OpCode::Number_Equal:
+			case OpCode::Number_Not_Equal:
+			case OpCode::Number_Less:
+			case OpCode::Number_Less_Equal:
+			case OpCode::Number_Greater:
+			case OpCode::Number_Greater_Equal:
+				if (!Apply(instruction))
+					return false;
+				break;
+
+			case OpCode::Add_Constant:
+			case OpCode::Substract_Constant:
+			case OpCode::Multiply_Constant:
+			case OpCode::Divide_Constant:
+			case OpCode::Constant_Negated:
+				m_slots.push_back({ true, m_source.At(offset + 1) });
+				if (!Apply(Chunk::Unfused(instruction)))
+					return false;
+				break;
+
+			case OpCode::End:
+				return Finish();
+
+			default:
+				return false;
+			}
+
+			offset += Chunk::InstructionSize(instruction);
+		}
+
+		return Finish();
+	}
+
+	// The Number_* opcodes and the typed comparisons give the generic
+	// instruction's result on the operands the type checker proved. The
+	// Integer_* arithmetic wraps and truncates, so it has its own forms.
+	bool RegisterCompiler::Apply(Byte opcode) {
+
+		switch (opcode) {
+		case OpCode::Negate:
+		case OpCode::Number_Negate:
+			return Negate(OpCode::Register_Negate);
+		case OpCode::Add:
+		case OpCode::Number_Add:
+			return Binary(OpCode::Register_Add);
+		case OpCode::Substract:
+		case OpCode::Number_Substract:
+			return Binary(OpCode::Register_Substract);
+		case OpCode::Multiply:
+		case OpCode::Number_Multiply:
+			return Binary(OpCode::Register_Multiply);
+		case OpCode::Divide:
+		case OpCode::Number_Divide:
+			return Binary(OpCode::Register_Divide);
+		case OpCode::Integer_Negate:
+			return Negate(OpCode::Register_Integer_Negate);
+		case OpCode::Integer_Add:
+			return Binary(OpCode::Register_Integer_Add);
+		case OpCode::Integer_Substract:
+			return Binary(OpCode::Register_Integer_Substract);
+		case OpCode::Integer_Multiply:
+			return Binary(OpCode::Register_Integer_Multiply);
+		case OpCode::Integer_Divide:
+			return Binary(OpCode::Register_Integer_Divide);
+		case OpCode::Equal:
+		case OpCode::Integer_Equal:
+		case OpCode::Number_Equal:
+			return Binary(OpCode::Register_Equal);
+		case OpCode::Not_Equal:
+		case OpCode::Integer_Not_Equal:
+		case OpCode::Number_Not_Equal:
+			return Binary(OpCode::Register_Not_Equal);
+		case OpCode::Less:
+		case OpCode::Integer_Less:
+		case OpCode::Number_Less:
+			return Binary(OpCode::Register_Less);
+		case OpCode::Less_Equal:
+		case OpCode::Integer_Less_Equal:
+		case OpCode::Number_Less_Equal:
+			return Binary(OpCode::Register_Less_Equal);
+		case OpCode::Greater:
+		case OpCode::Integer_Greater:
+		case OpCode::Number_Greater:
+			return Binary(OpCode::Register_Greater);
+		case OpCode::Greater_Equal:
+		case OpCode::Integer_Greater_Equal:
+		case OpCode::Number_Greater_Equal:
+			return Binary(OpCode::Register_Greater_Equal);
+		default:
+			return false;
+		}
+	}
+
+	// Values still on the stack at End are left in their registers, the
+	// bottom of the operand stack, where the stack engine leaves them.
+	bool RegisterCompiler::Finish() {
+
+		for (std::size_t position = 0; position < m_slots.size(); position++) {
+			if (!m_slots[position].constant)
+				continue;
+			if (!Claim(position))
+				return false;
+			Load(position);
+		}
+
+		m_results = m_slots.size();
+		m_target.Write8(OpCode::End);
+		return true;
+	}
+
+	bool RegisterCompiler::Claim(std::size_t position) {
+
+		if (position >= RegisterCount)
+			return false;
+
+		m_registers = std::max(m_registers, position + 1);
+		return true;
+	}
+
+	Byte RegisterCompiler::Operand(std::size_t position) {
+
+		Slot& slot = m_slots[position];
+
+		if (!slot.constant)
+			return static_cast<Byte>(slot.index);
+
+		if (slot.index < RegisterCount)
+			return static_cast<Byte>(RegisterConstantBit | slot.index);
+
+		Load(position);
+		return static_cast<Byte>(position);
+	}
+
+	void RegisterCompiler::Load(std::size_t position) {
+
+		Slot& slot = m_slots[position];
+		m_target.Write8(OpCode::Register_Load);
+		m_target.Write8(static_cast<Byte>(position));
+		m_target.Write16((slot.index >> 8) & 0xFF, slot.index & 0xFF);
+		slot = { false, position };
+	}
+
+	bool RegisterCompiler::Negate(Byte opcode) {
+
+		if (m_slots.empty())
+			return false;
+
+		std::size_t position = m_slots.size() - 1;
+		if (!Claim(position))
+			return false;
+
+		Byte operand = Operand(position);
+		m_target.Write16(opcode, static_cast<Byte>(position));
+		m_target.Write8(operand);
+		m_slots[position] = { false, position };
+		return true;
+	}
+
+	bool RegisterCompiler::Binary(Byte opcode) {
+
+		if (m_slots.size() < 2)
+			return false;
+
+		std::size_t position = m_slots.size() - 2;
+		if (!Claim(position + 1))
+			return false;
+
+		Byte left = Operand(position);
+		Byte right = Operand(position + 1);
+		m_target.Write16(opcode, static_cast<Byte>(position));
+		m_target.Write16(left, right);
+		m_slots.pop_back();
+		m_slots[position] = { false, position };
+		return true;
+	}
+
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <vector>
+#include "vm/chunk.hpp"
+
+namespace VM {
+
+// Translates the stack bytecode of a chunk into three-address register
+// bytecode for RVM's register engine. Stack slot n becomes register n, and
+// constants stay operands instead of being pushed, so 'Constant, Constant,
+// Add' becomes a single 'Add r0 k0 k1' and Pop emits nothing. The target
+// shares the source's constant table and keeps its line numbers, so both
+// engines use the same disassembler and line mapping. Every instruction the
+// compilers emit has a register form.
+class RegisterCompiler {
+
+public:
+	// Returns false when the source is malformed or needs more than
+	// RegisterCount registers.
+	bool Compile();
+	// Registers used by the compiled code, i.e. the frame size.
+	inline std::size_t Registers() const { return m_registers; }
+	// Values left on the stack at End, in registers 0 to Results() - 1.
+	inline std::size_t Results() const { return m_results; }
+
+public:
+	RegisterCompiler(const Chunk& source, Chunk& target);
+	RegisterCompiler(const RegisterCompiler&) = delete;
+	~RegisterCompiler() = default;
+
+private:
+	// A value on the simulated stack: a register or a constant not yet
+	// loaded into one.
+	struct Slot {
+		bool constant;
+		std::size_t index;
+	};
+
+	// Returns the operand byte naming the slot at position, loading a
+	// constant into that position's register when its index does not fit.
+	Byte Operand(std::size_t position);
+	// Emits Register_Load of the constant slot at position into its register.
+	void Load(std::size_t position);
+	// Translates a stack arithmetic or comparison opcode applied to the
+	// simulated stack.
+	bool Apply(Byte opcode);
+	bool Binary(Byte opcode);
+	bool Negate(Byte opcode);
+	bool Claim(std::size_t position);
+	// Loads the constants left on the stack and writes End.
+	bool Finish();
+
+private:
+	const Chunk& m_source;
+	Chunk& m_target;
+	std::vector<Slot> m_slots;
+	std::size_t m_registers = 0;
+	std::size_t m_results = 0;
+};
+
+}
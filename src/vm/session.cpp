@@ -0,0 +1,332 @@
+#include "vm/session.hpp"
+#include "analysis/parser.hpp"
+#include "vm/peephole.hpp"
+
+#include <algorithm>
+#include <exception>
+
+namespace VM {
+
+	using Analysis::Token;
+
+	void Session::Span::Append(const Span& next) {
+
+		count += next.count;
+		bytes += next.bytes;
+		trail = next.lines > 0 ? next.trail : trail + next.trail;
+		lines += next.lines;
+		failed += next.failed;
+	}
+
+	Session::Session()
+		: m_random(0x5eed) {
+
+		Load({});
+	}
+
+	InterpreteResult Session::Load(std::string_view text) {
+
+		m_constants = std::make_shared<Memory>();
+
+		Tree none;
+		std::vector<Declaration> declarations = Relex(std::string(text), 0, 0, none);
+		m_recompiled = declarations.size();
+		m_root = Build(std::move(declarations), 0);
+
+		m_loaded_constants = m_constants->Size();
+		m_linked = false;
+		return m_root->total.failed > 0 ? InterpreteResult::COMPILE_ERROR : InterpreteResult::OK;
+	}
+
+	InterpreteResult Session::Edit(std::size_t offset, std::size_t length, std::string_view text) {
+
+		std::size_t size = Size();
+		offset = std::min(offset, size);
+		length = std::min(length, size - offset);
+
+		// Take out the declarations the edit overlaps, the one it starts in
+		// when it only inserts.
+		Span first = Find(offset);
+		Span last = length > 0 ? Find(offset + length - 1) : first;
+
+		auto [left, rest] = Split(std::move(m_root), first.count);
+		auto [middle, right] = Split(std::move(rest), last.count - first.count + 1);
+
+		std::string local;
+		local.reserve(middle->total.bytes + text.size());
+		Visit(middle.get(), [&local](const Declaration& declaration) { local += declaration.text; });
+		local.replace(offset - first.bytes, length, text);
+		middle.reset();
+
+		std::vector<Declaration> declarations = Relex(std::move(local), first.lines, first.trail, right);
+		m_recompiled = declarations.size();
+		m_root = Merge(Merge(std::move(left), Build(std::move(declarations), first.lines)), std::move(right));
+		m_linked = false;
+
+		// Constants of replaced fragments stay in the table. It is rebuilt
+		// once they make up half of it, or it nears the reach of
+		// Constant_Long, so the rebuilds cost a constant per edit on average.
+		std::size_t constants = m_constants->Size();
+		if (constants > 2 * m_loaded_constants + 1024 || constants > UINT16_MAX - UINT16_MAX / 4)
+			return Load(Text());
+
+		return m_root->total.failed > 0 ? InterpreteResult::COMPILE_ERROR : InterpreteResult::OK;
+	}
+
+	InterpreteResult Session::Run() {
+
+		GetChunk();
+		RVM vm(m_chunk);
+		return vm.Run();
+	}
+
+	const Chunk& Session::GetChunk() {
+
+		if (m_linked)
+			return m_chunk;
+
+		// The fragments share m_constants, so appending them copies the code.
+		m_chunk = Chunk(m_constants);
+		std::size_t line = 0;
+
+		Visit(m_root.get(), [this, &line](const Declaration& declaration) {
+			if (!declaration.failed)
+				m_chunk.Append(declaration.code, std::int64_t(line) - std::int64_t(declaration.line));
+			line += declaration.span.lines;
+		});
+
+		m_chunk.Write8(OpCode::End);
+		m_linked = true;
+		return m_chunk;
+	}
+
+	std::string Session::Text() const {
+
+		std::string text;
+		text.reserve(Size());
+		Visit(m_root.get(), [&text](const Declaration& declaration) { text += declaration.text; });
+		return text;
+	}
+
+	std::size_t Session::Size() const {
+
+		return m_root->total.bytes;
+	}
+
+	std::size_t Session::Declarations() const {
+
+		return m_root->total.count;
+	}
+
+	std::size_t Session::Recompiled() const {
+
+		return m_recompiled;
+	}
+
+	Session::Span Session::Measure(std::string_view text) {
+
+		Span span;
+		span.count = 1;
+		span.bytes = text.size();
+		span.lines = std::count(text.begin(), text.end(), '\n');
+
+		std::size_t newline = text.rfind('\n');
+		span.trail = newline == std::string_view::npos ? text.size() : text.size() - newline - 1;
+		return span;
+	}
+
+	void Session::Update(Node& node) {
+
+		Span total;
+		if (node.left)
+			total = node.left->total;
+		total.Append(node.declaration.span);
+		if (node.right)
+			total.Append(node.right->total);
+		node.total = total;
+	}
+
+	Session::Tree Session::Merge(Tree left, Tree right) {
+
+		if (!left)
+			return right;
+		if (!right)
+			return left;
+
+		if (left->priority > right->priority) {
+			left->right = Merge(std::move(left->right), std::move(right));
+			Update(*left);
+			return left;
+		}
+
+		right->left = Merge(std::move(left), std::move(right->left));
+		Update(*right);
+		return right;
+	}
+
+	std::pair<Session::Tree, Session::Tree> Session::Split(Tree tree, std::size_t count) {
+
+		if (!tree)
+			return {};
+
+		std::size_t before = tree->left ? tree->left->total.count : 0;
+
+		if (count <= before) {
+			auto [left, right] = Split(std::move(tree->left), count);
+			tree->left = std::move(right);
+			Update(*tree);
+			return { std::move(left), std::move(tree) };
+		}
+
+		auto [left, right] = Split(std::move(tree->right), count - before - 1);
+		tree->right = std::move(left);
+		Update(*tree);
+		return { std::move(tree), std::move(right) };
+	}
+
+	template<typename Function>
+	void Session::Visit(const Node* node, Function&& function) {
+
+		if (!node)
+			return;
+
+		Visit(node->left.get(), function);
+		function(node->declaration);
+		Visit(node->right.get(), function);
+	}
+
+	Session::Span Session::Find(std::size_t offset) const {
+
+		Span before;
+		const Node* node = m_root.get();
+
+		while (node) {
+
+			if (node->left && offset < before.bytes + node->left->total.bytes) {
+				node = node->left.get();
+				continue;
+			}
+
+			if (node->left)
+				before.Append(node->left->total);
+
+			if (offset < before.bytes + node->declaration.span.bytes || !node->right)
+				break;
+
+			before.Append(node->declaration.span);
+			node = node->right.get();
+		}
+
+		return before;
+	}
+
+	std::vector<Session::Declaration> Session::Relex(std::string text, std::size_t line, std::size_t col, Tree& rest) {
+
+		std::vector<Declaration> declarations;
+		std::size_t start = 0;
+
+		for (std::size_t batch = 1;; batch *= 2) {
+
+			Analysis::Lexer lexer(text);
+			lexer.Seek(start, line, col);
+			Declaration current;
+
+			for (;;) {
+
+				std::size_t errors = lexer.Errors();
+				Token tk = lexer.PeekNextToken();
+				if (lexer.Errors() > errors)
+					current.malformed = true;
+				if (tk.KindType == Token::Kind::TkEOF)
+					break;
+
+				std::size_t end = tk.Offset + tk.Length;
+				std::size_t end_line = tk.Line;
+				std::size_t end_col = tk.Col;
+
+				tk.Offset = static_cast<std::uint32_t>(tk.Offset - start);
+				tk.Line = static_cast<std::uint32_t>(tk.Line - line);
+				current.tokens.push_back(tk);
+
+				if (tk.KindType != Token::Kind::Semicolon)
+					continue;
+
+				current.text = text.substr(start, end - start);
+				current.span = Measure(current.text);
+				declarations.push_back(std::move(current));
+				current = Declaration();
+
+				start = end;
+				line = end_line;
+				col = end_col;
+			}
+
+			if (!rest) {
+				current.text = text.substr(start);
+				current.span = Measure(current.text);
+				declarations.push_back(std::move(current));
+				return declarations;
+			}
+
+			// Ended on a ';', so what follows lexes as it did.
+			if (start == text.size())
+				return declarations;
+
+			// The edit swallowed the next ';' (an opened comment or string):
+			// take in the following declarations, twice as many each round.
+			auto [taken, remaining] = Split(std::move(rest), batch);
+			Visit(taken.get(), [&text](const Declaration& declaration) { text += declaration.text; });
+			rest = std::move(remaining);
+		}
+	}
+
+	void Session::Compile(Declaration& declaration, std::size_t line) {
+
+		declaration.line = line;
+		declaration.code = Chunk(m_constants);
+		declaration.failed = declaration.malformed;
+
+		if (!declaration.tokens.empty()) {
+
+			// Diagnostics and the fragment's lines use absolute lines.
+			std::vector<Token> tokens = declaration.tokens;
+			for (Token& tk : tokens)
+				tk.Line = static_cast<std::uint32_t>(tk.Line + line);
+
+			Analysis::Lexer lexer(declaration.text);
+
+			try {
+				Analysis::Parser parser(declaration.code, lexer, tokens.data(), tokens.data() + tokens.size());
+				parser.Declaration();
+
+				if (!parser.IsAtEnd())
+					throw parser.Report("Expect ';' after expression.");
+
+				Peephole::Optimize(declaration.code);
+			}
+			catch (const std::exception&) {
+				declaration.failed = true;
+			}
+		}
+
+		declaration.span.failed = declaration.failed ? 1 : 0;
+	}
+
+	Session::Tree Session::Build(std::vector<Declaration> declarations, std::size_t line) {
+
+		Tree tree;
+
+		for (Declaration& declaration : declarations) {
+
+			Compile(declaration, line);
+			line += declaration.span.lines;
+
+			Tree node = std::make_unique<Node>(Node{ std::move(declaration), static_cast<std::uint32_t>(m_random()) });
+			Update(*node);
+			tree = Merge(std::move(tree), std::move(node));
+		}
+
+		return tree;
+	}
+
+}
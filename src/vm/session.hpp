@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "analysis/lexer.hpp"
+#include "vm/chunk.hpp"
+#include "vm/virtual_machine.hpp"
+
+namespace VM {
+
+// Editable compilation unit for the REPL and editor tooling.
+//
+// The text is held as a sequence of top-level declarations (expression
+// statements ended by ';'), each with its own text, tokens and compiled
+// fragment. A ';' leaves the lexer in its initial state, so declarations
+// lex independently: an edit re-lexes the declarations it touches, plus the
+// following ones only while the edit swallowed their ';' (e.g. an opened
+// comment), and only those are parsed and compiled again. Tokens keep
+// offsets and lines relative to their declaration, so nothing after the
+// edit is shifted.
+//
+// The declarations are the nodes of a treap ordered by position, whose
+// subtree totals (bytes, lines, failed fragments) locate an offset and
+// splice the re-lexed declarations in O(log n). Fragments are compiled
+// against one constant table and run through Peephole on their own, so
+// linking them into the program is a copy; it happens on the first
+// GetChunk() or Run() after an edit. An edit therefore costs the size of
+// the declarations it touches, whatever the size of the file.
+class Session {
+
+public:
+	InterpreteResult Load(std::string_view text);
+	// Replaces length bytes at offset with text. Returns COMPILE_ERROR while
+	// any declaration of the new text fails to compile.
+	InterpreteResult Edit(std::size_t offset, std::size_t length, std::string_view text);
+	InterpreteResult Run();
+	// The program, linked from the fragments if an edit changed them.
+	const Chunk& GetChunk();
+	std::string Text() const;
+	std::size_t Size() const;
+	std::size_t Declarations() const;
+	// Number of declarations compiled by the last Load()/Edit().
+	std::size_t Recompiled() const;
+
+public:
+	Session();
+	Session(const Session&) = delete;
+	Session(Session&&) = default;
+	~Session() = default;
+
+private:
+	// Totals over a run of declarations. trail is the number of bytes after
+	// the last newline, the column where the run ends when lines > 0 and
+	// the run's own width otherwise.
+	struct Span {
+		std::size_t count = 0;
+		std::size_t bytes = 0;
+		std::size_t lines = 0;
+		std::size_t trail = 0;
+		std::size_t failed = 0;
+
+		void Append(const Span& next);
+	};
+
+	struct Declaration {
+		// From the end of the previous declaration through its ';'. The last
+		// declaration holds what follows the last ';' and may be empty.
+		std::string text;
+		// Offsets relative to text, lines relative to its first line.
+		std::vector<Analysis::Token> tokens;
+		// The lexer reported an error in text, which fails the declaration
+		// as Compiler::Compile fails a program.
+		bool malformed = false;
+		// Line of its first line when the fragment was compiled; fragments
+		// are shifted to the current line when linked.
+		std::size_t line = 0;
+		bool failed = false;
+		Chunk code;
+		// Its own totals; failed is set by Compile.
+		Span span;
+	};
+
+	struct Node;
+	using Tree = std::unique_ptr<Node>;
+
+	struct Node {
+		Declaration declaration;
+		std::uint32_t priority = 0;
+		Tree left = nullptr;
+		Tree right = nullptr;
+		Span total = {};
+	};
+
+	static Span Measure(std::string_view text);
+	static void Update(Node& node);
+	static Tree Merge(Tree left, Tree right);
+	// The first count declarations of tree, and the others.
+	static std::pair<Tree, Tree> Split(Tree tree, std::size_t count);
+	template<typename Function>
+	static void Visit(const Node* node, Function&& function);
+	// The declarations before the one holding offset; an offset of Size()
+	// is in the last one.
+	Span Find(std::size_t offset) const;
+	// Lexes text, which starts at line and col, into declarations. While it
+	// does not end on a ';' the declarations at the front of rest are taken
+	// into it.
+	std::vector<Declaration> Relex(std::string text, std::size_t line, std::size_t col, Tree& rest);
+	void Compile(Declaration& declaration, std::size_t line);
+	Tree Build(std::vector<Declaration> declarations, std::size_t line);
+
+private:
+	Tree m_root;
+	Ref<Memory> m_constants;
+	// Size of the constant table after the last Load().
+	std::size_t m_loaded_constants = 0;
+	std::size_t m_recompiled = 0;
+	Chunk m_chunk;
+	bool m_linked = false;
+	std::minstd_rand m_random;
+
+};
+
+}
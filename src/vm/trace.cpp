@@ -0,0 +1,252 @@
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string_view>
+#include "vm/trace.hpp"
+
+#ifdef _WIN32
+#include <io.h>
+#define RAVI_WRITE _write
+#define RAVI_OPEN _open
+#define RAVI_CLOSE _close
+#define RAVI_OPEN_FLAGS (_O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY)
+#else
+#include <unistd.h>
+#define RAVI_WRITE ::write
+#define RAVI_OPEN ::open
+#define RAVI_CLOSE ::close
+#define RAVI_OPEN_FLAGS (O_WRONLY | O_CREAT | O_TRUNC)
+#endif
+
+namespace VM {
+
+	namespace {
+
+		// Dumps are native-endian and only meant to be decoded on the machine
+		// that wrote them.
+		struct TraceHeader {
+			char magic[4];
+			std::uint32_t version;
+			std::uint64_t count;
+			std::uint32_t capacity;
+			std::uint32_t record_size;
+			std::uint32_t optimization;
+			std::uint32_t flags;
+		};
+
+		// Set in TraceHeader::flags when the records hold the top of the
+		// stack.
+		constexpr std::uint32_t TraceTop = 1;
+
+		constexpr char TraceMagic[4] = { 'R', 'V', 'M', 'T' };
+		constexpr std::uint32_t TraceVersion = 3;
+
+		constexpr std::string_view OpcodeNames[OpCodeCount] = {
+			"Constant", "End", "Negate", "Add", "Substract", "Multiply", "Divide",
+			"Constant_Long", "Pop",
+			"Register_Load", "Register_Negate", "Register_Add", "Register_Substract",
+			"Register_Multiply", "Register_Divide",
+			"Add_Constant", "Substract_Constant", "Multiply_Constant", "Divide_Constant",
+			"Constant_Negated",
+			"Integer_Negate", "Integer_Add", "Integer_Substract", "Integer_Multiply", "Integer_Divide",
+			"Equal", "Not_Equal", "Less", "Less_Equal", "Greater", "Greater_Equal",
+			"Integer_Equal", "Integer_Not_Equal", "Integer_Less", "Integer_Less_Equal",
+			"Integer_Greater", "Integer_Greater_Equal",
+			"Number_Negate", "Number_Add", "Number_Substract", "Number_Multiply", "Number_Divide",
+			"Number_Equal", "Number_Not_Equal", "Number_Less", "Number_Less_Equal",
+			"Number_Greater", "Number_Greater_Equal",
+			"Negate_Integer", "Add_Integers", "Substract_Integers", "Multiply_Integers", "Divide_Integers",
+			"Equal_Integers", "Not_Equal_Integers", "Less_Integers", "Less_Equal_Integers",
+			"Greater_Integers", "Greater_Equal_Integers",
+			"Register_Integer_Negate", "Register_Integer_Add", "Register_Integer_Substract",
+			"Register_Integer_Multiply", "Register_Integer_Divide",
+			"Register_Equal", "Register_Not_Equal", "Register_Less", "Register_Less_Equal",
+			"Register_Greater", "Register_Greater_Equal",
+		};
+
+		bool WriteAll(int fd, const void* data, std::size_t size) {
+
+			const char* bytes = static_cast<const char*>(data);
+			while (size > 0) {
+				auto written = RAVI_WRITE(fd, bytes, static_cast<unsigned>(size));
+				if (written <= 0)
+					return false;
+				bytes += written;
+				size -= static_cast<std::size_t>(written);
+			}
+			return true;
+		}
+
+	}
+
+	BufferedTrace::BufferedTrace(std::ostream& out, std::size_t capacity)
+		: m_out(out), m_capacity(capacity) {
+
+		m_buffer.reserve(capacity);
+	}
+
+	BufferedTrace::BufferedTrace(BufferedTrace&& other) noexcept
+		: m_out(other.m_out), m_buffer(std::move(other.m_buffer)), m_capacity(other.m_capacity) {
+
+		other.m_buffer.clear();
+	}
+
+	BufferedTrace::~BufferedTrace() {
+
+		Flush();
+	}
+
+	void BufferedTrace::Instruction(const Chunk& chunk, std::size_t offset, Byte, const Value*, const Value*) {
+
+		chunk.Disassemble(offset, m_buffer);
+
+		if (m_buffer.size() >= m_capacity)
+			Flush();
+	}
+
+	void BufferedTrace::Flush() {
+
+		m_out.write(m_buffer.data(), m_buffer.size());
+		m_out.flush();
+		m_buffer.clear();
+	}
+
+	RingTrace::RingTrace(std::size_t capacity)
+		: m_records(std::bit_ceil(capacity < 1 ? std::size_t(1) : capacity)), m_mask(m_records.size() - 1) { }
+
+	void RingTrace::Clear() {
+
+		m_count = 0;
+	}
+
+	std::vector<TraceRecord> RingTrace::Records() const {
+
+		std::uint64_t count = m_count;
+		std::size_t size = count < m_records.size() ? std::size_t(count) : m_records.size();
+		std::size_t first = std::size_t(count - size) & m_mask;
+
+		std::vector<TraceRecord> records;
+		records.reserve(size);
+		for (std::size_t i = 0; i < size; i++)
+			records.push_back(m_records[(first + i) & m_mask]);
+		return records;
+	}
+
+	bool RingTrace::Dump(int fd) const {
+
+		// One snapshot of the count, which a running writer keeps advancing.
+		std::uint64_t count = m_count;
+
+		TraceHeader header;
+		std::memcpy(header.magic, TraceMagic, sizeof(header.magic));
+		header.version = TraceVersion;
+		header.count = count;
+		header.capacity = static_cast<std::uint32_t>(m_records.size());
+		header.record_size = sizeof(TraceRecord);
+		header.optimization = static_cast<std::uint32_t>(m_optimization);
+		header.flags = m_top ? TraceTop : 0;
+
+		// The ring is written oldest first: the tail after the write cursor,
+		// then the head up to it.
+		std::size_t size = count < m_records.size() ? std::size_t(count) : m_records.size();
+		std::size_t first = std::size_t(count - size) & m_mask;
+		std::size_t tail = std::min(size, m_records.size() - first);
+
+		return WriteAll(fd, &header, sizeof(header))
+			&& WriteAll(fd, m_records.data() + first, tail * sizeof(TraceRecord))
+			&& WriteAll(fd, m_records.data(), (size - tail) * sizeof(TraceRecord));
+	}
+
+	bool RingTrace::Dump(const char* path) const {
+
+		int fd = RAVI_OPEN(path, RAVI_OPEN_FLAGS, 0644);
+		if (fd < 0)
+			return false;
+
+		bool ok = Dump(fd);
+		return RAVI_CLOSE(fd) == 0 && ok;
+	}
+
+	std::vector<TraceRecord> RingTrace::Load(const std::string& path, std::uint64_t* count, Optimization* level, bool* top) {
+
+		std::FILE* file = std::fopen(path.c_str(), "rb");
+		if (!file)
+			throw std::runtime_error("Cannot open '" + path + "'");
+
+		TraceHeader header;
+		if (std::fread(&header, sizeof(header), 1, file) != 1
+			|| std::memcmp(header.magic, TraceMagic, sizeof(header.magic)) != 0
+			|| header.version != TraceVersion
+			|| header.record_size != sizeof(TraceRecord)
+			|| header.optimization > static_cast<std::uint32_t>(Optimization::O2)) {
+			std::fclose(file);
+			throw std::runtime_error("'" + path + "' is not an RVM trace");
+		}
+
+		std::size_t size = header.count < header.capacity ? std::size_t(header.count) : header.capacity;
+		std::vector<TraceRecord> records(size);
+		std::size_t read = std::fread(records.data(), sizeof(TraceRecord), size, file);
+		std::fclose(file);
+
+		if (read != size)
+			throw std::runtime_error("'" + path + "' is truncated");
+
+		if (count)
+			*count = header.count;
+		if (level)
+			*level = Optimization(header.optimization);
+		if (top)
+			*top = (header.flags & TraceTop) != 0;
+		return records;
+	}
+
+	OpcodeProfile::OpcodeProfile()
+		: m_pairs(Width * Width), m_triples(Width * Width * Width) { }
+
+	OpcodeProfile::Counter::Counter(OpcodeProfile& profile)
+		: m_pairs(profile.m_pairs.data()), m_triples(profile.m_triples.data()),
+		  m_previous(None), m_before(None) { }
+
+	OpcodeProfile::Counter OpcodeProfile::Record() {
+
+		return Counter(*this);
+	}
+
+	void OpcodeProfile::Report(std::ostream& out, std::size_t limit) const {
+
+		// Sequences that include the "no instruction" slot only mark the
+		// start of a run and are left out.
+		auto print = [&out, limit](const char* title, const std::vector<std::uint64_t>& counts, std::size_t length) {
+
+			std::vector<std::size_t> order;
+			for (std::size_t i = 0; i < counts.size(); i++) {
+				bool complete = true;
+				for (std::size_t rest = i, n = 0; n < length; n++, rest /= Width)
+					complete = complete && rest % Width != None;
+				if (complete && counts[i] > 0)
+					order.push_back(i);
+			}
+
+			std::size_t shown = std::min(limit, order.size());
+			std::partial_sort(order.begin(), order.begin() + shown, order.end(),
+				[&counts](std::size_t a, std::size_t b) { return counts[a] > counts[b]; });
+
+			out << title << ":\n";
+			for (std::size_t i = 0; i < shown; i++) {
+
+				std::string sequence;
+				for (std::size_t rest = order[i], n = 0; n < length; n++, rest /= Width)
+					sequence = std::string(OpcodeNames[rest % Width]) + (n ? " " : "") + sequence;
+
+				out << "  " << counts[order[i]] << "\t" << sequence << "\n";
+			}
+		};
+
+		print("opcode pairs", m_pairs, 2);
+		print("opcode triples", m_triples, 3);
+	}
+
+}
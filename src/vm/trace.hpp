@@ -0,0 +1,207 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include "vm/chunk.hpp"
+#include "vm/virtual_machine.hpp"
+
+namespace VM {
+
+// Tracing policies for RVM's interpreter loop. The loop is instantiated
+// once per policy and only calls into one when Enabled is true, so the
+// NoTrace build contains no tracing code at all. Policies are passed to the
+// loop by value, so cheap ones can live in registers for the whole run.
+// Instruction receives the offset of the instruction about to run, its
+// opcode as the loop decoded it, and the operand stack below it.
+
+struct NoTrace {
+
+	static constexpr bool Enabled = false;
+};
+
+// Disassembles every executed instruction into a buffer and writes it out
+// in large blocks instead of one stdio call per instruction.
+class BufferedTrace {
+
+public:
+	static constexpr bool Enabled = true;
+	static constexpr std::size_t DefaultCapacity = 64 * 1024;
+
+	void Instruction(const Chunk& chunk, std::size_t offset, Byte opcode, const Value* stack, const Value* top);
+	void Flush();
+
+public:
+	explicit BufferedTrace(std::ostream& out, std::size_t capacity = DefaultCapacity);
+	BufferedTrace(const BufferedTrace&) = delete;
+	BufferedTrace(BufferedTrace&& other) noexcept;
+	~BufferedTrace();
+
+private:
+	std::ostream& m_out;
+	std::string m_buffer;
+	std::size_t m_capacity;
+};
+
+// One executed instruction in the binary trace.
+struct TraceRecord {
+	std::uint32_t offset;
+	// Operand stack depth before the instruction, saturated at 0xFFFF.
+	std::uint16_t depth;
+	std::uint16_t opcode;
+	// The value on top of the stack; only meaningful when depth > 0 and the
+	// ring captured it.
+	Value top;
+};
+
+static_assert(sizeof(TraceRecord) == 16, "TraceRecord is part of the dump format");
+static_assert(std::endian::native == std::endian::little, "RingTrace::Writer stores the head of a record as one word");
+
+// Keeps the last Capacity() executed instructions in a fixed ring of
+// TraceRecords. Recording is a handful of stores, cheap enough to leave on;
+// the ring is dumped in a compact binary form and rendered offline by
+// ravi_trace_decode.
+class RingTrace {
+
+public:
+	// The tracing policy for a run. It keeps its own copy of the cursor so
+	// the loop never reloads it from memory, and publishes the count after
+	// every record so a dump taken from a signal handler is current; the
+	// signal fence keeps the compiler from publishing before the record is
+	// stored. With Top the record also holds the top of the stack, read
+	// without a branch: an empty stack reads its first slot instead, which
+	// the decoder ignores.
+	template<bool Top>
+	class Writer {
+
+	public:
+		static constexpr bool Enabled = true;
+
+		inline void Instruction(const Chunk&, std::size_t offset, Byte opcode, const Value* stack, const Value* top) {
+
+			// offset, depth and opcode go out as one store.
+			std::size_t depth = std::size_t(top - stack);
+			std::uint64_t head = static_cast<std::uint32_t>(offset)
+				| std::uint64_t(std::min<std::size_t>(depth, 0xFFFF)) << 32
+				| std::uint64_t(opcode) << 48;
+			TraceRecord* record = m_data + (m_count & m_mask);
+			std::memcpy(record, &head, sizeof(head));
+			if constexpr (Top)
+				record->top = top[-std::ptrdiff_t(depth != 0)];
+			std::atomic_signal_fence(std::memory_order_release);
+			*m_published = ++m_count;
+		}
+
+	private:
+		explicit Writer(RingTrace& ring)
+			: m_data(ring.m_records.data()), m_mask(ring.m_mask), m_count(ring.m_count), m_published(&ring.m_count) { }
+
+	private:
+		TraceRecord* m_data;
+		std::size_t m_mask;
+		std::uint64_t m_count;
+		volatile std::uint64_t* m_published;
+
+		friend class RingTrace;
+	};
+
+	static constexpr std::size_t DefaultCapacity = 1 << 16;
+
+	// Only one writer may be in use at a time. Top must match CapturesTop()
+	// for the dump to describe the records.
+	template<bool Top>
+	inline Writer<Top> Record() { return Writer<Top>(*this); }
+
+	// Capacity is rounded up to a power of two.
+	inline std::size_t Capacity() const { return m_records.size(); }
+	// Total number of instructions recorded since the last Clear.
+	inline std::uint64_t Count() const { return m_count; }
+	void Clear();
+	// The optimization level of the traced program, kept in the dump so it is
+	// decoded against the same code. RVM::Run sets it.
+	inline void SetOptimization(Optimization level) { m_optimization = level; }
+	inline Optimization GetOptimization() const { return m_optimization; }
+	// Also records the value on top of the stack; off by default, as it
+	// makes every record cost a load more.
+	inline void SetCaptureTop(bool enabled) { m_top = enabled; }
+	inline bool CapturesTop() const { return m_top; }
+	// Records in execution order, oldest first.
+	std::vector<TraceRecord> Records() const;
+
+	// Both overloads only use open/write/close and never allocate, so they
+	// may be called from a signal handler.
+	bool Dump(int fd) const;
+	bool Dump(const char* path) const;
+	// Reads a dump back; throws std::runtime_error on a malformed file.
+	static std::vector<TraceRecord> Load(const std::string& path, std::uint64_t* count = nullptr, Optimization* level = nullptr, bool* top = nullptr);
+
+public:
+	explicit RingTrace(std::size_t capacity = DefaultCapacity);
+	RingTrace(const RingTrace&) = delete;
+	~RingTrace() = default;
+
+private:
+	std::vector<TraceRecord> m_records;
+	std::size_t m_mask = 0;
+	volatile std::uint64_t m_count = 0;
+	Optimization m_optimization = Optimization::O1;
+	bool m_top = false;
+};
+
+// Counts executed opcode pairs and triples across runs, to choose
+// superinstructions from real workloads rather than guesses.
+class OpcodeProfile {
+
+public:
+	class Counter {
+
+	public:
+		static constexpr bool Enabled = true;
+
+		inline void Instruction(const Chunk&, std::size_t, Byte instruction, const Value*, const Value*) {
+
+			std::size_t opcode = instruction;
+			m_pairs[m_previous * Width + opcode]++;
+			m_triples[(m_before * Width + m_previous) * Width + opcode]++;
+			m_before = m_previous;
+			m_previous = opcode;
+		}
+
+	private:
+		explicit Counter(OpcodeProfile& profile);
+
+	private:
+		std::uint64_t* m_pairs;
+		std::uint64_t* m_triples;
+		// None until the first instructions of a run have been seen.
+		std::size_t m_previous;
+		std::size_t m_before;
+
+		friend class OpcodeProfile;
+	};
+
+	// Starts a run; sequences do not span runs.
+	Counter Record();
+	// Prints the limit most frequent pairs and triples.
+	void Report(std::ostream& out, std::size_t limit = 10) const;
+
+public:
+	OpcodeProfile();
+	OpcodeProfile(const OpcodeProfile&) = delete;
+	~OpcodeProfile() = default;
+
+private:
+	// One more slot than there are opcodes, standing for "no instruction".
+	static constexpr std::size_t Width = OpCodeCount + 1;
+	static constexpr std::size_t None = OpCodeCount;
+
+	std::vector<std::uint64_t> m_pairs;
+	std::vector<std::uint64_t> m_triples;
+};
+
+}
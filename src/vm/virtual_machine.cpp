@@ -1,154 +1,1195 @@
 #include <iostream>
 #include <cstring>
+#include <string>
 #include "vm/virtual_machine.hpp"
 #include "vm/memory.hpp"
 #include "vm/compiler.hpp"
+#include "vm/trace.hpp"
+#include "vm/register_compiler.hpp"
+#include "vm/integer.hpp"
+#include "vm/image.hpp"
+#include "vm/compile_cache.hpp"
 
 namespace VM {
 
-	RVM::RVM(Chunk& c) : m_chunk(c), m_pc(0), m_index_pc(0) { }
+	RVM::RVM(Chunk& c, std::size_t stack_size)
+		: m_stack(stack_size), m_stack_top(m_stack.data()), m_chunk(c) { }
 
-	void RVM::BinaryAdd() {
+	RVM::RVM(std::size_t stack_size)
+		: m_stack(stack_size), m_stack_top(m_stack.data()) { }
 
-		Value b = m_values.top();
-		m_values.pop();
-		Value a = m_values.top();
-		m_values.pop();
-		m_values.push(a + b);
-	}
+	InterpreteResult RVM::RuntimeError(const std::string& message, std::size_t offset) {
 
-	void RVM::BinaryMul() {
+		if (m_image)
+			return ReportError(message, offset < m_image->Size() ? m_image->Line(offset) + 1 : 0);
 
-		Value b = m_values.top();
-		m_values.pop();
-		Value a = m_values.top();
-		m_values.pop();
-		m_values.push(a * b);
+		return RuntimeError(message, m_chunk, offset);
 	}
 
-	void RVM::BinarySub() {
+	InterpreteResult RVM::RuntimeError(const std::string& message, const Chunk& chunk, std::size_t offset) {
 
-		Value b = m_values.top();
-		m_values.pop();
-		Value a = m_values.top();
-		m_values.pop();
-		m_values.push(a - b);
+		return ReportError(message, std::uint32_t(offset < chunk.m_lines.size() ? chunk.m_lines[offset] + 1 : 0));
 	}
 
-	void RVM::BinaryDiv() {
+	InterpreteResult RVM::ReportError(const std::string& message, std::uint32_t line) {
+
+		std::cerr << "Error: " << message << " [line " << line << "]\n";
 
-		Value b = m_values.top();
-		m_values.pop();
-		Value a = m_values.top();
-		m_values.pop();
-		m_values.push(a / b);
+		m_stack_top = m_stack.data();
+		return InterpreteResult::RUNTIME_ERROR;
 	}
 
-	Byte RVM::Read8() {
-		
-		Byte pc = m_pc;
-		if (m_index_pc + 1 < m_chunk.m_bytes.size())
-			m_pc = m_chunk.m_bytes[++m_index_pc];
+	Chunk& RVM::CurrentChunk() {
 		
-		return pc;
+		// The caller may change the code through the reference.
+		m_register_stale = true;
+		m_jit.reset();
+		m_jit_failed = false;
+		m_source.reset();
+		m_entry.reset();
+		return m_chunk;
 	}
 
-	Value RVM::ReadConstant() {
+	void RVM::Park() {
 
-		return m_chunk.m_memory.GetHandle()[Read8()];
+		if (m_entry) {
+			const Chunk* key = m_entry.get();
+			m_programs[key] = Program{ std::move(m_entry), std::move(m_chunk), std::move(m_jit), m_jit_failed };
+		}
+
+		// Nothing else holds what the cache evicted, which cannot be
+		// returned again.
+		std::erase_if(m_programs, [](const auto& program) { return program.second.entry.use_count() == 1; });
 	}
 
-	Value RVM::ReadConstantLong() {
+	void RVM::Enter(std::shared_ptr<const Chunk> entry) {
+
+		Park();
+		CurrentChunk();
 
-		Byte byte1 = Read8();
-		Byte byte2 = Read8();
-		Byte bytes[] = { byte1, byte2 };
+		auto parked = m_programs.find(entry.get());
+		if (parked != m_programs.end()) {
+			m_chunk = std::move(parked->second.chunk);
+			m_jit = std::move(parked->second.jit);
+			m_jit_failed = parked->second.jit_failed;
+			m_programs.erase(parked);
+		}
+		else
+			m_chunk = *entry;
 
-		std::size_t addr;
-		std::memcpy(&addr, bytes, sizeof(std::size_t));
-		return m_chunk.m_memory.GetHandle()[addr];
+		m_entry = std::move(entry);
 	}
 
-	Chunk& RVM::CurrentChunk() {
-		
-		return m_chunk;
+	void RVM::SetEngine(Engine engine) {
+
+		m_engine = engine;
+	}
+
+	const Chunk& RVM::RegisterChunk() {
+
+		PrepareRegisters();
+		return m_register_chunk;
+	}
+
+	std::span<const Value> RVM::Stack() const {
+
+		return { m_stack.data(), m_stack_top };
+	}
+
+	bool RVM::PrepareRegisters() {
+
+		if (!m_register_stale)
+			return m_registers_ok;
+
+		RegisterCompiler compiler(m_chunk, m_register_chunk);
+		m_registers_ok = compiler.Compile();
+		m_registers = compiler.Registers();
+		m_register_results = compiler.Results();
+		m_register_stale = false;
+		return m_registers_ok;
+	}
+
+	void RVM::SetTrace(std::ostream* out) {
+
+		m_trace = out;
+	}
+
+	void RVM::SetTraceRing(RingTrace* ring) {
+
+		m_ring = ring;
+	}
+
+	void RVM::SetOptimization(Optimization level) {
+
+		m_optimization = level;
+	}
+
+	void RVM::SetQuickening(bool enabled) {
+
+		m_quickening = enabled;
+	}
+
+	void RVM::SetJitThreshold(std::size_t runs) {
+
+		m_jit_threshold = runs;
+	}
+
+	void RVM::SetJitFolding(bool enabled) {
+
+		m_jit_folding = enabled;
+		m_jit.reset();
+		m_jit_failed = false;
+		for (auto& parked : m_programs) {
+			parked.second.jit.reset();
+			parked.second.jit_failed = false;
+		}
 	}
 
+	bool RVM::PrepareJit() {
+
+		if (m_jit)
+			return true;
+
+		if (m_jit_threshold == 0 || m_jit_failed || m_chunk.m_executions < m_jit_threshold)
+			return false;
+
+		m_jit = Jit::Compile(m_chunk, m_stack.size(), m_jit_folding);
+		m_jit_failed = !m_jit;
+		m_jit_compiled += m_jit != nullptr;
+		return m_jit != nullptr;
+	}
+
+	// A side exit leaves the stack as it was before the instruction whose
+	// guard failed, and the interpreter finishes the run from there. The
+	// code stays: an exit costs the instructions already run in machine
+	// code at most.
+	InterpreteResult RVM::ExecuteJit() {
+
+		std::size_t depth = 0;
+		auto start = std::chrono::steady_clock::now();
+		const Jit::Exit* exit = m_jit->Run(m_stack.data(), depth);
+		m_jit_time += std::chrono::steady_clock::now() - start;
+
+		if (!exit) {
+			m_jit_runs++;
+			m_stack_top = m_stack.data() + depth;
+			return InterpreteResult::OK;
+		}
+
+		m_jit_exits++;
+		return ExecuteStack(NoTrace(), exit->offset, depth);
+	}
+
+	void RVM::SetProfile(OpcodeProfile* profile) {
+
+		m_profile = profile;
+	}
+
+	void RVM::SetCompileCache(CompileCache* cache) {
+
+		// Entries of another cache are no use; the current chunk stays.
+		if (cache != m_cache) {
+			m_entry.reset();
+			m_programs.clear();
+		}
+		m_cache = cache;
+	}
+
+	// A cached chunk is copied on its first run: the stack engine quickens
+	// the code it runs. The copy, its execution count and its machine code
+	// are kept per entry, so a hit on another source sets them aside instead
+	// of dropping them. Without a cache the last source is kept with its
+	// chunk the same way.
 	InterpreteResult RVM::Run(std::string_view source) {
-		
-		Compiler compiler(*this, source);
-		compiler.Compile();
+
+		if (m_cache) {
+			std::shared_ptr<const Chunk> chunk = m_cache->Get(source, m_optimization);
+			if (!chunk)
+				return InterpreteResult::COMPILE_ERROR;
+
+			if (chunk != m_entry)
+				Enter(std::move(chunk));
+			return Run();
+		}
+
+		if (m_source && *m_source == source && m_source_level == m_optimization)
+			return Run();
+
+		Park();
+		CurrentChunk() = Chunk();
+
+		try {
+			Compiler compiler(*this, source);
+			compiler.Compile();
+		}
+		catch (const std::exception&) {
+			return InterpreteResult::COMPILE_ERROR;
+		}
+
+		m_source = std::string(source);
+		m_source_level = m_optimization;
+		return Run();
+	}
+
+	InterpreteResult RVM::Run(Analysis::Reader& reader) {
+
+		Park();
+		CurrentChunk() = Chunk();
+
+		try {
+			Compiler compiler(*this, reader);
+			compiler.Compile();
+		}
+		catch (const std::exception&) {
+			return InterpreteResult::COMPILE_ERROR;
+		}
 
 		return Run();
 	}
 
+	// Tracing and fast runs use separate instantiations of each loop; hot
+	// chunks on the stack engine run as machine code when they can.
 	InterpreteResult RVM::Run() {
 
-		while (m_index_pc < m_chunk.m_bytes.size()) {
+		m_chunk.m_executions++;
+
+		if (m_engine == Engine::Register && !PrepareRegisters()) {
+			std::cerr << "Error: The program cannot run on the register engine.\n";
+			return InterpreteResult::COMPILE_ERROR;
+		}
+
+		if (m_ring) {
+			m_ring->SetOptimization(m_optimization);
+			if (m_ring->CapturesTop())
+				return Execute(m_ring->Record<true>());
+			return Execute(m_ring->Record<false>());
+		}
+
+		if (m_profile)
+			return Execute(m_profile->Record());
+
+		if (m_trace)
+			return Execute(BufferedTrace(*m_trace));
 
-#ifdef DEBUG_TRACE_EXECUTION
-			m_chunk.Disassemble(m_index_pc);
+		if (m_engine == Engine::Stack && PrepareJit())
+			return ExecuteJit();
+
+		return Execute(NoTrace());
+	}
+
+	InterpreteResult RVM::Run(Image& image) {
+
+		if (m_ring || m_profile || m_trace || m_engine == Engine::Register) {
+			Park();
+			CurrentChunk() = image.ToChunk();
+
+			// The copy runs in the image's stead, and counts for it.
+			InterpreteResult result = Run();
+			image.m_quickened += m_chunk.m_quickened;
+			image.m_deoptimized += m_chunk.m_deoptimized;
+			return result;
+		}
+
+		m_image = &image;
+		InterpreteResult result = ExecuteStack(NoTrace());
+		m_image = nullptr;
+		return result;
+	}
+
+	template<typename Tracer>
+	InterpreteResult RVM::Execute(Tracer tracer) {
+
+		if (m_engine == Engine::Register)
+			return ExecuteRegisters(std::move(tracer));
+
+		return ExecuteStack(std::move(tracer));
+	}
+
+	// Both loops keep the instruction pointer and their operands in locals.
+	// With RAVI_COMPUTED_GOTO on GCC/Clang every handler ends with its own
+	// indirect jump through the label table (direct threading), which gives
+	// the branch predictor one site per opcode; otherwise they fall back to
+	// a portable switch. Bytecode comes from the compilers, so opcodes are
+	// trusted by the threaded build; the switch build reports unknown ones.
+#if defined(RAVI_COMPUTED_GOTO) && (defined(__GNUC__) || defined(__clang__))
+#define RAVI_THREADED
+#define RAVI_DISPATCH() do { const Byte opcode_ = *ip++; RAVI_TRACE(opcode_); goto *dispatch[opcode_]; } while (0)
+#define RAVI_CASE(name) op_##name:
+#define RAVI_NEXT() RAVI_DISPATCH()
+#define RAVI_DEFAULT() op_Unknown:
+#define RAVI_LOOP_BEGIN() RAVI_DISPATCH(); {
+#define RAVI_LOOP_END() }
+#else
+#define RAVI_DISPATCH() const Byte opcode_ = *ip++; RAVI_TRACE(opcode_); switch (opcode_)
+#define RAVI_CASE(name) case OpCode::name:
+#define RAVI_NEXT() continue
+#define RAVI_DEFAULT() default:
+#define RAVI_LOOP_BEGIN() for (;;) { RAVI_DISPATCH() {
+#define RAVI_LOOP_END() } }
+#endif
+
+	// Stores lhs op rhs into target when both are numeric, otherwise returns
+	// error. Boxed values are NaNs to the FPU, so a result that is not NaN
+	// proves both operands were numbers and costs a single check. integers
+	// runs first when both are integers, which only the slow path sees.
+#define RAVI_BINARY(target, lhs, rhs, op, error, integers) do { \
+		const Value left_ = (lhs), right_ = (rhs); \
+		double result_ = left_.AsNumber() op right_.AsNumber(); \
+		if (result_ == result_ || (left_.IsNumber() && right_.IsNumber())) [[likely]] \
+			(target) = Value::Arithmetic(result_); \
+		else if (left_.IsNumeric() && right_.IsNumeric()) { \
+			if (Value::AreIntegers(left_, right_)) \
+				integers; \
+			(target) = Value::Arithmetic(left_.ToNumber() op right_.ToNumber()); \
+		} \
+		else \
+			return error; \
+	} while (0)
+
+	// Stores a bool, lhs op rhs, into target when both are numeric, otherwise
+	// returns error.
+#define RAVI_COMPARE(target, lhs, rhs, op, error, integers) do { \
+		const Value left_ = (lhs), right_ = (rhs); \
+		if (left_.IsNumber() && right_.IsNumber()) [[likely]] \
+			(target) = Value::Bool(left_.AsNumber() op right_.AsNumber()); \
+		else if (left_.IsNumeric() && right_.IsNumeric()) { \
+			if (Value::AreIntegers(left_, right_)) \
+				integers; \
+			(target) = Value::Bool(left_.ToNumber() op right_.ToNumber()); \
+		} \
+		else \
+			return error; \
+	} while (0)
+
+	// Quickening rewrites the instruction being executed, whose opcode is at
+	// ip[-1], in the stack engine's code, and counts it against that code:
+	// the chunk's or the image's. The Compiler types every operation on
+	// integer operands, so only untyped bytecode and images from other
+	// producers reach the generic opcodes on integers.
+#define RAVI_QUICKEN(quick) do { \
+		if (m_quickening) { \
+			ip[-1] = OpCode::quick; \
+			quickened++; \
+		} \
+	} while (0)
+
+#define RAVI_DEOPTIMIZE(generic) do { \
+		ip[-1] = OpCode::generic; \
+		deoptimized++; \
+	} while (0)
+
+	// The Integer_* and Number_* opcodes are only emitted for operands the
+	// type checker proved, so they skip the tag checks.
+#define RAVI_INTEGER(target, lhs, rhs, expr) do { \
+		const std::int32_t a_ = (lhs).AsInteger(), b_ = (rhs).AsInteger(); \
+		(target) = (expr); \
+	} while (0)
+
+#define RAVI_NUMBER(target, lhs, rhs, expr) do { \
+		const double a_ = (lhs).AsNumber(), b_ = (rhs).AsNumber(); \
+		(target) = (expr); \
+	} while (0)
+
+	static constexpr const char* OperandError = "Operand must be a number.";
+	static constexpr const char* OperandsError = "Operands must be numbers.";
+	static constexpr const char* DivisionError = "Division by zero.";
+
+	template<typename Tracer>
+	InterpreteResult RVM::ExecuteStack([[maybe_unused]] Tracer tracer, std::size_t offset, std::size_t depth) {
+
+		// Images end with End once loaded.
+		if (!m_image && (m_chunk.m_bytes.empty() || m_chunk.m_bytes.back() != OpCode::End))
+			m_chunk.Write8(OpCode::End);
+
+		// Not const: generic instructions are quickened in place.
+		Byte* const code = m_image ? m_image->Code() : m_chunk.m_bytes.data();
+		const Value* const constants = m_image ? m_image->Constants() : m_chunk.m_memory->GetHandle().data();
+		std::uint64_t& quickened = m_image ? m_image->m_quickened : m_chunk.m_quickened;
+		std::uint64_t& deoptimized = m_image ? m_image->m_deoptimized : m_chunk.m_deoptimized;
+		Byte* ip = code + offset;
+		Value* const stack = m_stack.data();
+		Value* sp = stack + depth;
+		Value* const stack_end = stack + m_stack.size();
+
+#define RAVI_TRACE(opcode) if constexpr (Tracer::Enabled) tracer.Instruction(m_chunk, ip - 1 - code, opcode, stack, sp)
+
+#ifdef RAVI_THREADED
+		static const void* const dispatch[OpCodeCount] = {
+			&&op_Constant,
+			&&op_End,
+			&&op_Negate,
+			&&op_Add,
+			&&op_Substract,
+			&&op_Multiply,
+			&&op_Divide,
+			&&op_Constant_Long,
+			&&op_Pop,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Add_Constant,
+			&&op_Substract_Constant,
+			&&op_Multiply_Constant,
+			&&op_Divide_Constant,
+			&&op_Constant_Negated,
+			&&op_Integer_Negate,
+			&&op_Integer_Add,
+			&&op_Integer_Substract,
+			&&op_Integer_Multiply,
+			&&op_Integer_Divide,
+			&&op_Equal,
+			&&op_Not_Equal,
+			&&op_Less,
+			&&op_Less_Equal,
+			&&op_Greater,
+			&&op_Greater_Equal,
+			&&op_Integer_Equal,
+			&&op_Integer_Not_Equal,
+			&&op_Integer_Less,
+			&&op_Integer_Less_Equal,
+			&&op_Integer_Greater,
+			&&op_Integer_Greater_Equal,
+			&&op_Number_Negate,
+			&&op_Number_Add,
+			&&op_Number_Substract,
+			&&op_Number_Multiply,
+			&&op_Number_Divide,
+			&&op_Number_Equal,
+			&&op_Number_Not_Equal,
+			&&op_Number_Less,
+			&&op_Number_Less_Equal,
+			&&op_Number_Greater,
+			&&op_Number_Greater_Equal,
+			&&op_Negate_Integer,
+			&&op_Add_Integers,
+			&&op_Substract_Integers,
+			&&op_Multiply_Integers,
+			&&op_Divide_Integers,
+			&&op_Equal_Integers,
+			&&op_Not_Equal_Integers,
+			&&op_Less_Integers,
+			&&op_Less_Equal_Integers,
+			&&op_Greater_Integers,
+			&&op_Greater_Equal_Integers,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+		};
 #endif
-			
-			Byte instruction;
-			switch (instruction = Read8()) {
 
-			case OpCode::Constant: {
-				
-				Value constant = ReadConstant();
-				m_values.push(constant);
-				break;
+		RAVI_LOOP_BEGIN()
+
+			RAVI_CASE(Constant) {
+
+				if (sp == stack_end)
+					return RuntimeError("Stack overflow.", ip - code - 1);
+				*sp++ = constants[*ip++];
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Constant_Long) {
+
+				if (sp == stack_end)
+					return RuntimeError("Stack overflow.", ip - code - 1);
+				*sp++ = constants[(std::size_t(ip[0]) << 8) | ip[1]];
+				ip += 2;
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Pop) {
+
+				sp--;
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Negate) {
+
+				if (!sp[-1].IsNumeric())
+					return RuntimeError(OperandError, ip - code - 1);
+				if (sp[-1].IsInteger())
+					RAVI_QUICKEN(Negate_Integer);
+				sp[-1] = Value::Arithmetic(-sp[-1].ToNumber());
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Add) {
+
+				sp--;
+				RAVI_BINARY(sp[-1], sp[-1], sp[0], +, RuntimeError(OperandsError, ip - code - 1), RAVI_QUICKEN(Add_Integers));
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Substract) {
+
+				sp--;
+				RAVI_BINARY(sp[-1], sp[-1], sp[0], -, RuntimeError(OperandsError, ip - code - 1), RAVI_QUICKEN(Substract_Integers));
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Multiply) {
+
+				sp--;
+				RAVI_BINARY(sp[-1], sp[-1], sp[0], *, RuntimeError(OperandsError, ip - code - 1), RAVI_QUICKEN(Multiply_Integers));
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Divide) {
+
+				sp--;
+				RAVI_BINARY(sp[-1], sp[-1], sp[0], /, RuntimeError(OperandsError, ip - code - 1), RAVI_QUICKEN(Divide_Integers));
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Constant_Negated) {
+
+				if (sp == stack_end)
+					return RuntimeError("Stack overflow.", ip - code - 1);
+				if (!constants[*ip].IsNumeric())
+					return RuntimeError(OperandError, ip - code - 1);
+				*sp++ = Value::Arithmetic(-constants[*ip++].ToNumber());
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Add_Constant) {
+
+				RAVI_BINARY(sp[-1], sp[-1], constants[*ip], +, RuntimeError(OperandsError, ip - code - 1), (void)0);
+				ip++;
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Substract_Constant) {
+
+				RAVI_BINARY(sp[-1], sp[-1], constants[*ip], -, RuntimeError(OperandsError, ip - code - 1), (void)0);
+				ip++;
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Multiply_Constant) {
+
+				RAVI_BINARY(sp[-1], sp[-1], constants[*ip], *, RuntimeError(OperandsError, ip - code - 1), (void)0);
+				ip++;
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Divide_Constant) {
+
+				RAVI_BINARY(sp[-1], sp[-1], constants[*ip], /, RuntimeError(OperandsError, ip - code - 1), (void)0);
+				ip++;
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Integer_Negate) {
+
+				sp[-1] = Value::Integer(Integer::Negate(sp[-1].AsInteger()));
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Integer_Add) {
+
+				sp--;
+				RAVI_INTEGER(sp[-1], sp[-1], sp[0], Value::Integer(Integer::Add(a_, b_)));
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Integer_Substract) {
+
+				sp--;
+				RAVI_INTEGER(sp[-1], sp[-1], sp[0], Value::Integer(Integer::Substract(a_, b_)));
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Integer_Multiply) {
+
+				sp--;
+				RAVI_INTEGER(sp[-1], sp[-1], sp[0], Value::Integer(Integer::Multiply(a_, b_)));
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Integer_Divide) {
+
+				sp--;
+				if (sp[0].AsInteger() == 0)
+					return RuntimeError(DivisionError, ip - code - 1);
+				RAVI_INTEGER(sp[-1], sp[-1], sp[0], Value::Integer(Integer::Divide(a_, b_)));
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Equal) {
+
+				sp--;
+				if (Value::AreIntegers(sp[-1], sp[0]))
+					RAVI_QUICKEN(Equal_Integers);
+				sp[-1] = Value::Bool(sp[-1].Equals(sp[0]));
+				RAVI_NEXT();
 			}
-		
-			case OpCode::End: {
 
-				m_values.pop();
+			RAVI_CASE(Not_Equal) {
+
+				sp--;
+				if (Value::AreIntegers(sp[-1], sp[0]))
+					RAVI_QUICKEN(Not_Equal_Integers);
+				sp[-1] = Value::Bool(!sp[-1].Equals(sp[0]));
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Less) {
+
+				sp--;
+				RAVI_COMPARE(sp[-1], sp[-1], sp[0], <, RuntimeError(OperandsError, ip - code - 1), RAVI_QUICKEN(Less_Integers));
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Less_Equal) {
+
+				sp--;
+				RAVI_COMPARE(sp[-1], sp[-1], sp[0], <=, RuntimeError(OperandsError, ip - code - 1), RAVI_QUICKEN(Less_Equal_Integers));
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Greater) {
+
+				sp--;
+				RAVI_COMPARE(sp[-1], sp[-1], sp[0], >, RuntimeError(OperandsError, ip - code - 1), RAVI_QUICKEN(Greater_Integers));
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Greater_Equal) {
+
+				sp--;
+				RAVI_COMPARE(sp[-1], sp[-1], sp[0], >=, RuntimeError(OperandsError, ip - code - 1), RAVI_QUICKEN(Greater_Equal_Integers));
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Integer_Equal) {
+
+				sp--;
+				RAVI_INTEGER(sp[-1], sp[-1], sp[0], Value::Bool(a_ == b_));
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Integer_Not_Equal) {
+
+				sp--;
+				RAVI_INTEGER(sp[-1], sp[-1], sp[0], Value::Bool(a_ != b_));
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Integer_Less) {
+
+				sp--;
+				RAVI_INTEGER(sp[-1], sp[-1], sp[0], Value::Bool(a_ < b_));
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Integer_Less_Equal) {
+
+				sp--;
+				RAVI_INTEGER(sp[-1], sp[-1], sp[0], Value::Bool(a_ <= b_));
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Integer_Greater) {
+
+				sp--;
+				RAVI_INTEGER(sp[-1], sp[-1], sp[0], Value::Bool(a_ > b_));
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Integer_Greater_Equal) {
+
+				sp--;
+				RAVI_INTEGER(sp[-1], sp[-1], sp[0], Value::Bool(a_ >= b_));
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Number_Negate) {
+
+				sp[-1] = Value::Arithmetic(-sp[-1].AsNumber());
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Number_Add) {
+
+				sp--;
+				RAVI_NUMBER(sp[-1], sp[-1], sp[0], Value::Arithmetic(a_ + b_));
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Number_Substract) {
+
+				sp--;
+				RAVI_NUMBER(sp[-1], sp[-1], sp[0], Value::Arithmetic(a_ - b_));
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Number_Multiply) {
+
+				sp--;
+				RAVI_NUMBER(sp[-1], sp[-1], sp[0], Value::Arithmetic(a_ * b_));
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Number_Divide) {
+
+				sp--;
+				RAVI_NUMBER(sp[-1], sp[-1], sp[0], Value::Arithmetic(a_ / b_));
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Number_Equal) {
+
+				sp--;
+				RAVI_NUMBER(sp[-1], sp[-1], sp[0], Value::Bool(a_ == b_));
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Number_Not_Equal) {
+
+				sp--;
+				RAVI_NUMBER(sp[-1], sp[-1], sp[0], Value::Bool(a_ != b_));
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Number_Less) {
+
+				sp--;
+				RAVI_NUMBER(sp[-1], sp[-1], sp[0], Value::Bool(a_ < b_));
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Number_Less_Equal) {
+
+				sp--;
+				RAVI_NUMBER(sp[-1], sp[-1], sp[0], Value::Bool(a_ <= b_));
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Number_Greater) {
+
+				sp--;
+				RAVI_NUMBER(sp[-1], sp[-1], sp[0], Value::Bool(a_ > b_));
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Number_Greater_Equal) {
+
+				sp--;
+				RAVI_NUMBER(sp[-1], sp[-1], sp[0], Value::Bool(a_ >= b_));
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Negate_Integer) {
+
+				if (sp[-1].IsInteger()) [[likely]]
+					sp[-1] = Value::Arithmetic(-double(sp[-1].AsInteger()));
+				else {
+					RAVI_DEOPTIMIZE(Negate);
+					if (!sp[-1].IsNumeric())
+						return RuntimeError(OperandError, ip - code - 1);
+					sp[-1] = Value::Arithmetic(-sp[-1].ToNumber());
+				}
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Add_Integers) {
+
+				sp--;
+				if (Value::AreIntegers(sp[-1], sp[0])) [[likely]]
+					sp[-1] = Value::Arithmetic(double(sp[-1].AsInteger()) + double(sp[0].AsInteger()));
+				else {
+					RAVI_DEOPTIMIZE(Add);
+					RAVI_BINARY(sp[-1], sp[-1], sp[0], +, RuntimeError(OperandsError, ip - code - 1), (void)0);
+				}
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Substract_Integers) {
+
+				sp--;
+				if (Value::AreIntegers(sp[-1], sp[0])) [[likely]]
+					sp[-1] = Value::Arithmetic(double(sp[-1].AsInteger()) - double(sp[0].AsInteger()));
+				else {
+					RAVI_DEOPTIMIZE(Substract);
+					RAVI_BINARY(sp[-1], sp[-1], sp[0], -, RuntimeError(OperandsError, ip - code - 1), (void)0);
+				}
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Multiply_Integers) {
+
+				sp--;
+				if (Value::AreIntegers(sp[-1], sp[0])) [[likely]]
+					sp[-1] = Value::Arithmetic(double(sp[-1].AsInteger()) * double(sp[0].AsInteger()));
+				else {
+					RAVI_DEOPTIMIZE(Multiply);
+					RAVI_BINARY(sp[-1], sp[-1], sp[0], *, RuntimeError(OperandsError, ip - code - 1), (void)0);
+				}
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Divide_Integers) {
+
+				sp--;
+				if (Value::AreIntegers(sp[-1], sp[0])) [[likely]]
+					sp[-1] = Value::Arithmetic(double(sp[-1].AsInteger()) / double(sp[0].AsInteger()));
+				else {
+					RAVI_DEOPTIMIZE(Divide);
+					RAVI_BINARY(sp[-1], sp[-1], sp[0], /, RuntimeError(OperandsError, ip - code - 1), (void)0);
+				}
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Equal_Integers) {
+
+				sp--;
+				if (Value::AreIntegers(sp[-1], sp[0])) [[likely]]
+					sp[-1] = Value::Bool(sp[-1].AsInteger() == sp[0].AsInteger());
+				else {
+					RAVI_DEOPTIMIZE(Equal);
+					sp[-1] = Value::Bool(sp[-1].Equals(sp[0]));
+				}
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Not_Equal_Integers) {
+
+				sp--;
+				if (Value::AreIntegers(sp[-1], sp[0])) [[likely]]
+					sp[-1] = Value::Bool(sp[-1].AsInteger() != sp[0].AsInteger());
+				else {
+					RAVI_DEOPTIMIZE(Not_Equal);
+					sp[-1] = Value::Bool(!sp[-1].Equals(sp[0]));
+				}
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Less_Integers) {
+
+				sp--;
+				if (Value::AreIntegers(sp[-1], sp[0])) [[likely]]
+					sp[-1] = Value::Bool(sp[-1].AsInteger() < sp[0].AsInteger());
+				else {
+					RAVI_DEOPTIMIZE(Less);
+					RAVI_COMPARE(sp[-1], sp[-1], sp[0], <, RuntimeError(OperandsError, ip - code - 1), (void)0);
+				}
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Less_Equal_Integers) {
+
+				sp--;
+				if (Value::AreIntegers(sp[-1], sp[0])) [[likely]]
+					sp[-1] = Value::Bool(sp[-1].AsInteger() <= sp[0].AsInteger());
+				else {
+					RAVI_DEOPTIMIZE(Less_Equal);
+					RAVI_COMPARE(sp[-1], sp[-1], sp[0], <=, RuntimeError(OperandsError, ip - code - 1), (void)0);
+				}
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Greater_Integers) {
+
+				sp--;
+				if (Value::AreIntegers(sp[-1], sp[0])) [[likely]]
+					sp[-1] = Value::Bool(sp[-1].AsInteger() > sp[0].AsInteger());
+				else {
+					RAVI_DEOPTIMIZE(Greater);
+					RAVI_COMPARE(sp[-1], sp[-1], sp[0], >, RuntimeError(OperandsError, ip - code - 1), (void)0);
+				}
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Greater_Equal_Integers) {
+
+				sp--;
+				if (Value::AreIntegers(sp[-1], sp[0])) [[likely]]
+					sp[-1] = Value::Bool(sp[-1].AsInteger() >= sp[0].AsInteger());
+				else {
+					RAVI_DEOPTIMIZE(Greater_Equal);
+					RAVI_COMPARE(sp[-1], sp[-1], sp[0], >=, RuntimeError(OperandsError, ip - code - 1), (void)0);
+				}
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(End) {
+
+				m_stack_top = sp;
 				return InterpreteResult::OK;
 			}
 
-			case OpCode::Constant_Long: {
+			RAVI_DEFAULT() {
+
+				return RuntimeError("Unknown opcode.", ip - code - 1);
+			}
+
+		RAVI_LOOP_END()
+
+#undef RAVI_TRACE
+	}
+
+	// The frame is the bottom of m_stack: RegisterCount registers followed by
+	// a copy of the constants an operand byte can name, so an operand indexes
+	// the frame directly whether it is a register or a constant.
+	template<typename Tracer>
+	InterpreteResult RVM::ExecuteRegisters([[maybe_unused]] Tracer tracer) {
+
+		const Chunk& chunk = m_register_chunk;
+		const std::vector<Value>& pool = chunk.m_memory->GetHandle();
+		std::size_t inline_constants = std::min(pool.size(), RegisterCount);
+
+		if (m_stack.size() < RegisterCount + inline_constants)
+			return RuntimeError("Stack overflow.", chunk, 0);
+
+		Value* const frame = m_stack.data();
+		std::copy_n(pool.data(), inline_constants, frame + RegisterCount);
+
+		const Byte* const code = chunk.m_bytes.data();
+		const Value* const constants = pool.data();
+		const Byte* ip = code;
+
+#define RAVI_TRACE(opcode) if constexpr (Tracer::Enabled) tracer.Instruction(chunk, ip - 1 - code, opcode, frame, frame + m_registers)
+
+#ifdef RAVI_THREADED
+		static const void* const dispatch[OpCodeCount] = {
+			&&op_Unknown,
+			&&op_End,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Register_Load,
+			&&op_Register_Negate,
+			&&op_Register_Add,
+			&&op_Register_Substract,
+			&&op_Register_Multiply,
+			&&op_Register_Divide,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Unknown,
+			&&op_Register_Integer_Negate,
+			&&op_Register_Integer_Add,
+			&&op_Register_Integer_Substract,
+			&&op_Register_Integer_Multiply,
+			&&op_Register_Integer_Divide,
+			&&op_Register_Equal,
+			&&op_Register_Not_Equal,
+			&&op_Register_Less,
+			&&op_Register_Less_Equal,
+			&&op_Register_Greater,
+			&&op_Register_Greater_Equal,
+		};
+#endif
+
+		RAVI_LOOP_BEGIN()
+
+			RAVI_CASE(Register_Load) {
 
-				Value constant = ReadConstantLong();
-				m_values.push(constant);
-				break;
+				frame[ip[0]] = constants[(std::size_t(ip[1]) << 8) | ip[2]];
+				ip += 3;
+				RAVI_NEXT();
 			}
 
-			case OpCode::Negate: {
-			
-				auto& negate_value = m_values.top();
-				m_values.push(-negate_value);
-				m_values.pop();
-				break;
+			RAVI_CASE(Register_Negate) {
+
+				if (!frame[ip[1]].IsNumeric())
+					return RuntimeError(OperandError, chunk, ip - code - 1);
+				frame[ip[0]] = Value::Arithmetic(-frame[ip[1]].ToNumber());
+				ip += 2;
+				RAVI_NEXT();
 			}
-			
-			case OpCode::Add: {
-			
-				BinaryAdd();
-				break;
+
+			RAVI_CASE(Register_Add) {
+
+				RAVI_BINARY(frame[ip[0]], frame[ip[1]], frame[ip[2]], +, RuntimeError(OperandsError, chunk, ip - code - 1), (void)0);
+				ip += 3;
+				RAVI_NEXT();
 			}
-			
-			case OpCode::Substract: {
-			
-				BinarySub();
-				break;
+
+			RAVI_CASE(Register_Substract) {
+
+				RAVI_BINARY(frame[ip[0]], frame[ip[1]], frame[ip[2]], -, RuntimeError(OperandsError, chunk, ip - code - 1), (void)0);
+				ip += 3;
+				RAVI_NEXT();
 			}
-			
-			case OpCode::Divide: {
-				
-				BinaryDiv();
-				break;
+
+			RAVI_CASE(Register_Multiply) {
+
+				RAVI_BINARY(frame[ip[0]], frame[ip[1]], frame[ip[2]], *, RuntimeError(OperandsError, chunk, ip - code - 1), (void)0);
+				ip += 3;
+				RAVI_NEXT();
 			}
 
-			case OpCode::Multiply: {
-				
-				BinaryMul();
-				break;
+			RAVI_CASE(Register_Divide) {
+
+				RAVI_BINARY(frame[ip[0]], frame[ip[1]], frame[ip[2]], /, RuntimeError(OperandsError, chunk, ip - code - 1), (void)0);
+				ip += 3;
+				RAVI_NEXT();
 			}
 
-			default: break;
+			RAVI_CASE(Register_Integer_Negate) {
+
+				frame[ip[0]] = Value::Integer(Integer::Negate(frame[ip[1]].AsInteger()));
+				ip += 2;
+				RAVI_NEXT();
 			}
-		}
+
+			RAVI_CASE(Register_Integer_Add) {
+
+				RAVI_INTEGER(frame[ip[0]], frame[ip[1]], frame[ip[2]], Value::Integer(Integer::Add(a_, b_)));
+				ip += 3;
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Register_Integer_Substract) {
+
+				RAVI_INTEGER(frame[ip[0]], frame[ip[1]], frame[ip[2]], Value::Integer(Integer::Substract(a_, b_)));
+				ip += 3;
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Register_Integer_Multiply) {
+
+				RAVI_INTEGER(frame[ip[0]], frame[ip[1]], frame[ip[2]], Value::Integer(Integer::Multiply(a_, b_)));
+				ip += 3;
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Register_Integer_Divide) {
+
+				if (frame[ip[2]].AsInteger() == 0)
+					return RuntimeError(DivisionError, chunk, ip - code - 1);
+				RAVI_INTEGER(frame[ip[0]], frame[ip[1]], frame[ip[2]], Value::Integer(Integer::Divide(a_, b_)));
+				ip += 3;
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Register_Equal) {
+
+				frame[ip[0]] = Value::Bool(frame[ip[1]].Equals(frame[ip[2]]));
+				ip += 3;
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Register_Not_Equal) {
+
+				frame[ip[0]] = Value::Bool(!frame[ip[1]].Equals(frame[ip[2]]));
+				ip += 3;
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Register_Less) {
+
+				RAVI_COMPARE(frame[ip[0]], frame[ip[1]], frame[ip[2]], <, RuntimeError(OperandsError, chunk, ip - code - 1), (void)0);
+				ip += 3;
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Register_Less_Equal) {
+
+				RAVI_COMPARE(frame[ip[0]], frame[ip[1]], frame[ip[2]], <=, RuntimeError(OperandsError, chunk, ip - code - 1), (void)0);
+				ip += 3;
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Register_Greater) {
+
+				RAVI_COMPARE(frame[ip[0]], frame[ip[1]], frame[ip[2]], >, RuntimeError(OperandsError, chunk, ip - code - 1), (void)0);
+				ip += 3;
+				RAVI_NEXT();
+			}
+
+			RAVI_CASE(Register_Greater_Equal) {
+
+				RAVI_COMPARE(frame[ip[0]], frame[ip[1]], frame[ip[2]], >=, RuntimeError(OperandsError, chunk, ip - code - 1), (void)0);
+				ip += 3;
+				RAVI_NEXT();
+			}
+
+			// The values left on the stack are in the first registers, which
+			// are the bottom of m_stack.
+			RAVI_CASE(End) {
+
+				m_stack_top = m_stack.data() + m_register_results;
+				return InterpreteResult::OK;
+			}
+
+			RAVI_DEFAULT() {
+
+				return RuntimeError("Unknown opcode.", chunk, ip - code - 1);
+			}
+
+		RAVI_LOOP_END()
+
+#undef RAVI_TRACE
 	}
 
-}
+#undef RAVI_THREADED
+#undef RAVI_DISPATCH
+#undef RAVI_CASE
+#undef RAVI_NEXT
+#undef RAVI_DEFAULT
+#undef RAVI_LOOP_BEGIN
+#undef RAVI_LOOP_END
+#undef RAVI_BINARY
+#undef RAVI_COMPARE
+#undef RAVI_INTEGER
+#undef RAVI_NUMBER
+#undef RAVI_QUICKEN
+#undef RAVI_DEOPTIMIZE
 
+}
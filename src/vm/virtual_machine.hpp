@@ -1,13 +1,26 @@
 #pragma once
 
-#include <stack>
+#include <vector>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <string>
+#include <unordered_map>
 #include "vm/chunk.hpp"
+#include "vm/jit.hpp"
+#include "vm/optimizer.hpp"
 #include "common/common.hpp"
-
-#define DEBUG_TRACE_EXECUTION
+#include "analysis/reader.hpp"
 
 namespace VM {
 
+class RingTrace;
+class OpcodeProfile;
+class Image;
+class CompileCache;
+
 enum OpCode : Byte {
 	Constant = 0,
 	End = 1,
@@ -17,6 +30,94 @@ enum OpCode : Byte {
 	Multiply,
 	Divide,
 	Constant_Long,
+	Pop,
+	// Register engine, see RegisterCompiler. Operands are one byte: below
+	// RegisterConstantBit a register, otherwise a constant index.
+	Register_Load,
+	Register_Negate,
+	Register_Add,
+	Register_Substract,
+	Register_Multiply,
+	Register_Divide,
+	// Superinstructions formed by Peephole: 'Constant k' fused with the
+	// instruction that follows it.
+	Add_Constant,
+	Substract_Constant,
+	Multiply_Constant,
+	Divide_Constant,
+	Constant_Negated,
+	// Emitted when both operands are statically integers, see Integer. Like
+	// the Number_* opcodes they trust the type checker and check no tags.
+	Integer_Negate,
+	Integer_Add,
+	Integer_Substract,
+	Integer_Multiply,
+	Integer_Divide,
+	// Comparisons push a bool.
+	Equal,
+	Not_Equal,
+	Less,
+	Less_Equal,
+	Greater,
+	Greater_Equal,
+	Integer_Equal,
+	Integer_Not_Equal,
+	Integer_Less,
+	Integer_Less_Equal,
+	Integer_Greater,
+	Integer_Greater_Equal,
+	// Emitted when both operands are statically numbers.
+	Number_Negate,
+	Number_Add,
+	Number_Substract,
+	Number_Multiply,
+	Number_Divide,
+	Number_Equal,
+	Number_Not_Equal,
+	Number_Less,
+	Number_Less_Equal,
+	Number_Greater,
+	Number_Greater_Equal,
+	// Quickened in place by the stack engine from the generic opcode once it
+	// saw integer operands, see Chunk::Unquickened. Same results as the
+	// generic opcode; a tag guard reverts them when the operands change.
+	// Compiled source already gets Integer_* for those, so this is the path
+	// for untyped bytecode and images.
+	Negate_Integer,
+	Add_Integers,
+	Substract_Integers,
+	Multiply_Integers,
+	Divide_Integers,
+	Equal_Integers,
+	Not_Equal_Integers,
+	Less_Integers,
+	Less_Equal_Integers,
+	Greater_Integers,
+	Greater_Equal_Integers,
+	// Register engine forms of the Integer_* opcodes and of the comparisons.
+	Register_Integer_Negate,
+	Register_Integer_Add,
+	Register_Integer_Substract,
+	Register_Integer_Multiply,
+	Register_Integer_Divide,
+	Register_Equal,
+	Register_Not_Equal,
+	Register_Less,
+	Register_Less_Equal,
+	Register_Greater,
+	Register_Greater_Equal,
+};
+
+// Keep in sync with the last opcode; sizes the interpreter dispatch tables.
+constexpr std::size_t OpCodeCount = OpCode::Register_Greater_Equal + 1;
+
+constexpr Byte RegisterConstantBit = 0x80;
+// Registers per frame; operands can also name this many constants.
+constexpr std::size_t RegisterCount = RegisterConstantBit;
+
+enum class Engine {
+	Stack = 0,
+	Register
 };
 
 enum class InterpreteResult {
@@ -29,30 +130,141 @@ class RVM {
 
 public:
 	InterpreteResult Run(std::string_view source);
+	InterpreteResult Run(Analysis::Reader& reader);
 	InterpreteResult Run();
-	Byte Read8();
-	Value ReadConstant();
-	Value ReadConstantLong();
+	// Runs a precompiled image where it is loaded, quickening its code in
+	// place, without copying it into the current chunk. Tracing, profiling
+	// and the register engine run a copy instead; the JIT is not used.
+	InterpreteResult Run(Image& image);
 	Chunk& CurrentChunk();
+	// Disassembles every executed instruction to out; nullptr (the default)
+	// runs the interpreter build without any tracing code.
+	void SetTrace(std::ostream* out);
+	// Records executed instructions into ring, which the caller owns and can
+	// dump after the run or from a signal handler. Takes precedence over
+	// SetTrace; nullptr turns it off.
+	void SetTraceRing(RingTrace* ring);
+	// Counts executed opcode pairs and triples into profile; nullptr turns
+	// it off.
+	void SetProfile(OpcodeProfile* profile);
+	// Selects the interpreter for the following runs. Engine::Register runs
+	// the current chunk translated by RegisterCompiler.
+	void SetEngine(Engine engine);
+	// The current chunk as register code, for inspection.
+	const Chunk& RegisterChunk();
+	// Optimization level of the programs Run(source) and Run(reader)
+	// compile; O1 by default.
+	void SetOptimization(Optimization level);
+	inline Optimization GetOptimization() const { return m_optimization; }
+	// Takes the chunks Run(source) runs from cache, which the caller owns
+	// and may share with other RVMs; the copy each entry runs is kept with
+	// its machine code while the entry stays cached. nullptr (the default)
+	// compiles each source unless it is the one run last.
+	void SetCompileCache(CompileCache* cache);
+	// Lets the stack engine rewrite generic opcodes it sees on integers into
+	// their quickened variants; on by default. Only code that was not typed
+	// by the Compiler has any.
+	void SetQuickening(bool enabled);
+	// Compiles the current chunk with Jit once it has run this many times,
+	// then runs the machine code whenever the stack engine would run without
+	// tracing. 0 turns the JIT off.
+	void SetJitThreshold(std::size_t runs);
+	// Lets the JIT fold operations on constants; on by default. Off, it
+	// keeps straight-line benchmarks from folding away.
+	void SetJitFolding(bool enabled);
+	// Chunks compiled, runs that finished in machine code, runs a failed
+	// guard sent back to the interpreter through a side exit, and the time
+	// spent in machine code.
+	inline std::uint64_t JitCompiled() const { return m_jit_compiled; }
+	inline std::uint64_t JitRuns() const { return m_jit_runs; }
+	inline std::uint64_t JitExits() const { return m_jit_exits; }
+	inline std::chrono::nanoseconds JitTime() const { return m_jit_time; }
+	// Machine code for the current chunk, whose exits count how often each
+	// was taken; nullptr until it is compiled.
+	inline const Jit* CompiledCode() const { return m_jit.get(); }
+	// Values the last run left on the operand stack, bottom first.
+	std::span<const Value> Stack() const;
 
 public:
-	RVM(Chunk& c);
-	RVM() = default;
-	RVM(const RVM&) = default;
+	static constexpr std::size_t DefaultStackSize = 64 * 1024;
+	static constexpr std::size_t DefaultJitThreshold = 16;
+
+	// stack_size is the maximum operand stack depth, in values; exceeding it
+	// stops the program with a runtime error.
+	explicit RVM(Chunk& c, std::size_t stack_size = DefaultStackSize);
+	explicit RVM(std::size_t stack_size = DefaultStackSize);
+	RVM(const RVM&) = delete;
 	RVM(RVM&&) = default;
 	~RVM() = default;
 
 private:
-	void BinaryAdd();
-	void BinaryMul();
-	void BinarySub();
-	void BinaryDiv();
+	template<typename Tracer>
+	InterpreteResult Execute(Tracer tracer);
+	// Starts at offset with depth values on the stack, which resumes a run
+	// after a side exit.
+	template<typename Tracer>
+	InterpreteResult ExecuteStack(Tracer tracer, std::size_t offset = 0, std::size_t depth = 0);
+	template<typename Tracer>
+	InterpreteResult ExecuteRegisters(Tracer tracer);
+	bool PrepareRegisters();
+	bool PrepareJit();
+	// Sets the state of the current cache entry aside, if any, before
+	// m_chunk is replaced.
+	void Park();
+	// Makes entry, a chunk from the cache, the current chunk.
+	void Enter(std::shared_ptr<const Chunk> entry);
+	InterpreteResult ExecuteJit();
+	// offset is the position of the failing instruction in the chunk.
+	InterpreteResult RuntimeError(const std::string& message, std::size_t offset);
+	InterpreteResult RuntimeError(const std::string& message, const Chunk& chunk, std::size_t offset);
+	// line is 1-based, 0 when unknown.
+	InterpreteResult ReportError(const std::string& message, std::uint32_t line);
 
 private:
-	std::stack<Value> m_values;
-	std::size_t m_index_pc = 0;
-	Byte m_pc = 0;
+	// Contiguous operand stack allocated once; m_stack_top points one past
+	// the top value.
+	std::vector<Value> m_stack;
+	Value* m_stack_top = nullptr;
+	std::ostream* m_trace = nullptr;
+	RingTrace* m_ring = nullptr;
+	OpcodeProfile* m_profile = nullptr;
 	Chunk m_chunk;
+	// Set while Run(Image&) executes the image instead of m_chunk.
+	Image* m_image = nullptr;
+	Engine m_engine = Engine::Stack;
+	// m_chunk translated for the register engine; rebuilt when stale.
+	Chunk m_register_chunk;
+	std::size_t m_registers = 0;
+	std::size_t m_register_results = 0;
+	bool m_registers_ok = false;
+	bool m_register_stale = true;
+	bool m_quickening = true;
+	Optimization m_optimization = Optimization::O1;
+	CompileCache* m_cache = nullptr;
+	// The source m_chunk was compiled from by Run(source), and at which
+	// level; empty once the chunk came from anywhere else.
+	std::optional<std::string> m_source;
+	Optimization m_source_level = Optimization::O1;
+	// The cache entry m_chunk is a copy of; empty once the chunk came from
+	// anywhere else.
+	std::shared_ptr<const Chunk> m_entry;
+	// What runs of another cache entry left, by entry.
+	struct Program {
+		std::shared_ptr<const Chunk> entry;
+		Chunk chunk;
+		std::unique_ptr<Jit> jit;
+		bool jit_failed = false;
+	};
+	std::unordered_map<const Chunk*, Program> m_programs;
+	// Machine code for m_chunk; dropped when it may have changed.
+	std::unique_ptr<Jit> m_jit;
+	std::size_t m_jit_threshold = DefaultJitThreshold;
+	bool m_jit_folding = true;
+	bool m_jit_failed = false;
+	std::uint64_t m_jit_compiled = 0;
+	std::uint64_t m_jit_runs = 0;
+	std::uint64_t m_jit_exits = 0;
+	std::chrono::nanoseconds m_jit_time{ 0 };
 };
 
 }
@@ -0,0 +1,250 @@
+#include <iostream>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include "vm/chunk.hpp"
+#include "vm/compiler.hpp"
+#include "vm/virtual_machine.hpp"
+#include "vm/peephole.hpp"
+
+// Differential check of the register engine against the stack engine.
+// Generates random typed expression programs as bytecode, with the Integer_*
+// and Number_* opcodes on operands of their type, the comparisons in their
+// generic and typed forms, fused superinstructions and operands that make
+// an instruction fail; runs each on both engines, the stack engine
+// twice so its quickened code is checked too, and compares the results
+// value by value. Then compiles random source programs at -O0, -O1 and -O2
+// and checks both engines accept and run them alike.
+//
+// usage: ravi_engine_diff [programs] [seed]
+
+namespace {
+
+	enum class Type { Integer, Number, Bool };
+
+	class Generator {
+
+	public:
+		explicit Generator(std::uint64_t seed) : m_random(seed) { }
+
+		VM::Chunk Program() {
+
+			VM::Chunk chunk;
+			std::size_t expressions = 1 + Below(4);
+
+			for (std::size_t i = 0; i < expressions; i++) {
+				chunk.SetLine(i);
+				Expression(chunk, 1 + Below(6));
+
+				// Some values are left on the stack for the comparison.
+				if (Below(2) == 0)
+					chunk.Write8(VM::OpCode::Pop);
+			}
+
+			chunk.Write8(VM::OpCode::End);
+
+			if (Below(2) == 0)
+				VM::Peephole::Optimize(chunk);
+			return chunk;
+		}
+
+		std::string Source() {
+
+			std::string source;
+			std::size_t statements = 1 + Below(4);
+			for (std::size_t i = 0; i < statements; i++)
+				source += Text(1 + Below(5)) + ";\n";
+			return source;
+		}
+
+	private:
+		std::size_t Below(std::size_t bound) {
+
+			return std::size_t(m_random() % bound);
+		}
+
+		// Emits an expression in postfix order and returns its type.
+		Type Expression(VM::Chunk& chunk, std::size_t depth) {
+
+			if (depth == 0 || Below(4) == 0)
+				return Leaf(chunk);
+
+			if (Below(6) == 0) {
+				Type type = Expression(chunk, depth - 1);
+				// Negating a bool fails; now and then, to check both engines
+				// stop alike.
+				if (type == Type::Bool && Below(8) != 0) {
+					chunk.WriteConstantAuto(Value::Bool(true));
+					chunk.Write8(VM::OpCode::Equal);
+					return Type::Bool;
+				}
+				if (type == Type::Integer && Below(2) == 0) {
+					chunk.Write8(VM::OpCode::Integer_Negate);
+					return Type::Integer;
+				}
+				chunk.Write8(type == Type::Number && Below(2) == 0 ? VM::OpCode::Number_Negate : VM::OpCode::Negate);
+				return Type::Number;
+			}
+
+			Type left = Expression(chunk, depth - 1);
+			Type right = Expression(chunk, depth - 1);
+			bool integers = left == Type::Integer && right == Type::Integer && Below(3) != 0;
+			bool numbers = left == Type::Number && right == Type::Number && Below(2) == 0;
+
+			// Only the equalities take bools.
+			if (left == Type::Bool || right == Type::Bool) {
+				chunk.Write8(Byte(VM::OpCode::Equal + Below(2)));
+				return Type::Bool;
+			}
+
+			if (Below(3) == 0) {
+				std::size_t comparison = Below(6);
+				if (integers)
+					chunk.Write8(Byte(VM::OpCode::Integer_Equal + comparison));
+				else if (numbers)
+					chunk.Write8(Byte(VM::OpCode::Number_Equal + comparison));
+				else
+					chunk.Write8(Byte(VM::OpCode::Equal + comparison));
+				return Type::Bool;
+			}
+
+			std::size_t operation = Below(4);
+			if (integers) {
+				chunk.Write8(Byte(VM::OpCode::Integer_Add + operation));
+				return Type::Integer;
+			}
+			chunk.Write8(Byte((numbers ? VM::OpCode::Number_Add : VM::OpCode::Add) + operation));
+			return Type::Number;
+		}
+
+		Type Leaf(VM::Chunk& chunk) {
+
+			static constexpr double Numbers[] = { 0.0, -0.0, 1.0, -1.0, 2.5, 0.1, 7.0, 1e308, -1e308 };
+			static constexpr std::int32_t Integers[] = { 0, 1, -1, 2, 7, -100, INT32_MAX, INT32_MIN };
+
+			std::size_t kind = Below(64);
+			if (kind == 0) {
+				chunk.WriteConstantAuto(Value::Bool(Below(2) == 0));
+				return Type::Bool;
+			}
+			if (kind < 28) {
+				chunk.WriteConstantAuto(Value::Integer(Below(2) == 0 ? Integers[Below(std::size(Integers))] : std::int32_t(Below(200)) - 100));
+				return Type::Integer;
+			}
+			if (Below(3) == 0)
+				chunk.WriteConstantAuto(Numbers[Below(std::size(Numbers))]);
+			else
+				chunk.WriteConstantAuto(double(std::int64_t(Below(2001)) - 1000) / 8.0);
+			return Type::Number;
+		}
+
+		std::string Text(std::size_t depth) {
+
+			static constexpr const char* Literals[] = { "0", "1", "2", "7", "100", "2147483647", "0.5", "1.25", "3.0" };
+			static constexpr const char* Operators[] = {
+				" + ", " - ", " * ", " / ", " == ", " != ", " < ", " <= ", " > ", " >= "
+			};
+
+			if (depth == 0 || Below(4) == 0)
+				return Literals[Below(std::size(Literals))];
+			if (Below(6) == 0)
+				return "-" + Text(depth - 1);
+			return "(" + Text(depth - 1) + Operators[Below(std::size(Operators))] + Text(depth - 1) + ")";
+		}
+
+	private:
+		std::mt19937_64 m_random;
+	};
+
+	// Bit-identical values, or two NaNs.
+	bool Same(const Value& a, const Value& b) {
+
+		if (a.IsNumber() && b.IsNumber() && a.AsNumber() != a.AsNumber())
+			return b.AsNumber() != b.AsNumber();
+		return a == b;
+	}
+
+	bool Same(const VM::RVM& a, VM::InterpreteResult a_result, const VM::RVM& b, VM::InterpreteResult b_result) {
+
+		if (a_result != b_result)
+			return false;
+		// A failed run stops at the same instruction, but the register engine
+		// keeps no stack to compare.
+		if (a_result != VM::InterpreteResult::OK)
+			return true;
+		if (a.Stack().size() != b.Stack().size())
+			return false;
+		for (std::size_t v = 0; v < a.Stack().size(); v++)
+			if (!Same(a.Stack()[v], b.Stack()[v]))
+				return false;
+		return true;
+	}
+
+}
+
+int main(int argc, char** argv) {
+
+	std::size_t programs = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000;
+	std::uint64_t seed = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1;
+
+	Generator generator(seed);
+	std::size_t errors = 0, mismatches = 0;
+
+	for (std::size_t i = 0; i < programs; i++) {
+
+		VM::Chunk chunk = generator.Program();
+
+		VM::RVM stack(chunk);
+		stack.SetJitThreshold(0);
+		VM::RVM registers(chunk);
+		registers.SetEngine(VM::Engine::Register);
+
+		VM::InterpreteResult expected = stack.Run();
+		VM::InterpreteResult result = registers.Run();
+		errors += expected != VM::InterpreteResult::OK;
+
+		bool same = Same(stack, expected, registers, result);
+		if (same) {
+			VM::InterpreteResult quickened = stack.Run();
+			same = Same(stack, quickened, registers, result);
+		}
+
+		if (!same && mismatches++ == 0) {
+			std::cerr << "Mismatch in program " << i << ":\n";
+			chunk.Disassemble("program");
+			VM::Chunk(registers.RegisterChunk()).Disassemble("registers");
+		}
+	}
+
+	for (std::size_t i = 0; i < programs; i++) {
+
+		std::string source = generator.Source();
+
+		for (VM::Optimization level : { VM::Optimization::O0, VM::Optimization::O1, VM::Optimization::O2 }) {
+
+			VM::Chunk chunk;
+			try {
+				VM::Compiler compiler(chunk, source, nullptr, level);
+				compiler.Compile();
+			}
+			catch (const std::exception&) {
+				continue;
+			}
+
+			VM::RVM stack(chunk);
+			stack.SetJitThreshold(0);
+			VM::RVM registers(chunk);
+			registers.SetEngine(VM::Engine::Register);
+
+			VM::InterpreteResult expected = stack.Run();
+			VM::InterpreteResult result = registers.Run();
+
+			if (!Same(stack, expected, registers, result) && mismatches++ == 0)
+				std::cerr << "Mismatch at -O" << int(level) << " on:\n" << source;
+		}
+	}
+
+	std::cout << programs << " programs and " << programs << " sources at three levels: " << errors
+		<< " programs stopped with a runtime error, " << mismatches << " mismatches\n";
+	return mismatches == 0 ? 0 : 1;
+}
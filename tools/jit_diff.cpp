@@ -0,0 +1,220 @@
+#include <iostream>
+#include <cstdlib>
+#include <random>
+#include "vm/chunk.hpp"
+#include "vm/virtual_machine.hpp"
+#include "vm/peephole.hpp"
+#include "vm/jit.hpp"
+
+// Differential check of the JIT against the interpreter. Generates random
+// expression programs as bytecode (the parser would fold them to constants),
+// runs each on a plain interpreter and on an RVM that compiles it to machine
+// code on its second run, and compares the results value by value. The
+// corpus mixes generic, Integer_* and Number_* opcodes, comparisons,
+// fused superinstructions, stacks deeper than the XMM registers, and
+// integer operands that make the generic guards take side exits. Every program is also compiled without
+// constant folding, which would otherwise leave little code to check.
+//
+// usage: ravi_jit_diff [programs] [seed]
+
+namespace {
+
+	class Generator {
+
+	public:
+		explicit Generator(std::uint64_t seed) : m_random(seed) { }
+
+		VM::Chunk Program() {
+
+			VM::Chunk chunk;
+			std::size_t expressions = 1 + Below(4);
+
+			for (std::size_t i = 0; i < expressions; i++) {
+				chunk.SetLine(i);
+				if (Below(4) == 0)
+					Ladder(chunk, 2 + Below(24));
+				else if (Below(2) == 0)
+					Typed(chunk, 1 + Below(6), Type(Below(3)));
+				else
+					Expression(chunk, 1 + Below(7));
+
+				// Some values are left on the stack for the comparison.
+				if (Below(2) == 0)
+					chunk.Write8(VM::OpCode::Pop);
+			}
+
+			chunk.Write8(VM::OpCode::End);
+
+			if (Below(2) == 0)
+				VM::Peephole::Optimize(chunk);
+			return chunk;
+		}
+
+	private:
+		std::size_t Below(std::size_t bound) {
+
+			return std::size_t(m_random() % bound);
+		}
+
+		// Emits an expression in postfix order and returns whether it is
+		// statically a number, which allows the Number_* opcodes on it.
+		bool Expression(VM::Chunk& chunk, std::size_t depth) {
+
+			if (depth == 0 || Below(4) == 0)
+				return Leaf(chunk);
+
+			if (Below(6) == 0) {
+				bool number = Expression(chunk, depth - 1);
+				chunk.Write8(number && Below(2) == 0 ? VM::OpCode::Number_Negate : VM::OpCode::Negate);
+				return true;
+			}
+
+			bool left = Expression(chunk, depth - 1);
+			bool right = Expression(chunk, depth - 1);
+			std::size_t operation = Below(4);
+			bool specialized = left && right && Below(2) == 0;
+			chunk.Write8(Byte((specialized ? VM::OpCode::Number_Add : VM::OpCode::Add) + operation));
+			return true;
+		}
+
+		// Pushes count values before combining them, so that the stack grows
+		// past the slots kept in registers.
+		void Ladder(VM::Chunk& chunk, std::size_t count) {
+
+			for (std::size_t i = 0; i < count; i++)
+				Leaf(chunk);
+			for (std::size_t i = 1; i < count; i++)
+				chunk.Write8(Byte(VM::OpCode::Add + Below(4)));
+		}
+
+		enum class Type { Integer, Number, Bool };
+
+		// Emits an expression of type the way the compiler does for proven
+		// operands, with the Integer_* and Number_* opcodes, and generic
+		// comparisons on operands of either type.
+		void Typed(VM::Chunk& chunk, std::size_t depth, Type type) {
+
+			static constexpr std::int32_t Integers[] = { 0, 1, -1, 2, 7, INT32_MIN, INT32_MAX };
+
+			if (type == Type::Bool) {
+				Type left = Type(Below(2)), right = Below(4) == 0 ? Type(Below(2)) : left;
+				Typed(chunk, depth > 0 ? depth - 1 : 0, left);
+				Typed(chunk, depth > 0 ? depth - 1 : 0, right);
+				bool generic = left != right || Below(2) == 0;
+				VM::OpCode first = generic ? VM::OpCode::Equal : left == Type::Integer ? VM::OpCode::Integer_Equal : VM::OpCode::Number_Equal;
+				chunk.Write8(Byte(first + Below(6)));
+				return;
+			}
+
+			if (depth == 0 || Below(4) == 0) {
+				if (type == Type::Number)
+					chunk.WriteConstantAuto(Number());
+				else if (Below(3) == 0)
+					chunk.WriteConstantAuto(Value::Integer(Integers[Below(std::size(Integers))]));
+				else
+					chunk.WriteConstantAuto(Value::Integer(std::int32_t(Below(200)) - 100));
+				return;
+			}
+
+			bool integer = type == Type::Integer;
+			if (Below(6) == 0) {
+				Typed(chunk, depth - 1, type);
+				chunk.Write8(integer ? VM::OpCode::Integer_Negate : VM::OpCode::Number_Negate);
+				return;
+			}
+
+			// Integer quotients are often 0, so most divisors are nonzero
+			// constants, -1 included, to keep division by zero rare.
+			std::size_t operation = Below(4);
+			Typed(chunk, depth - 1, type);
+			if (integer && operation == 3 && Below(8) != 0)
+				chunk.WriteConstantAuto(Value::Integer(Below(4) == 0 ? -1 : std::int32_t(1 + Below(100))));
+			else
+				Typed(chunk, depth - 1, type);
+			chunk.Write8(Byte((integer ? VM::OpCode::Integer_Add : VM::OpCode::Number_Add) + operation));
+		}
+
+		bool Leaf(VM::Chunk& chunk) {
+
+			if (Below(16) == 0) {
+				chunk.WriteConstantAuto(Value::Integer(std::int32_t(Below(200)) - 100));
+				return false;
+			}
+
+			chunk.WriteConstantAuto(Number());
+			return true;
+		}
+
+		double Number() {
+
+			static constexpr double Numbers[] = { 0.0, -0.0, 1.0, -1.0, 2.5, 0.1, 7.0, 1e308, -1e308, 1e-308 };
+
+			if (Below(3) == 0)
+				return Numbers[Below(std::size(Numbers))];
+			return double(std::int64_t(Below(2001)) - 1000) / 8.0;
+		}
+
+	private:
+		std::mt19937_64 m_random;
+	};
+
+	// Bit-identical values, or two NaNs: the NaN an operation propagates
+	// depends on the order the compiler picked for its operands.
+	bool Same(const Value& a, const Value& b) {
+
+		if (a.IsNumber() && b.IsNumber() && a.AsNumber() != a.AsNumber())
+			return b.AsNumber() != b.AsNumber();
+		return a == b;
+	}
+
+}
+
+int main(int argc, char** argv) {
+
+	std::size_t programs = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000;
+	std::uint64_t seed = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1;
+
+	if (!VM::Jit::Available()) {
+		std::cerr << "The JIT is not available on this platform.\n";
+		return 0;
+	}
+
+	Generator generator(seed);
+	std::size_t compiled = 0, exited = 0, mismatches = 0;
+
+	for (std::size_t i = 0; i < programs; i++) {
+
+		VM::Chunk chunk = generator.Program();
+
+		VM::RVM interpreter(chunk);
+		interpreter.SetJitThreshold(0);
+		VM::InterpreteResult expected = interpreter.Run();
+
+		// The first run is interpreted and may quicken the code the JIT then
+		// translates. Each program is compiled with and without folding.
+		for (bool fold : { true, false }) {
+
+			VM::RVM jit(chunk);
+			jit.SetJitThreshold(2);
+			jit.SetJitFolding(fold);
+			jit.Run();
+			VM::InterpreteResult result = jit.Run();
+
+			compiled += jit.JitRuns();
+			exited += jit.JitExits();
+
+			bool same = result == expected && jit.Stack().size() == interpreter.Stack().size();
+			for (std::size_t v = 0; same && v < jit.Stack().size(); v++)
+				same = Same(jit.Stack()[v], interpreter.Stack()[v]);
+
+			if (!same && mismatches++ == 0) {
+				std::cerr << "Mismatch in program " << i << (fold ? "" : " without folding") << ":\n";
+				chunk.Disassemble("program");
+			}
+		}
+	}
+
+	std::cout << programs << " programs, twice: " << compiled << " ran as machine code, " << exited << " resumed after a side exit, "
+		<< 2 * programs - compiled - exited << " not compiled, " << mismatches << " mismatches\n";
+	return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,97 @@
+#include <iostream>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include "vm/driver.hpp"
+#include "vm/memory.hpp"
+#include "vm/trace.hpp"
+#include "vm/register_compiler.hpp"
+
+// Renders a ring trace written by 'ravi --trace-ring=<file>' with the
+// disassembler and line table of the program that produced it. The program
+// is recompiled from source at the optimization level recorded in the
+// trace, which yields the same chunk as the traced run; -O0, -O1 or -O2
+// overrides it. Pass --register for traces of runs on the register engine.
+// The top of the stack is shown for runs traced with --trace-top.
+//
+// usage: ravi_trace_decode [--register] [-O0|-O1|-O2] <trace> <source>
+
+int main(int argc, char** argv) {
+
+	bool registers = false;
+	int override = -1;
+
+	for (; argc > 3; argv++, argc--) {
+		std::string_view arg = argv[1];
+		if (arg == "--register")
+			registers = true;
+		else if (arg.size() == 3 && arg.substr(0, 2) == "-O" && arg[2] >= '0' && arg[2] <= '2')
+			override = arg[2] - '0';
+		else
+			break;
+	}
+
+	if (argc != 3) {
+		std::cerr << "usage: " << argv[0] << " [--register] [-O0|-O1|-O2] <trace> <source>\n";
+		return 2;
+	}
+
+	std::uint64_t count = 0;
+	VM::Optimization level = VM::Optimization::O1;
+	bool top_captured = false;
+	std::vector<VM::TraceRecord> records;
+
+	try {
+		records = VM::RingTrace::Load(argv[1], &count, &level, &top_captured);
+	}
+	catch (const std::runtime_error& e) {
+		std::cerr << "Error: " << e.what() << "\n";
+		return 1;
+	}
+
+	if (override >= 0)
+		level = VM::Optimization(override);
+
+	VM::Driver::Unit unit;
+	unit.path = argv[2];
+	if (!VM::Driver::Compile(unit, level)) {
+		for (const std::string& message : unit.diagnostics.Messages())
+			std::cerr << unit.path << ": " << message << "\n";
+		return 1;
+	}
+
+	VM::Chunk register_chunk;
+	if (registers && !VM::RegisterCompiler(unit.chunk, register_chunk).Compile()) {
+		std::cerr << "Error: " << unit.path << " cannot run on the register engine\n";
+		return 1;
+	}
+
+	const VM::Chunk& chunk = registers ? register_chunk : unit.chunk;
+	std::uint64_t sequence = count - records.size();
+
+	std::cout << count << " instructions executed at -O" << int(level) << ", showing the last " << records.size() << "\n";
+
+	std::string out;
+	char buffer[64];
+	for (const VM::TraceRecord& record : records) {
+
+		std::snprintf(buffer, sizeof(buffer), "#%-10llu depth %-5u ", static_cast<unsigned long long>(sequence++), record.depth);
+		out += buffer;
+
+		std::string top = top_captured && record.depth > 0 ? "top " + VM::Memory::ToString(record.top) : "";
+		std::snprintf(buffer, sizeof(buffer), "%-17s", top.c_str());
+		out += buffer;
+
+		if (record.offset >= chunk.Size() || chunk.At(record.offset) != record.opcode) {
+			std::snprintf(buffer, sizeof(buffer), "%04u opcode %u (does not match the source)\n", record.offset, record.opcode);
+			out += buffer;
+			continue;
+		}
+
+		chunk.Disassemble(record.offset, out);
+	}
+
+	std::fwrite(out.data(), 1, out.size(), stdout);
+	return 0;
+}